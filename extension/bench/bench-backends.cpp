@@ -0,0 +1,149 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "bench.h"
+#include "watcher.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <fstream>
+#include <unistd.h>
+#endif
+
+// Builds a large tree and measures, per backend, how long a watch takes to
+// arm and how much memory it holds on to. inotify needs a kernel watch and a
+// tree node for every directory; fanotify needs one mark. Set
+// BENCH_DIRECTORIES to change the size of the tree.
+
+#ifdef __linux__
+namespace
+{
+    namespace fs = std::filesystem;
+
+    constexpr size_t kDefaultDirectories = 100000;
+    constexpr size_t kDirectoriesPerParent = 1000;
+
+    size_t GetResidentBytes()
+    {
+        size_t pages = 0, resident = 0;
+        std::ifstream("/proc/self/statm") >> pages >> resident;
+
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    void Run(const char *name, const fs::path &root, size_t directories, DirectoryWatcher::WatchBackend backend)
+    {
+        DirectoryWatcher watcher;
+        DirectoryWatcher::WatchOptions options = {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192};
+        options.backend = backend;
+
+        auto registry = WatchRegistry::Acquire();
+        size_t baseWatches = registry->GetWatchCount();
+        size_t baseResident = GetResidentBytes();
+        uint64_t start = NowNanoseconds();
+
+        if (!watcher.Watch(root, options))
+        {
+            std::printf("  %-9s failed to start\n", name);
+            return;
+        }
+
+        if (watcher.GetBackend() != backend)
+        {
+            std::printf("  %-9s unavailable here\n", name);
+            return;
+        }
+
+        while (!watcher.GetWatchProgress().armed)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+
+        uint64_t elapsed = NowNanoseconds() - start;
+        auto progress = watcher.GetWatchProgress();
+
+        std::printf("  %-9s armed in %8.1f ms | %zu of %zu directories listed, %zu kernel watches | +%zu KB resident\n",
+                    name,
+                    elapsed / 1e6,
+                    progress.registeredDirectories,
+                    directories,
+                    registry->GetWatchCount() - baseWatches,
+                    (GetResidentBytes() - std::min(GetResidentBytes(), baseResident)) / 1024);
+
+        watcher.StopWatching();
+    }
+}
+
+BENCHMARK(BackendArmTime)
+{
+    size_t directories = kDefaultDirectories;
+    if (const char *value = std::getenv("BENCH_DIRECTORIES"))
+    {
+        directories = std::strtoul(value, nullptr, 10);
+    }
+
+    char temp[] = "/tmp/watcherbenchXXXXXX";
+    if (!mkdtemp(temp))
+    {
+        return;
+    }
+
+    fs::path root = temp;
+    uint64_t start = NowNanoseconds();
+
+    for (size_t i = 0; i < directories; i++)
+    {
+        fs::path parent = root / ("d" + std::to_string(i / kDirectoriesPerParent));
+        if (i % kDirectoriesPerParent == 0)
+        {
+            fs::create_directory(parent);
+        }
+
+        fs::create_directory(parent / std::to_string(i % kDirectoriesPerParent));
+    }
+
+    size_t limit = 0;
+    std::ifstream("/proc/sys/fs/inotify/max_user_watches") >> limit;
+
+    std::printf("  %zu directories built in %.1f ms, max_user_watches is %zu\n",
+                directories, (NowNanoseconds() - start) / 1e6, limit);
+
+    Run("inotify", root, directories, DirectoryWatcher::WatchBackend::kInotify);
+    Run("fanotify", root, directories, DirectoryWatcher::WatchBackend::kFanotify);
+    Run("polling", root, directories, DirectoryWatcher::WatchBackend::kPolling);
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+}
+#endif
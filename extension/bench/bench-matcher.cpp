@@ -0,0 +1,194 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "bench.h"
+#include "pathmatcher.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fnmatch.h>
+#endif
+
+// Measures how fast PathMatcher turns away or accepts paths with a few
+// hundred patterns loaded, the way a plugin that filters a large tree would.
+// On Linux, trying every pattern with fnmatch(3) is shown for comparison.
+
+namespace
+{
+    constexpr size_t kPaths = 20000;
+    constexpr size_t kRounds = 10;
+
+    void MakePatterns(std::vector<std::string> &includes, std::vector<std::string> &excludes)
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            includes.push_back("*.ext" + std::to_string(i));
+            includes.push_back("config_" + std::to_string(i) + ".cfg");
+            includes.push_back("maps/**/level_" + std::to_string(i) + "_*.bsp");
+        }
+
+        for (int i = 0; i < 50; i++)
+        {
+            excludes.push_back("cache" + std::to_string(i) + "/**");
+            excludes.push_back("*.tmp" + std::to_string(i));
+        }
+    }
+
+    void MakePaths(std::vector<std::string> &paths)
+    {
+        uint32_t seed = 12345;
+        for (size_t i = 0; i < kPaths; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t n = (seed >> 8) % 200;
+
+            switch (seed % 5)
+            {
+            case 0:
+                paths.push_back("materials/models/props/file_" + std::to_string(n) + ".ext" + std::to_string(n));
+                break;
+            case 1:
+                paths.push_back("cfg/config_" + std::to_string(n) + ".cfg");
+                break;
+            case 2:
+                paths.push_back("maps/workshop/" + std::to_string(seed % 997) + "/level_" + std::to_string(n) + "_final.bsp");
+                break;
+            case 3:
+                paths.push_back("cache" + std::to_string(n % 60) + "/sound/file_" + std::to_string(n) + ".ext1");
+                break;
+            default:
+                paths.push_back("logs/L" + std::to_string(seed) + ".log");
+                break;
+            }
+        }
+    }
+
+    template <typename F>
+    void Run(const char *name, const std::vector<std::string> &paths, F &&isAccepted)
+    {
+        size_t accepted = 0;
+        uint64_t start = NowNanoseconds();
+
+        for (size_t round = 0; round < kRounds; round++)
+        {
+            for (auto it = paths.begin(); it != paths.end(); it++)
+            {
+                accepted += isAccepted(*it) ? 1 : 0;
+            }
+        }
+
+        uint64_t elapsed = NowNanoseconds() - start;
+        size_t checks = paths.size() * kRounds;
+
+        std::printf("  %-8s %8.1f ns/path  %7.2f M paths/s | accepted %zu of %zu\n",
+                    name,
+                    (double)elapsed / checks,
+                    checks / (elapsed / 1e3),
+                    accepted / kRounds,
+                    paths.size());
+    }
+}
+
+BENCHMARK(PathMatcherThroughput)
+{
+    std::vector<std::string> includes, excludes, paths;
+    MakePatterns(includes, excludes);
+    MakePaths(paths);
+
+    std::printf("  %zu include and %zu exclude patterns, %zu paths x %zu rounds\n",
+                includes.size(), excludes.size(), paths.size(), kRounds);
+
+    PathMatcher matcher;
+    for (auto it = includes.begin(); it != includes.end(); it++)
+    {
+        matcher.AddInclude(it->c_str());
+    }
+
+    for (auto it = excludes.begin(); it != excludes.end(); it++)
+    {
+        matcher.AddExclude(it->c_str());
+    }
+
+    Run("matcher", paths, [&matcher](const std::string &path)
+        { return matcher.IsAccepted(path.data(), path.size()); });
+
+#ifdef __linux__
+    // fnmatch has no "**" and matches whole paths, so patterns are given the
+    // closest equivalents: "*" across separators, and a "*/" prefix for name
+    // patterns. Only the cost is comparable, not the exact results.
+    auto toFnmatch = [](const std::string &pattern)
+    {
+        std::string out = pattern.find('/') == std::string::npos ? "*" + pattern : pattern;
+        size_t pos;
+        while ((pos = out.find("**")) != std::string::npos)
+        {
+            out.erase(pos, 1);
+        }
+
+        return out;
+    };
+
+    std::vector<std::string> fnIncludes, fnExcludes;
+    for (auto it = includes.begin(); it != includes.end(); it++)
+    {
+        fnIncludes.push_back(toFnmatch(*it));
+    }
+
+    for (auto it = excludes.begin(); it != excludes.end(); it++)
+    {
+        fnExcludes.push_back(toFnmatch(*it));
+    }
+
+    Run("fnmatch", paths, [&](const std::string &path)
+        {
+            bool included = false;
+            for (auto it = fnIncludes.begin(); it != fnIncludes.end() && !included; it++)
+            {
+                included = fnmatch(it->c_str(), path.c_str(), 0) == 0;
+            }
+
+            if (!included)
+            {
+                return false;
+            }
+
+            for (auto it = fnExcludes.begin(); it != fnExcludes.end(); it++)
+            {
+                if (fnmatch(it->c_str(), path.c_str(), 0) == 0)
+                {
+                    return false;
+                }
+            }
+
+            return true; });
+#endif
+}
@@ -0,0 +1,212 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "bench.h"
+#include "queue.h"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+// Compares the old mutex-guarded std::queue transport against BoundedQueue
+// under a burst from several producer threads while the consumer simulates
+// game frames that run a callback per event.
+
+namespace
+{
+    constexpr size_t kProducers = 4;
+    constexpr size_t kBatchesPerProducer = 20000;
+    constexpr size_t kEventsPerBatch = 16;
+
+    // Time a producer spends parsing between batches, and a consumer spends in
+    // a plugin callback per event.
+    constexpr uint64_t kProducerWorkNs = 20000;
+    constexpr uint64_t kCallbackNs = 50;
+    constexpr auto kFrameInterval = std::chrono::milliseconds(1);
+
+    typedef std::vector<uint64_t> Batch;
+
+    // Mirrors the previous DirectoryWatcher design: producers lock once per
+    // batch and the consumer holds the lock while draining and dispatching.
+    class MutexTransport
+    {
+    public:
+        bool Push(std::unique_ptr<Batch> &&batch)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push(std::move(batch));
+            return true;
+        }
+
+        template <typename F>
+        void Drain(F callback)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            while (!queue.empty())
+            {
+                callback(*queue.front());
+                queue.pop();
+            }
+        }
+
+    private:
+        std::mutex mutex;
+        std::queue<std::unique_ptr<Batch>> queue;
+    };
+
+    class RingTransport
+    {
+    public:
+        RingTransport() : queue(1024) {}
+
+        bool Push(std::unique_ptr<Batch> &&batch)
+        {
+            return queue.TryPush(std::move(batch));
+        }
+
+        template <typename F>
+        void Drain(F callback)
+        {
+            std::unique_ptr<Batch> batch;
+            while (queue.TryPop(batch))
+            {
+                callback(*batch);
+            }
+        }
+
+    private:
+        BoundedQueue<std::unique_ptr<Batch>> queue;
+    };
+
+    template <typename Transport>
+    void Run(const char *name)
+    {
+        Transport transport;
+        std::atomic<size_t> producersDone(0);
+        std::atomic<size_t> dropped(0);
+        std::vector<std::vector<uint64_t>> pushLatencies(kProducers);
+        std::vector<std::thread> producers;
+
+        uint64_t start = NowNanoseconds();
+
+        for (size_t i = 0; i < kProducers; i++)
+        {
+            pushLatencies[i].reserve(kBatchesPerProducer);
+
+            producers.emplace_back([&, i]()
+            {
+                for (size_t j = 0; j < kBatchesPerProducer; j++)
+                {
+                    SpinFor(kProducerWorkNs);
+
+                    auto batch = std::make_unique<Batch>(kEventsPerBatch, j);
+
+                    uint64_t pushStart = NowNanoseconds();
+                    if (!transport.Push(std::move(batch)))
+                    {
+                        dropped.fetch_add(kEventsPerBatch);
+                    }
+                    pushLatencies[i].push_back(NowNanoseconds() - pushStart);
+                }
+
+                producersDone.fetch_add(1);
+            });
+        }
+
+        size_t consumed = 0;
+        std::vector<uint64_t> frameTimes;
+
+        for (;;)
+        {
+            bool finished = producersDone.load() == kProducers;
+
+            uint64_t frameStart = NowNanoseconds();
+            transport.Drain([&](const Batch &batch)
+            {
+                for (size_t k = 0; k < batch.size(); k++)
+                {
+                    SpinFor(kCallbackNs);
+                }
+
+                consumed += batch.size();
+            });
+            frameTimes.push_back(NowNanoseconds() - frameStart);
+
+            if (finished)
+            {
+                break;
+            }
+
+            std::this_thread::sleep_for(kFrameInterval);
+        }
+
+        for (auto it = producers.begin(); it != producers.end(); it++)
+        {
+            it->join();
+        }
+
+        uint64_t elapsed = NowNanoseconds() - start;
+
+        std::vector<uint64_t> latencies;
+        for (auto it = pushLatencies.begin(); it != pushLatencies.end(); it++)
+        {
+            latencies.insert(latencies.end(), it->begin(), it->end());
+        }
+
+        uint64_t latencySum = 0;
+        for (auto it = latencies.begin(); it != latencies.end(); it++)
+        {
+            latencySum += *it;
+        }
+
+        std::printf("  %-8s wall %7.1f ms | push avg %6llu ns  p99 %8llu ns  max %8llu ns | frame p99 %7llu us  max %7llu us | consumed %zu dropped %zu\n",
+                    name,
+                    elapsed / 1e6,
+                    (unsigned long long)(latencySum / latencies.size()),
+                    (unsigned long long)Percentile(latencies, 99.0),
+                    (unsigned long long)Percentile(latencies, 100.0),
+                    (unsigned long long)(Percentile(frameTimes, 99.0) / 1000),
+                    (unsigned long long)(Percentile(frameTimes, 100.0) / 1000),
+                    consumed,
+                    dropped.load());
+    }
+}
+
+BENCHMARK(EventQueueContention)
+{
+    std::printf("  %zu producers x %zu batches x %zu events, %llu ns per callback\n",
+                kProducers, kBatchesPerProducer, kEventsPerBatch, (unsigned long long)kCallbackNs);
+
+    Run<MutexTransport>("mutex");
+    Run<RingTransport>("ring");
+}
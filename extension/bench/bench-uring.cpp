@@ -0,0 +1,268 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "bench.h"
+#include "watcher.h"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Counts the system calls the reactor thread makes to deliver the same
+// bursts of changes to several watchers, with epoll and with io_uring. The
+// workload runs in a child traced with ptrace, which stops it at every
+// system call, so only the counts mean anything; timings under a tracer
+// don't. The child marks the measured part by calling getppid().
+
+#ifdef __linux__
+namespace
+{
+    namespace fs = std::filesystem;
+
+    constexpr int kWatchers = 8;
+    constexpr int kBursts = 200;
+    constexpr int kFilesPerBurst = 4;
+
+    struct SyscallCounts
+    {
+        size_t wait = 0;
+        size_t read = 0;
+        size_t ioctl = 0;
+        size_t enter = 0;
+        size_t other = 0;
+
+        size_t GetTotal() const { return wait + read + ioctl + enter + other; }
+    };
+
+    void RunWorkload(const fs::path &root, EventReactor::Backend backend)
+    {
+        EventReactor::SetPreferredBackend(backend);
+
+        DirectoryWatcher watchers[kWatchers];
+        for (int i = 0; i < kWatchers; i++)
+        {
+            fs::path dir = root / std::to_string(i);
+            fs::create_directory(dir);
+
+            watchers[i].Watch(dir, {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192});
+        }
+
+        for (int i = 0; i < kWatchers; i++)
+        {
+            while (!watchers[i].GetWatchProgress().armed)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        if (EventReactor::Acquire()->GetBackend() != backend)
+        {
+            _exit(2);
+        }
+
+        getppid();
+
+        // Each burst touches a file in every directory, then leaves the
+        // reactor time to go back to sleep.
+        for (int burst = 0; burst < kBursts; burst++)
+        {
+            for (int i = 0; i < kWatchers; i++)
+            {
+                std::string path = (root / std::to_string(i) / ("file_" + std::to_string(burst % kFilesPerBurst))).string();
+                close(open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644));
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        getppid();
+
+        for (int i = 0; i < kWatchers; i++)
+        {
+            watchers[i].StopWatching();
+        }
+
+        _exit(0);
+    }
+
+    // Counts system call entries on every thread but the child's main one
+    // while it is between its two markers.
+    bool Trace(pid_t child, SyscallCounts &counts)
+    {
+        int status;
+        if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status))
+        {
+            return false;
+        }
+
+        ptrace(PTRACE_SETOPTIONS, child, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+        ptrace(PTRACE_SYSCALL, child, nullptr, nullptr);
+
+        bool measuring = false;
+        bool succeeded = false;
+
+        for (;;)
+        {
+            pid_t tid = waitpid(-1, &status, __WALL);
+            if (tid == -1)
+            {
+                break;
+            }
+
+            if (WIFEXITED(status) || WIFSIGNALED(status))
+            {
+                if (tid == child)
+                {
+                    succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                }
+
+                continue;
+            }
+
+            int signal = WSTOPSIG(status);
+            if (signal == (SIGTRAP | 0x80))
+            {
+                __ptrace_syscall_info info;
+                if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY)
+                {
+                    long nr = (long)info.entry.nr;
+                    if (tid == child)
+                    {
+                        if (nr == SYS_getppid)
+                        {
+                            measuring = !measuring;
+                        }
+                    }
+                    else if (measuring)
+                    {
+                        if (nr == SYS_epoll_wait || nr == SYS_epoll_pwait)
+                        {
+                            counts.wait++;
+                        }
+                        else if (nr == SYS_read)
+                        {
+                            counts.read++;
+                        }
+                        else if (nr == SYS_ioctl)
+                        {
+                            counts.ioctl++;
+                        }
+                        else if (nr == SYS_io_uring_enter)
+                        {
+                            counts.enter++;
+                        }
+                        else
+                        {
+                            counts.other++;
+                        }
+                    }
+                }
+
+                signal = 0;
+            }
+            else if (signal == SIGTRAP || signal == SIGSTOP)
+            {
+                // Clone events, and the stop new threads start with.
+                signal = 0;
+            }
+
+            ptrace(PTRACE_SYSCALL, tid, nullptr, signal);
+        }
+
+        return succeeded;
+    }
+
+    void Run(const char *name, const fs::path &root, EventReactor::Backend backend)
+    {
+        fflush(stdout);
+
+        pid_t child = fork();
+        if (child == -1)
+        {
+            return;
+        }
+
+        if (child == 0)
+        {
+            ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+            raise(SIGSTOP);
+            RunWorkload(root / name, backend);
+        }
+
+        fs::create_directory(root / name);
+
+        SyscallCounts counts;
+        if (!Trace(child, counts))
+        {
+            std::printf("  %-9s unavailable here\n", name);
+            return;
+        }
+
+        std::printf("  %-9s %6zu calls, %5.2f per burst | wait %zu, read %zu, ioctl %zu, io_uring_enter %zu, other %zu\n",
+                    name,
+                    counts.GetTotal(),
+                    (double)counts.GetTotal() / kBursts,
+                    counts.wait,
+                    counts.read,
+                    counts.ioctl,
+                    counts.enter,
+                    counts.other);
+    }
+}
+
+BENCHMARK(ReactorSyscalls)
+{
+    char temp[] = "/tmp/watcherbenchXXXXXX";
+    if (!mkdtemp(temp))
+    {
+        return;
+    }
+
+    fs::path root = temp;
+
+    std::printf("  %d watchers, %d bursts of one change each\n", kWatchers, kBursts);
+
+    Run("epoll", root, EventReactor::kEpoll);
+    Run("io_uring", root, EventReactor::kIoUring);
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+}
+#endif
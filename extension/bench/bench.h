@@ -0,0 +1,75 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+typedef void (*BenchmarkFunc)();
+
+// Benchmarks register themselves at static initialization time through the
+// BENCHMARK macro, in the same spirit as gtest's TEST.
+struct BenchmarkRegistration
+{
+    BenchmarkRegistration(const char *name, BenchmarkFunc func);
+
+    const char *name;
+    BenchmarkFunc func;
+    BenchmarkRegistration *next;
+};
+
+#define BENCHMARK(name)                                                             \
+    static void Benchmark_##name();                                                 \
+    static BenchmarkRegistration benchmarkRegistration_##name(#name, &Benchmark_##name); \
+    static void Benchmark_##name()
+
+inline uint64_t NowNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Busy-waits instead of sleeping so that the cost being simulated shows up as
+// real CPU work.
+inline void SpinFor(uint64_t nanoseconds)
+{
+    uint64_t end = NowNanoseconds() + nanoseconds;
+    while (NowNanoseconds() < end)
+    {
+    }
+}
+
+// Returns the value at the given percentile (0-100). Sorts the samples.
+uint64_t Percentile(std::vector<uint64_t> &samples, double percentile);
+
+#endif // BENCH_H_
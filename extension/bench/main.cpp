@@ -0,0 +1,97 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "bench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    BenchmarkRegistration *benchmarks = nullptr;
+}
+
+BenchmarkRegistration::BenchmarkRegistration(const char *name, BenchmarkFunc func)
+    : name(name), func(func), next(benchmarks)
+{
+    benchmarks = this;
+}
+
+uint64_t Percentile(std::vector<uint64_t> &samples, double percentile)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    size_t index = (size_t)((percentile / 100.0) * (samples.size() - 1));
+    return samples[index];
+}
+
+int main(int argc, char **argv)
+{
+    // Registration order is reversed by the linked list, so collect first.
+    std::vector<BenchmarkRegistration *> list;
+    for (auto it = benchmarks; it != nullptr; it = it->next)
+    {
+        list.push_back(it);
+    }
+
+    std::reverse(list.begin(), list.end());
+
+    for (auto it = list.begin(); it != list.end(); it++)
+    {
+        auto benchmark = *it;
+
+        // Any arguments act as substring filters on benchmark names.
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+        {
+            if (std::strstr(benchmark->name, argv[i]))
+            {
+                selected = true;
+                break;
+            }
+        }
+
+        if (!selected)
+        {
+            continue;
+        }
+
+        std::printf("[ RUN      ] %s\n", benchmark->name);
+        benchmark->func();
+        std::printf("[     DONE ] %s\n\n", benchmark->name);
+    }
+
+    return 0;
+}
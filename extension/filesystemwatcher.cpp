@@ -28,16 +28,54 @@
  */
 
 #include "filesystemwatcher.h"
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include "smsdk_ext.h"
 
 namespace fs = std::filesystem;
 
+void SMChangeList::Add(const DirectoryWatcher::NotifyEvent &event)
+{
+    Entry entry;
+    entry.flags = event.flags;
+
+    entry.pathOffset = (uint32_t)slab.size();
+    event.AppendRelativePath(slab);
+    slab.push_back('\0');
+
+    entry.lastPathOffset = (uint32_t)slab.size();
+    event.AppendRelativeLastPath(slab);
+    slab.push_back('\0');
+
+    entry.contents = kNoContents;
+
+    auto fileContents = event.GetContents();
+    if (fileContents)
+    {
+        contents.push_back(std::move(fileContents));
+        entry.contents = (uint32_t)(contents.size() - 1);
+    }
+
+    entries.push_back(entry);
+}
+
+std::shared_ptr<const FileContents> SMChangeList::GetContents(size_t index) const
+{
+    uint32_t at = entries[index].contents;
+    if (at == kNoContents)
+    {
+        return nullptr;
+    }
+
+    return contents[at];
+}
+
 SMDirectoryWatcher::SMDirectoryWatcher(const fs::path &path)
     : DirectoryWatcher(),
       gamePath(fs::path(path).lexically_normal()),
       watching(false),
-      options{false, true, kNone, 8192},
+      options{false, true, kNone, 8192, 0, 0},
       handle(0),
       owningContext(nullptr),
       onStarted(nullptr),
@@ -46,7 +84,15 @@ SMDirectoryWatcher::SMDirectoryWatcher(const fs::path &path)
       onDeleted(nullptr),
       onModified(nullptr),
 
-      onRenamed(nullptr)
+      onRenamed(nullptr),
+      onOverflow(nullptr),
+      onChangesBatch(nullptr),
+      onQueueOverflow(nullptr),
+      dispatchedEvent(nullptr),
+      skippedFrames(0),
+      budgetOverruns(0),
+      reportedDrops(0),
+      slowEvents(0)
 {
 }
 
@@ -60,6 +106,37 @@ bool SMDirectoryWatcher::Start()
     fs::path absPath(g_pSM->GetGamePath());
     absPath = absPath.lexically_normal() / gamePath;
 
+    options.pathMatcher.reset();
+    if (!includePatterns.empty() || !excludePatterns.empty())
+    {
+        auto matcher = std::make_shared<PathMatcher>();
+
+        for (auto it = includePatterns.begin(); it != includePatterns.end(); it++)
+        {
+            matcher->AddInclude(it->c_str());
+        }
+
+        for (auto it = excludePatterns.begin(); it != excludePatterns.end(); it++)
+        {
+            matcher->AddExclude(it->c_str());
+        }
+
+        options.pathMatcher = matcher;
+    }
+
+    options.directoryFilter.reset();
+    if (!excludedDirectories.empty())
+    {
+        auto filter = std::make_shared<PathMatcher>();
+
+        for (auto it = excludedDirectories.begin(); it != excludedDirectories.end(); it++)
+        {
+            filter->AddExclude(it->c_str());
+        }
+
+        options.directoryFilter = filter;
+    }
+
     if (!Watch(absPath, options))
     {
         return false;
@@ -81,12 +158,98 @@ void SMDirectoryWatcher::Stop()
     StopWatching();
 }
 
-void SMDirectoryWatcher::OnGameFrame(bool simulating)
+void SMDirectoryWatcher::OnGameFrame(bool simulating, std::chrono::steady_clock::time_point deadline)
 {
     if (IsWatching())
     {
-        ProcessEvents();
+        ProcessEvents(deadline);
+        ReportDroppedEvents(false);
+
+        if (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() > deadline)
+        {
+            budgetOverruns++;
+        }
+    }
+
+    DeliverChanges();
+}
+
+void SMDirectoryWatcher::ReportDroppedEvents(bool resyncRequired)
+{
+    size_t dropped = GetDroppedEventCount();
+    if (dropped == reportedDrops && !resyncRequired)
+    {
+        return;
+    }
+
+    size_t count = dropped - reportedDrops;
+    reportedDrops = dropped;
+
+    if (onQueueOverflow && onQueueOverflow->IsRunnable())
+    {
+        onQueueOverflow->PushCell(handle);
+        onQueueOverflow->PushCell((cell_t)count);
+        onQueueOverflow->PushCell(resyncRequired);
+        onQueueOverflow->Execute(nullptr);
+    }
+}
+
+void SMDirectoryWatcher::CheckLatency(const NotifyEvent &event)
+{
+    auto threshold = g_FileSystemWatchers.GetLatencyWarning();
+    auto latency = event.GetDispatchTime() - event.GetReadTime();
+    if (!threshold.count() || latency < threshold)
+    {
+        return;
+    }
+
+    slowEvents++;
+
+    // A backlog makes every change in it late; one line covers them all.
+    if (event.GetDispatchTime() < nextLatencyWarning)
+    {
+        return;
+    }
+
+    nextLatencyWarning = event.GetDispatchTime() + kLatencyWarningInterval;
+
+    std::string relPath;
+    event.AppendRelativePath(relPath);
+
+    smutils->LogMessage(myself, "Warning: change to \"%s\" in \"%s\" took %lld ms to dispatch (%lld ms before it was queued); %zu change(s) so far took over %lld ms",
+                        relPath.c_str(), gamePath.string().c_str(),
+                        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(latency).count(),
+                        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(event.GetQueueTime() - event.GetReadTime()).count(),
+                        slowEvents, (long long)threshold.count());
+}
+
+void SMDirectoryWatcher::DeliverChanges()
+{
+    if (!pendingChanges || pendingChanges->IsEmpty())
+    {
+        return;
+    }
+
+    std::unique_ptr<SMChangeList> changes = std::move(pendingChanges);
+    if (!onChangesBatch || !onChangesBatch->IsRunnable())
+    {
+        return;
+    }
+
+    IPluginContext *context = onChangesBatch->GetParentContext();
+    SourceMod::Handle_t changesHandle = g_FileSystemWatchers.CreateChanges(context, changes.release());
+    if (!changesHandle)
+    {
+        return;
     }
+
+    onChangesBatch->PushCell(handle);
+    onChangesBatch->PushCell(changesHandle);
+    onChangesBatch->Execute(nullptr);
+
+    // Only good for the callback; a plugin that wants to keep the changes
+    // clones the handle.
+    g_FileSystemWatchers.FreeChanges(context, changesHandle);
 }
 
 void SMDirectoryWatcher::OnPluginUnloaded(SourceMod::IPlugin *plugin)
@@ -128,19 +291,57 @@ void SMDirectoryWatcher::OnPluginUnloaded(SourceMod::IPlugin *plugin)
     {
         onRenamed = nullptr;
     }
+
+    if (onOverflow && onOverflow->GetParentContext() == context)
+    {
+        onOverflow = nullptr;
+    }
+
+    if (onChangesBatch && onChangesBatch->GetParentContext() == context)
+    {
+        onChangesBatch = nullptr;
+    }
+
+    if (onQueueOverflow && onQueueOverflow->GetParentContext() == context)
+    {
+        onQueueOverflow = nullptr;
+    }
 }
 
 void SMDirectoryWatcher::OnProcessEvent(const NotifyEvent &event)
 {
+    // Changes gathered so far go out ahead of anything else, so the plugin
+    // sees everything in the order it happened.
+    if (event.type != kFilesystem)
+    {
+        DeliverChanges();
+    }
+
     switch (event.type)
     {
     case kFilesystem:
     {
+        CheckLatency(event);
+
+        if (onChangesBatch && onChangesBatch->IsRunnable())
+        {
+            if (!pendingChanges)
+            {
+                pendingChanges = std::make_unique<SMChangeList>();
+            }
+
+            pendingChanges->Add(event);
+            break;
+        }
+
+        dispatchedEvent = &event;
+
         if (event.flags & kCreated)
         {
             if (onCreated && onCreated->IsRunnable())
             {
-                auto relPath = fs::path(event.path).lexically_relative(g_pSM->GetGamePath() / gamePath).string();
+                std::string relPath;
+                event.AppendRelativePath(relPath);
 
                 onCreated->PushCell(handle);
                 onCreated->PushString(relPath.c_str());
@@ -152,7 +353,8 @@ void SMDirectoryWatcher::OnProcessEvent(const NotifyEvent &event)
         {
             if (onDeleted && onDeleted->IsRunnable())
             {
-                auto relPath = fs::path(event.path).lexically_relative(g_pSM->GetGamePath() / gamePath).string();
+                std::string relPath;
+                event.AppendRelativePath(relPath);
 
                 onDeleted->PushCell(handle);
                 onDeleted->PushString(relPath.c_str());
@@ -164,7 +366,8 @@ void SMDirectoryWatcher::OnProcessEvent(const NotifyEvent &event)
         {
             if (onModified && onModified->IsRunnable())
             {
-                auto relPath = fs::path(event.path).lexically_relative(g_pSM->GetGamePath() / gamePath).string();
+                std::string relPath;
+                event.AppendRelativePath(relPath);
 
                 onModified->PushCell(handle);
                 onModified->PushString(relPath.c_str());
@@ -176,8 +379,10 @@ void SMDirectoryWatcher::OnProcessEvent(const NotifyEvent &event)
         {
             if (onRenamed && onRenamed->IsRunnable())
             {
-                auto relPath = fs::path(event.path).lexically_relative(g_pSM->GetGamePath() / gamePath).string();
-                auto relLastPath = fs::path(event.lastPath).lexically_relative(g_pSM->GetGamePath() / gamePath).string();
+                std::string relPath;
+                event.AppendRelativePath(relPath);
+                std::string relLastPath;
+                event.AppendRelativeLastPath(relLastPath);
 
                 onRenamed->PushCell(handle);
                 onRenamed->PushString(relLastPath.c_str());
@@ -186,6 +391,7 @@ void SMDirectoryWatcher::OnProcessEvent(const NotifyEvent &event)
             }
         }
 
+        dispatchedEvent = nullptr;
         break;
     }
     case kStart:
@@ -207,13 +413,33 @@ void SMDirectoryWatcher::OnProcessEvent(const NotifyEvent &event)
         }
         break;
     }
+    case kOverflow:
+    {
+        if (onOverflow && onOverflow->IsRunnable())
+        {
+            onOverflow->PushCell(handle);
+            onOverflow->Execute(nullptr);
+        }
+        break;
+    }
+    case kResyncRequired:
+    {
+        ReportDroppedEvents(true);
+        break;
+    }
     }
 }
 
 SMDirectoryWatcherManager g_FileSystemWatchers;
 SourceMod::HandleType_t SMDirectoryWatcherManager::m_HandleType(0);
+SourceMod::HandleType_t SMDirectoryWatcherManager::m_ContentsHandleType(0);
+SourceMod::HandleType_t SMDirectoryWatcherManager::m_ChangesHandleType(0);
 
-SMDirectoryWatcherManager::SMDirectoryWatcherManager() {}
+SMDirectoryWatcherManager::SMDirectoryWatcherManager() : m_frameBudget(0),
+                                                         m_nextWatcher(0),
+                                                         m_latencyWarning(0)
+{
+}
 
 static void GameFrameHook(bool simulating)
 {
@@ -232,8 +458,51 @@ bool SMDirectoryWatcherManager::SDK_OnLoad(char *error, int errorSize)
         return false;
     }
 
+    m_ContentsHandleType =
+        g_pHandleSys->CreateType("FileContents", this, 0, nullptr, nullptr,
+                                 myself->GetIdentity(), nullptr);
+    if (!m_ContentsHandleType)
+    {
+        std::snprintf(error, errorSize,
+                      "Failed to create FileContents handle type.");
+        return false;
+    }
+
+    m_ChangesHandleType =
+        g_pHandleSys->CreateType("FileSystemChanges", this, 0, nullptr, nullptr,
+                                 myself->GetIdentity(), nullptr);
+    if (!m_ChangesHandleType)
+    {
+        std::snprintf(error, errorSize,
+                      "Failed to create FileSystemChanges handle type.");
+        return false;
+    }
+
+    const char *frameBudget = smutils->GetCoreConfigValue("FileWatcherFrameBudget");
+    if (frameBudget)
+    {
+        m_frameBudget = std::max(std::atol(frameBudget), 0L);
+    }
+
+    const char *latencyWarning = smutils->GetCoreConfigValue("FileWatcherLatencyWarning");
+    if (latencyWarning)
+    {
+        m_latencyWarning = std::chrono::milliseconds(std::max(std::atol(latencyWarning), 0L));
+    }
+
+#ifdef __linux__
+    // Opted into through core.cfg, as it's shared by every watcher.
+    const char *ioUring = smutils->GetCoreConfigValue("FileWatcherIoUring");
+    if (ioUring && strcasecmp(ioUring, "yes") == 0)
+    {
+        EventReactor::SetPreferredBackend(EventReactor::kIoUring);
+    }
+#endif
+
     plsys->AddPluginsListener(this);
 
+    rootconsole->AddRootConsoleCommand3("filewatcher", "Lists file system watchers and what they have seen", this);
+
     smutils->AddGameFrameHook(&GameFrameHook);
 
     sharesys->AddNatives(myself, m_Natives);
@@ -247,17 +516,130 @@ void SMDirectoryWatcherManager::SDK_OnUnload()
 
     plsys->RemovePluginsListener(this);
 
+    rootconsole->RemoveRootConsoleCommand("filewatcher", this);
+
     if (m_HandleType)
     {
         g_pHandleSys->RemoveType(m_HandleType, myself->GetIdentity());
     }
+
+    if (m_ContentsHandleType)
+    {
+        g_pHandleSys->RemoveType(m_ContentsHandleType, myself->GetIdentity());
+    }
+
+    if (m_ChangesHandleType)
+    {
+        g_pHandleSys->RemoveType(m_ChangesHandleType, myself->GetIdentity());
+    }
 }
 
 void SMDirectoryWatcherManager::OnGameFrame(bool simulating)
 {
-    for (auto it = m_watchers.begin(); it != m_watchers.end(); it++)
+    if (!m_frameBudget)
+    {
+        for (size_t i = 0; i < m_watchers.size(); i++)
+        {
+            m_watchers[i]->OnGameFrame(simulating, std::chrono::steady_clock::time_point::max());
+        }
+
+        return;
+    }
+
+    // Whatever is left once the budget runs out waits for the next frame.
+    // The first watcher that didn't get a turn goes first then, so a watcher
+    // with a large backlog can't keep the others from ever being served.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(m_frameBudget);
+
+    size_t count = m_watchers.size();
+    size_t first = m_nextWatcher;
+    m_nextWatcher = first + 1;
+
+    bool skipping = false;
+    for (size_t i = 0; i < count && !m_watchers.empty(); i++)
+    {
+        // Callbacks can delete watchers, so the list is indexed afresh.
+        size_t index = (first + i) % m_watchers.size();
+        SMDirectoryWatcher *watcher = m_watchers[index];
+
+        if (!skipping && std::chrono::steady_clock::now() >= deadline)
+        {
+            skipping = true;
+            m_nextWatcher = index;
+        }
+
+        if (skipping)
+        {
+            if (watcher->IsWatching() && watcher->HasPendingEvents())
+            {
+                watcher->skippedFrames++;
+            }
+
+            continue;
+        }
+
+        watcher->OnGameFrame(simulating, deadline);
+    }
+
+    if (!m_watchers.empty())
+    {
+        m_nextWatcher %= m_watchers.size();
+    }
+}
+
+static const char *GetBackendName(DirectoryWatcher::WatchBackend backend)
+{
+    switch (backend)
+    {
+    case DirectoryWatcher::kInotify:
+        return "inotify";
+    case DirectoryWatcher::kFanotify:
+        return "fanotify";
+    case DirectoryWatcher::kPolling:
+        return "polling";
+    default:
+        return "default";
+    }
+}
+
+void SMDirectoryWatcherManager::OnRootConsoleCommand(const char *cmdname, const SourceMod::ICommandArgs *args)
+{
+    if (m_watchers.empty())
+    {
+        rootconsole->ConsolePrint("[SM] No file system watchers.");
+        return;
+    }
+
+    rootconsole->ConsolePrint("[SM] Listing %zu file system watcher(s):", m_watchers.size());
+
+    for (size_t i = 0; i < m_watchers.size(); i++)
     {
-        (*it)->OnGameFrame(simulating);
+        SMDirectoryWatcher *watcher = m_watchers[i];
+        auto statistics = watcher->GetStatistics();
+        auto queueUsage = watcher->GetQueueUsage();
+
+        rootconsole->ConsolePrint("  [%zu] \"%s\" (%s, %s)", i + 1,
+                                  watcher->gamePath.string().c_str(),
+                                  GetBackendName(watcher->GetBackend()),
+                                  watcher->IsWatching() ? "watching" : "stopped");
+        rootconsole->ConsolePrint("      read %zu, filtered %zu, queued %zu, dispatched %zu, dropped %zu",
+                                  statistics.recordsRead, statistics.eventsFiltered,
+                                  statistics.eventsQueued, statistics.eventsDispatched,
+                                  statistics.eventsDropped);
+        rootconsole->ConsolePrint("      queue %zu events (%zu bytes), %zu watches, %zu byte buffer, %lld ms CPU",
+                                  statistics.queueDepth, queueUsage.bytes, statistics.watchCount,
+                                  statistics.bufferSize,
+                                  (long long)std::chrono::duration_cast<std::chrono::milliseconds>(statistics.cpuTime).count());
+        rootconsole->ConsolePrint("      deferred %zu, skipped frames %zu, budget overruns %zu",
+                                  watcher->GetDeferredEventCount(), watcher->skippedFrames,
+                                  watcher->budgetOverruns);
+        rootconsole->ConsolePrint("      latency p50/p99/max (us): read to queued %lld/%lld/%lld, queued to dispatched %lld/%lld/%lld, total %lld/%lld/%lld",
+                                  (long long)statistics.queueLatency.p50.count(), (long long)statistics.queueLatency.p99.count(),
+                                  (long long)statistics.queueLatency.max.count(),
+                                  (long long)statistics.dispatchLatency.p50.count(), (long long)statistics.dispatchLatency.p99.count(),
+                                  (long long)statistics.dispatchLatency.max.count(),
+                                  (long long)statistics.totalLatency.p50.count(), (long long)statistics.totalLatency.p99.count(),
+                                  (long long)statistics.totalLatency.max.count());
     }
 }
 
@@ -285,6 +667,69 @@ SMDirectoryWatcher *SMDirectoryWatcherManager::GetWatcher(
     return (err == HandleError_None) ? watcher : nullptr;
 }
 
+SourceMod::Handle_t SMDirectoryWatcherManager::CreateContents(
+    SourcePawn::IPluginContext *context,
+    std::shared_ptr<const FileContents> &&contents)
+{
+    // The handle owns a reference; the bytes go back to the watcher's budget
+    // once the last one is closed.
+    auto holder = new std::shared_ptr<const FileContents>(std::move(contents));
+    SourceMod::Handle_t handle =
+        handlesys->CreateHandle(m_ContentsHandleType, holder, context->GetIdentity(),
+                                myself->GetIdentity(), nullptr);
+    if (!handle)
+    {
+        delete holder;
+    }
+
+    return handle;
+}
+
+const FileContents *SMDirectoryWatcherManager::GetContents(
+    SourceMod::Handle_t handle)
+{
+    std::shared_ptr<const FileContents> *holder = nullptr;
+    HandleSecurity sec(nullptr, myself->GetIdentity());
+
+    SourceMod::HandleError err =
+        g_pHandleSys->ReadHandle(handle, m_ContentsHandleType, &sec, (void **)(&holder));
+    return (err == HandleError_None) ? holder->get() : nullptr;
+}
+
+SourceMod::Handle_t SMDirectoryWatcherManager::CreateChanges(
+    SourcePawn::IPluginContext *context,
+    SMChangeList *changes)
+{
+    SourceMod::Handle_t handle =
+        handlesys->CreateHandle(m_ChangesHandleType, changes, context->GetIdentity(),
+                                myself->GetIdentity(), nullptr);
+    if (!handle)
+    {
+        delete changes;
+    }
+
+    return handle;
+}
+
+const SMChangeList *SMDirectoryWatcherManager::GetChanges(
+    SourceMod::Handle_t handle)
+{
+    SMChangeList *changes = nullptr;
+    HandleSecurity sec(nullptr, myself->GetIdentity());
+
+    SourceMod::HandleError err =
+        g_pHandleSys->ReadHandle(handle, m_ChangesHandleType, &sec, (void **)(&changes));
+    return (err == HandleError_None) ? changes : nullptr;
+}
+
+void SMDirectoryWatcherManager::FreeChanges(
+    SourcePawn::IPluginContext *context,
+    SourceMod::Handle_t handle)
+{
+    HandleSecurity sec(context->GetIdentity(), myself->GetIdentity());
+    g_pHandleSys->FreeHandle(handle, &sec);
+}
+
 void SMDirectoryWatcherManager::OnHandleDestroy(SourceMod::HandleType_t type,
                                                 void *object)
 {
@@ -306,6 +751,14 @@ void SMDirectoryWatcherManager::OnHandleDestroy(SourceMod::HandleType_t type,
 
         delete watcher;
     }
+    else if (type == m_ContentsHandleType)
+    {
+        delete (std::shared_ptr<const FileContents> *)object;
+    }
+    else if (type == m_ChangesHandleType)
+    {
+        delete (SMChangeList *)object;
+    }
 }
 
 void SMDirectoryWatcherManager::OnPluginUnloaded(SourceMod::IPlugin *plugin)
@@ -411,6 +864,13 @@ cell_t smn_NotifyFilterSet(SourcePawn::IPluginContext *context,
 
     watcher->options.notifyFilterFlags =
         (DirectoryWatcher::NotifyFilterFlags)params[2];
+
+    // Live watches pick up the new filter without restarting.
+    if (watcher->IsWatching())
+    {
+        watcher->SetNotifyFilter(watcher->options.notifyFilterFlags);
+    }
+
     return 0;
 }
 
@@ -453,8 +913,8 @@ cell_t smn_InternalBufferSizeSet(SourcePawn::IPluginContext *context,
     return 0;
 }
 
-cell_t smn_OnStartedSet(SourcePawn::IPluginContext *context,
-                        const cell_t *params)
+cell_t smn_CoalesceWindowGet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
 {
     SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
     if (!watcher)
@@ -463,19 +923,11 @@ cell_t smn_OnStartedSet(SourcePawn::IPluginContext *context,
         return 0;
     }
 
-    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
-    if (!cb && params[2] != -1)
-    {
-        context->ReportError("Invalid function id %x", params[2]);
-        return 0;
-    }
-
-    watcher->onStarted = cb;
-    return 0;
+    return (cell_t)watcher->options.coalesceWindowMs;
 }
 
-cell_t smn_OnStoppedSet(SourcePawn::IPluginContext *context,
-                        const cell_t *params)
+cell_t smn_CoalesceWindowSet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
 {
     SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
     if (!watcher)
@@ -484,19 +936,12 @@ cell_t smn_OnStoppedSet(SourcePawn::IPluginContext *context,
         return 0;
     }
 
-    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
-    if (!cb && params[2] != -1)
-    {
-        context->ReportError("Invalid function id %x", params[2]);
-        return 0;
-    }
-
-    watcher->onStopped = cb;
+    watcher->options.coalesceWindowMs = params[2] > 0 ? params[2] : 0;
     return 0;
 }
 
-cell_t smn_OnCreatedSet(SourcePawn::IPluginContext *context,
-                        const cell_t *params)
+cell_t smn_PollIntervalGet(SourcePawn::IPluginContext *context,
+                           const cell_t *params)
 {
     SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
     if (!watcher)
@@ -505,19 +950,11 @@ cell_t smn_OnCreatedSet(SourcePawn::IPluginContext *context,
         return 0;
     }
 
-    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
-    if (!cb && params[2] != -1)
-    {
-        context->ReportError("Invalid function id %x", params[2]);
-        return 0;
-    }
-
-    watcher->onCreated = cb;
-    return 0;
+    return (cell_t)watcher->options.pollIntervalMs;
 }
 
-cell_t smn_OnDeletedSet(SourcePawn::IPluginContext *context,
-                        const cell_t *params)
+cell_t smn_PollIntervalSet(SourcePawn::IPluginContext *context,
+                           const cell_t *params)
 {
     SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
     if (!watcher)
@@ -526,7 +963,388 @@ cell_t smn_OnDeletedSet(SourcePawn::IPluginContext *context,
         return 0;
     }
 
-    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
+    watcher->options.pollIntervalMs = params[2] > 0 ? params[2] : 0;
+    return 0;
+}
+
+cell_t smn_VerifyContentsGet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return watcher->options.verifyContents;
+}
+
+cell_t smn_VerifyContentsSet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    watcher->options.verifyContents = params[2] != 0;
+    return 0;
+}
+
+cell_t smn_MaxHashedSizeGet(SourcePawn::IPluginContext *context,
+                            const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)watcher->options.maxHashedSize;
+}
+
+cell_t smn_MaxHashedSizeSet(SourcePawn::IPluginContext *context,
+                            const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    watcher->options.maxHashedSize = params[2] > 0 ? params[2] : 0;
+    return 0;
+}
+
+cell_t smn_ContentsBudgetGet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)watcher->options.contentsBudget;
+}
+
+cell_t smn_ContentsBudgetSet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    watcher->options.contentsBudget = params[2] > 0 ? params[2] : 0;
+    return 0;
+}
+
+cell_t smn_MaxContentsSizeGet(SourcePawn::IPluginContext *context,
+                              const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)watcher->options.maxContentsSize;
+}
+
+cell_t smn_MaxContentsSizeSet(SourcePawn::IPluginContext *context,
+                              const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    watcher->options.maxContentsSize = params[2] > 0 ? params[2] : 0;
+    return 0;
+}
+
+cell_t smn_MaxQueuedEventsGet(SourcePawn::IPluginContext *context,
+                              const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)watcher->options.maxQueuedEvents;
+}
+
+cell_t smn_MaxQueuedEventsSet(SourcePawn::IPluginContext *context,
+                              const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    watcher->options.maxQueuedEvents = params[2] > 0 ? params[2] : 0;
+    return 0;
+}
+
+cell_t smn_MaxQueuedBytesGet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)watcher->options.maxQueuedBytes;
+}
+
+cell_t smn_MaxQueuedBytesSet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    watcher->options.maxQueuedBytes = params[2] > 0 ? params[2] : 0;
+    return 0;
+}
+
+cell_t smn_QueuePolicyGet(SourcePawn::IPluginContext *context,
+                          const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)watcher->options.queuePolicy;
+}
+
+cell_t smn_QueuePolicySet(SourcePawn::IPluginContext *context,
+                          const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    if (params[2] < DirectoryWatcher::kDropNewest || params[2] > DirectoryWatcher::kCollapse)
+    {
+        context->ReportError("Invalid queue policy %d", params[2]);
+        return 0;
+    }
+
+    watcher->options.queuePolicy = (DirectoryWatcher::QueuePolicy)params[2];
+    return 0;
+}
+
+cell_t smn_BackendGet(SourcePawn::IPluginContext *context,
+                      const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)watcher->options.backend;
+}
+
+cell_t smn_BackendSet(SourcePawn::IPluginContext *context,
+                      const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    if (params[2] < DirectoryWatcher::kAutomatic || params[2] > DirectoryWatcher::kPolling)
+    {
+        context->ReportError("Invalid backend %d", params[2]);
+        return 0;
+    }
+
+    watcher->options.backend = (DirectoryWatcher::WatchBackend)params[2];
+    return 0;
+}
+
+cell_t smn_ActiveBackendGet(SourcePawn::IPluginContext *context,
+                            const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)watcher->GetBackend();
+}
+
+cell_t smn_OnStartedSet(SourcePawn::IPluginContext *context,
+                        const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
+    if (!cb && params[2] != -1)
+    {
+        context->ReportError("Invalid function id %x", params[2]);
+        return 0;
+    }
+
+    watcher->onStarted = cb;
+    return 0;
+}
+
+cell_t smn_OnStoppedSet(SourcePawn::IPluginContext *context,
+                        const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
+    if (!cb && params[2] != -1)
+    {
+        context->ReportError("Invalid function id %x", params[2]);
+        return 0;
+    }
+
+    watcher->onStopped = cb;
+    return 0;
+}
+
+cell_t smn_OnOverflowSet(SourcePawn::IPluginContext *context,
+                         const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
+    if (!cb && params[2] != -1)
+    {
+        context->ReportError("Invalid function id %x", params[2]);
+        return 0;
+    }
+
+    watcher->onOverflow = cb;
+    return 0;
+}
+
+cell_t smn_OnChangesBatchSet(SourcePawn::IPluginContext *context,
+                            const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
+    if (!cb && params[2] != -1)
+    {
+        context->ReportError("Invalid function id %x", params[2]);
+        return 0;
+    }
+
+    watcher->onChangesBatch = cb;
+    return 0;
+}
+
+cell_t smn_OnQueueOverflowSet(SourcePawn::IPluginContext *context,
+                             const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
+    if (!cb && params[2] != -1)
+    {
+        context->ReportError("Invalid function id %x", params[2]);
+        return 0;
+    }
+
+    watcher->onQueueOverflow = cb;
+    return 0;
+}
+
+cell_t smn_OnCreatedSet(SourcePawn::IPluginContext *context,
+                        const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
+    if (!cb && params[2] != -1)
+    {
+        context->ReportError("Invalid function id %x", params[2]);
+        return 0;
+    }
+
+    watcher->onCreated = cb;
+    return 0;
+}
+
+cell_t smn_OnDeletedSet(SourcePawn::IPluginContext *context,
+                        const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    SourcePawn::IPluginFunction *cb = context->GetFunctionById(params[2]);
     if (!cb && params[2] != -1)
     {
         context->ReportError("Invalid function id %x", params[2]);
@@ -630,6 +1448,407 @@ cell_t smn_GetPath(SourcePawn::IPluginContext *context, const cell_t *params)
     return writtenBytes;
 }
 
+cell_t smn_GetRegistrationProgress(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    auto progress = watcher->GetWatchProgress();
+
+    cell_t *registered, *pending;
+    context->LocalToPhysAddr(params[2], &registered);
+    context->LocalToPhysAddr(params[3], &pending);
+
+    *registered = (cell_t)progress.registeredDirectories;
+    *pending = (cell_t)progress.pendingDirectories;
+
+    return progress.armed;
+}
+
+static cell_t AddPattern(SourcePawn::IPluginContext *context, const cell_t *params, std::vector<std::string> SMDirectoryWatcher::*patterns)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    char *pattern = nullptr;
+    context->LocalToString(params[2], &pattern);
+
+    if (!PathMatcher::IsValidPattern(pattern))
+    {
+        context->ReportError("Pattern \"%s\" is invalid", pattern);
+        return 0;
+    }
+
+    (watcher->*patterns).push_back(pattern);
+
+    return 0;
+}
+
+cell_t smn_AddIncludePattern(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    return AddPattern(context, params, &SMDirectoryWatcher::includePatterns);
+}
+
+cell_t smn_AddExcludePattern(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    return AddPattern(context, params, &SMDirectoryWatcher::excludePatterns);
+}
+
+cell_t smn_AddExcludedDirectory(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    return AddPattern(context, params, &SMDirectoryWatcher::excludedDirectories);
+}
+
+cell_t smn_ClearPatterns(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    watcher->includePatterns.clear();
+    watcher->excludePatterns.clear();
+    watcher->excludedDirectories.clear();
+
+    return 0;
+}
+
+cell_t smn_GetInternalBufferUsage(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    auto usage = watcher->GetBufferUsage();
+
+    cell_t *current, *peak;
+    context->LocalToPhysAddr(params[2], &current);
+    context->LocalToPhysAddr(params[3], &peak);
+
+    *current = (cell_t)usage.currentSize;
+    *peak = (cell_t)usage.peakSize;
+
+    return 0;
+}
+
+cell_t smn_GetQueueUsage(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    auto usage = watcher->GetQueueUsage();
+
+    cell_t *events, *bytes, *peakBytes;
+    context->LocalToPhysAddr(params[2], &events);
+    context->LocalToPhysAddr(params[3], &bytes);
+    context->LocalToPhysAddr(params[4], &peakBytes);
+
+    *events = (cell_t)usage.events;
+    *bytes = (cell_t)usage.bytes;
+    *peakBytes = (cell_t)usage.peakBytes;
+
+    return 0;
+}
+
+cell_t smn_GetDispatchStats(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    cell_t *deferred, *skipped, *overruns;
+    context->LocalToPhysAddr(params[2], &deferred);
+    context->LocalToPhysAddr(params[3], &skipped);
+    context->LocalToPhysAddr(params[4], &overruns);
+
+    *deferred = (cell_t)watcher->GetDeferredEventCount();
+    *skipped = (cell_t)watcher->skippedFrames;
+    *overruns = (cell_t)watcher->budgetOverruns;
+
+    return 0;
+}
+
+cell_t smn_GetStats(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    auto statistics = watcher->GetStatistics();
+
+    // In the order of FileSystemWatcherStat.
+    const cell_t values[] = {
+        (cell_t)statistics.recordsRead,
+        (cell_t)statistics.eventsFiltered,
+        (cell_t)statistics.eventsQueued,
+        (cell_t)statistics.eventsDispatched,
+        (cell_t)statistics.eventsDropped,
+        (cell_t)statistics.queueDepth,
+        (cell_t)statistics.watchCount,
+        (cell_t)statistics.bufferSize,
+        (cell_t)std::chrono::duration_cast<std::chrono::milliseconds>(statistics.cpuTime).count(),
+        (cell_t)statistics.queueLatency.p50.count(),
+        (cell_t)statistics.queueLatency.p99.count(),
+        (cell_t)statistics.queueLatency.max.count(),
+        (cell_t)statistics.dispatchLatency.p50.count(),
+        (cell_t)statistics.dispatchLatency.p99.count(),
+        (cell_t)statistics.dispatchLatency.max.count(),
+        (cell_t)statistics.totalLatency.p50.count(),
+        (cell_t)statistics.totalLatency.p99.count(),
+        (cell_t)statistics.totalLatency.max.count(),
+    };
+
+    cell_t *stats;
+    context->LocalToPhysAddr(params[2], &stats);
+
+    cell_t count = std::max(std::min(params[3], (cell_t)(sizeof(values) / sizeof(values[0]))), 0);
+    for (cell_t i = 0; i < count; i++)
+    {
+        stats[i] = values[i];
+    }
+
+    return count;
+}
+
+cell_t smn_GetEventLatency(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    const DirectoryWatcher::NotifyEvent *event = watcher->dispatchedEvent;
+    if (!event)
+    {
+        return 0;
+    }
+
+    cell_t *queued, *dispatched;
+    context->LocalToPhysAddr(params[2], &queued);
+    context->LocalToPhysAddr(params[3], &dispatched);
+
+    *queued = (cell_t)std::chrono::duration_cast<std::chrono::microseconds>(event->GetQueueTime() - event->GetReadTime()).count();
+    *dispatched = (cell_t)std::chrono::duration_cast<std::chrono::microseconds>(event->GetDispatchTime() - event->GetReadTime()).count();
+
+    return 1;
+}
+
+cell_t smn_GetContents(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    SMDirectoryWatcher *watcher = g_FileSystemWatchers.GetWatcher(params[1]);
+    if (!watcher)
+    {
+        context->ReportError("Invalid FileSystemWatcher handle %x", params[1]);
+        return 0;
+    }
+
+    if (!watcher->dispatchedEvent)
+    {
+        return 0;
+    }
+
+    auto contents = watcher->dispatchedEvent->GetContents();
+    if (!contents)
+    {
+        return 0;
+    }
+
+    return g_FileSystemWatchers.CreateContents(context, std::move(contents));
+}
+
+cell_t smn_ContentsSizeGet(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const FileContents *contents = g_FileSystemWatchers.GetContents(params[1]);
+    if (!contents)
+    {
+        context->ReportError("Invalid FileContents handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)contents->GetSize();
+}
+
+// Reads the handle, and checks that the offset is within the contents.
+static bool GetContentsRange(SourcePawn::IPluginContext *context, const cell_t *params, const FileContents *&contents, size_t &offset)
+{
+    contents = g_FileSystemWatchers.GetContents(params[1]);
+    if (!contents)
+    {
+        context->ReportError("Invalid FileContents handle %x", params[1]);
+        return false;
+    }
+
+    if (params[4] < 0 || (size_t)params[4] > contents->GetSize())
+    {
+        context->ReportError("Offset %d is out of range (size %u)", params[4], (unsigned int)contents->GetSize());
+        return false;
+    }
+
+    offset = (size_t)params[4];
+    return true;
+}
+
+cell_t smn_ContentsGetString(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const FileContents *contents;
+    size_t offset;
+    if (!GetContentsRange(context, params, contents, offset))
+    {
+        return 0;
+    }
+
+    if (params[3] <= 0)
+    {
+        return 0;
+    }
+
+    char *buffer = nullptr;
+    context->LocalToString(params[2], &buffer);
+
+    size_t length = std::min(contents->GetSize() - offset, (size_t)params[3] - 1);
+    std::memcpy(buffer, contents->GetData() + offset, length);
+    buffer[length] = '\0';
+
+    return (cell_t)length;
+}
+
+cell_t smn_ContentsGetBytes(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const FileContents *contents;
+    size_t offset;
+    if (!GetContentsRange(context, params, contents, offset))
+    {
+        return 0;
+    }
+
+    if (params[3] <= 0)
+    {
+        return 0;
+    }
+
+    cell_t *bytes;
+    context->LocalToPhysAddr(params[2], &bytes);
+
+    size_t length = std::min(contents->GetSize() - offset, (size_t)params[3]);
+    const unsigned char *data = (const unsigned char *)contents->GetData() + offset;
+    for (size_t i = 0; i < length; i++)
+    {
+        bytes[i] = data[i];
+    }
+
+    return (cell_t)length;
+}
+
+cell_t smn_ChangesLengthGet(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const SMChangeList *changes = g_FileSystemWatchers.GetChanges(params[1]);
+    if (!changes)
+    {
+        context->ReportError("Invalid FileSystemChanges handle %x", params[1]);
+        return 0;
+    }
+
+    return (cell_t)changes->GetSize();
+}
+
+// Reads the handle, and checks that the index is within the list.
+static const SMChangeList *GetChangeAt(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const SMChangeList *changes = g_FileSystemWatchers.GetChanges(params[1]);
+    if (!changes)
+    {
+        context->ReportError("Invalid FileSystemChanges handle %x", params[1]);
+        return nullptr;
+    }
+
+    if (params[2] < 0 || (size_t)params[2] >= changes->GetSize())
+    {
+        context->ReportError("Index %d is out of bounds (length %u)", params[2], (unsigned int)changes->GetSize());
+        return nullptr;
+    }
+
+    return changes;
+}
+
+cell_t smn_ChangesGetType(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const SMChangeList *changes = GetChangeAt(context, params);
+    if (!changes)
+    {
+        return 0;
+    }
+
+    return (cell_t)changes->GetFlags(params[2]);
+}
+
+cell_t smn_ChangesGetPath(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const SMChangeList *changes = GetChangeAt(context, params);
+    if (!changes)
+    {
+        return 0;
+    }
+
+    size_t writtenBytes;
+    context->StringToLocalUTF8(params[3], params[4], changes->GetPath(params[2]), &writtenBytes);
+    return writtenBytes;
+}
+
+cell_t smn_ChangesGetOldPath(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const SMChangeList *changes = GetChangeAt(context, params);
+    if (!changes)
+    {
+        return 0;
+    }
+
+    size_t writtenBytes;
+    context->StringToLocalUTF8(params[3], params[4], changes->GetLastPath(params[2]), &writtenBytes);
+    return writtenBytes;
+}
+
+cell_t smn_ChangesGetContents(SourcePawn::IPluginContext *context, const cell_t *params)
+{
+    const SMChangeList *changes = GetChangeAt(context, params);
+    if (!changes)
+    {
+        return 0;
+    }
+
+    auto contents = changes->GetContents(params[2]);
+    if (!contents)
+    {
+        return 0;
+    }
+
+    return g_FileSystemWatchers.CreateContents(context, std::move(contents));
+}
+
 sp_nativeinfo_s SMDirectoryWatcherManager::m_Natives[] = {
     {"FileSystemWatcher.FileSystemWatcher", smn_FileSystemWatcher},
     {"FileSystemWatcher.IsWatching.get", smn_IsWatchingGet},
@@ -644,12 +1863,55 @@ sp_nativeinfo_s SMDirectoryWatcherManager::m_Natives[] = {
     {"FileSystemWatcher.RetryInterval.set", smn_RetryIntervalSet},
     {"FileSystemWatcher.InternalBufferSize.get", smn_InternalBufferSizeGet},
     {"FileSystemWatcher.InternalBufferSize.set", smn_InternalBufferSizeSet},
+    {"FileSystemWatcher.CoalesceWindow.get", smn_CoalesceWindowGet},
+    {"FileSystemWatcher.CoalesceWindow.set", smn_CoalesceWindowSet},
+    {"FileSystemWatcher.VerifyContents.get", smn_VerifyContentsGet},
+    {"FileSystemWatcher.VerifyContents.set", smn_VerifyContentsSet},
+    {"FileSystemWatcher.MaxHashedSize.get", smn_MaxHashedSizeGet},
+    {"FileSystemWatcher.MaxHashedSize.set", smn_MaxHashedSizeSet},
+    {"FileSystemWatcher.ContentsBudget.get", smn_ContentsBudgetGet},
+    {"FileSystemWatcher.ContentsBudget.set", smn_ContentsBudgetSet},
+    {"FileSystemWatcher.MaxContentsSize.get", smn_MaxContentsSizeGet},
+    {"FileSystemWatcher.MaxContentsSize.set", smn_MaxContentsSizeSet},
+    {"FileSystemWatcher.MaxQueuedEvents.get", smn_MaxQueuedEventsGet},
+    {"FileSystemWatcher.MaxQueuedEvents.set", smn_MaxQueuedEventsSet},
+    {"FileSystemWatcher.MaxQueuedBytes.get", smn_MaxQueuedBytesGet},
+    {"FileSystemWatcher.MaxQueuedBytes.set", smn_MaxQueuedBytesSet},
+    {"FileSystemWatcher.QueuePolicy.get", smn_QueuePolicyGet},
+    {"FileSystemWatcher.QueuePolicy.set", smn_QueuePolicySet},
+    {"FileSystemWatcher.Backend.get", smn_BackendGet},
+    {"FileSystemWatcher.Backend.set", smn_BackendSet},
+    {"FileSystemWatcher.ActiveBackend.get", smn_ActiveBackendGet},
+    {"FileSystemWatcher.PollInterval.get", smn_PollIntervalGet},
+    {"FileSystemWatcher.PollInterval.set", smn_PollIntervalSet},
     {"FileSystemWatcher.OnStarted.set", smn_OnStartedSet},
     {"FileSystemWatcher.OnStopped.set", smn_OnStoppedSet},
     {"FileSystemWatcher.OnCreated.set", smn_OnCreatedSet},
     {"FileSystemWatcher.OnDeleted.set", smn_OnDeletedSet},
     {"FileSystemWatcher.OnModified.set", smn_OnModifiedSet},
     {"FileSystemWatcher.OnRenamed.set", smn_OnRenamedSet},
+    {"FileSystemWatcher.OnOverflow.set", smn_OnOverflowSet},
+    {"FileSystemWatcher.OnChangesBatch.set", smn_OnChangesBatchSet},
+    {"FileSystemWatcher.OnQueueOverflow.set", smn_OnQueueOverflowSet},
     {"FileSystemWatcher.GetPath", smn_GetPath},
+    {"FileSystemWatcher.GetRegistrationProgress", smn_GetRegistrationProgress},
+    {"FileSystemWatcher.GetInternalBufferUsage", smn_GetInternalBufferUsage},
+    {"FileSystemWatcher.AddIncludePattern", smn_AddIncludePattern},
+    {"FileSystemWatcher.AddExcludePattern", smn_AddExcludePattern},
+    {"FileSystemWatcher.AddExcludedDirectory", smn_AddExcludedDirectory},
+    {"FileSystemWatcher.ClearPatterns", smn_ClearPatterns},
+    {"FileSystemWatcher.GetQueueUsage", smn_GetQueueUsage},
+    {"FileSystemWatcher.GetDispatchStats", smn_GetDispatchStats},
+    {"FileSystemWatcher.GetStats", smn_GetStats},
+    {"FileSystemWatcher.GetContents", smn_GetContents},
+    {"FileSystemWatcher.GetEventLatency", smn_GetEventLatency},
+    {"FileContents.Size.get", smn_ContentsSizeGet},
+    {"FileContents.GetString", smn_ContentsGetString},
+    {"FileContents.GetBytes", smn_ContentsGetBytes},
+    {"FileSystemChanges.Length.get", smn_ChangesLengthGet},
+    {"FileSystemChanges.GetType", smn_ChangesGetType},
+    {"FileSystemChanges.GetPath", smn_ChangesGetPath},
+    {"FileSystemChanges.GetOldPath", smn_ChangesGetOldPath},
+    {"FileSystemChanges.GetContents", smn_ChangesGetContents},
     {NULL, NULL},
 };
\ No newline at end of file
@@ -33,8 +33,45 @@
 #include "watcher/watcher.h"
 
 #include <IPluginSys.h>
+#include <IRootConsoleMenu.h>
 #include <sp_vm_api.h>
 
+// The changes a watcher saw in one frame, handed to OnChangesBatch all at
+// once instead of one callback per change. Paths are stored back to back,
+// each terminated, so they can be copied out as they are.
+class SMChangeList
+{
+public:
+    void Add(const DirectoryWatcher::NotifyEvent &event);
+
+    inline size_t GetSize() const { return entries.size(); }
+    inline bool IsEmpty() const { return entries.empty(); }
+    inline DirectoryWatcher::NotifyFilterFlags GetFlags(size_t index) const { return entries[index].flags; }
+    inline const char *GetPath(size_t index) const { return slab.data() + entries[index].pathOffset; }
+
+    // Empty unless the change is a rename.
+    inline const char *GetLastPath(size_t index) const { return slab.data() + entries[index].lastPathOffset; }
+
+    std::shared_ptr<const FileContents> GetContents(size_t index) const;
+
+private:
+    struct Entry
+    {
+        DirectoryWatcher::NotifyFilterFlags flags;
+        uint32_t pathOffset;
+        uint32_t lastPathOffset;
+
+        // Index into contents, or kNoContents.
+        uint32_t contents;
+    };
+
+    static constexpr uint32_t kNoContents = UINT32_MAX;
+
+    std::string slab;
+    std::vector<Entry> entries;
+    std::vector<std::shared_ptr<const FileContents>> contents;
+};
+
 class SMDirectoryWatcher : public DirectoryWatcher
 {
 public:
@@ -46,9 +83,19 @@ public:
     virtual void OnProcessEvent(const NotifyEvent &event) override;
 
 private:
-    void OnGameFrame(bool simulating);
+    void OnGameFrame(bool simulating, std::chrono::steady_clock::time_point deadline);
     void OnPluginUnloaded(SourceMod::IPlugin *plugin);
 
+    // Sends the changes gathered for OnChangesBatch so far, if any.
+    void DeliverChanges();
+
+    // Tells OnQueueOverflow about changes dropped since it was last called.
+    void ReportDroppedEvents(bool resyncRequired);
+
+    // Logs a warning if the change took longer than the configured threshold
+    // to get from the system to its callback.
+    void CheckLatency(const NotifyEvent &event);
+
     friend class SMDirectoryWatcherManager;
 
 public:
@@ -57,6 +104,12 @@ public:
 
     WatchOptions options;
 
+    // Compiled into options.pathMatcher and options.directoryFilter each
+    // time the watcher starts.
+    std::vector<std::string> includePatterns;
+    std::vector<std::string> excludePatterns;
+    std::vector<std::string> excludedDirectories;
+
     SourceMod::Handle_t handle;
 
     SourcePawn::IPluginContext *owningContext;
@@ -66,10 +119,36 @@ public:
     SourcePawn::IPluginFunction *onDeleted;
     SourcePawn::IPluginFunction *onModified;
     SourcePawn::IPluginFunction *onRenamed;
+    SourcePawn::IPluginFunction *onOverflow;
+    SourcePawn::IPluginFunction *onChangesBatch;
+    SourcePawn::IPluginFunction *onQueueOverflow;
+
+    // The event whose callback is running, which GetContents() reads from.
+    const NotifyEvent *dispatchedEvent;
+
+    // Changes waiting to be sent to OnChangesBatch at the end of the frame.
+    std::unique_ptr<SMChangeList> pendingChanges;
+
+    // With a frame budget, the frames this watcher had events waiting but
+    // didn't get a turn, and those in which its callbacks ran past the
+    // budget.
+    size_t skippedFrames;
+    size_t budgetOverruns;
+
+    // The dropped event count as of the last OnQueueOverflow.
+    size_t reportedDrops;
+
+    // Changes that took longer than the latency threshold. The warning for
+    // them is logged at most once per interval.
+    size_t slowEvents;
+    std::chrono::steady_clock::time_point nextLatencyWarning;
+
+    static constexpr std::chrono::seconds kLatencyWarningInterval{10};
 };
 
 class SMDirectoryWatcherManager : public SourceMod::IHandleTypeDispatch,
-                                  public SourceMod::IPluginsListener
+                                  public SourceMod::IPluginsListener,
+                                  public SourceMod::IRootConsoleCommand
 {
 public:
     SMDirectoryWatcherManager();
@@ -81,17 +160,40 @@ public:
     SourceMod::Handle_t CreateWatcher(SourcePawn::IPluginContext *context, const std::filesystem::path &path);
     SMDirectoryWatcher *GetWatcher(SourceMod::Handle_t handle);
 
+    // How long a change may take from being read to reaching its callback
+    // before a warning is logged, or 0 for no warning.
+    inline std::chrono::milliseconds GetLatencyWarning() const { return m_latencyWarning; }
+
+    SourceMod::Handle_t CreateContents(SourcePawn::IPluginContext *context, std::shared_ptr<const FileContents> &&contents);
+    const FileContents *GetContents(SourceMod::Handle_t handle);
+
+    SourceMod::Handle_t CreateChanges(SourcePawn::IPluginContext *context, SMChangeList *changes);
+    const SMChangeList *GetChanges(SourceMod::Handle_t handle);
+    void FreeChanges(SourcePawn::IPluginContext *context, SourceMod::Handle_t handle);
+
     // IHandleTypeDispatch
     virtual void OnHandleDestroy(SourceMod::HandleType_t type, void *object) override;
 
     // IPluginsListener
     virtual void OnPluginUnloaded(SourceMod::IPlugin *plugin) override;
 
+    // IRootConsoleCommand
+    virtual void OnRootConsoleCommand(const char *cmdname, const SourceMod::ICommandArgs *args) override;
+
 private:
     static SourceMod::HandleType_t m_HandleType;
+    static SourceMod::HandleType_t m_ContentsHandleType;
+    static SourceMod::HandleType_t m_ChangesHandleType;
     static sp_nativeinfo_t m_Natives[];
 
     std::vector<SMDirectoryWatcher *> m_watchers;
+
+    // How long, in microseconds, callbacks may take each frame, or 0 for no
+    // limit. Watchers take turns going first, starting from m_nextWatcher.
+    long m_frameBudget;
+    size_t m_nextWatcher;
+
+    std::chrono::milliseconds m_latencyWarning;
 };
 
 extern SMDirectoryWatcherManager g_FileSystemWatchers;
@@ -0,0 +1,631 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "workload.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <fstream>
+#include <sys/resource.h>
+#include <unistd.h>
+#else
+#include <Windows.h>
+#include <psapi.h>
+#endif
+
+// Runs a file workload against one or more watchers for a set time and
+// prints what they made of it as JSON: how many changes were reported, how
+// many were lost, how long they took from the change being made to the
+// callback, and what it cost in CPU time and memory. Watchers are serviced
+// once per frame, the way the extension is.
+
+namespace
+{
+    namespace fs = std::filesystem;
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        WorkloadOptions workload;
+        unsigned int watchers;
+        DirectoryWatcher::WatchBackend backend;
+        unsigned int coalesceMs;
+        unsigned int frameMs;
+
+        // How long to wait for late changes once the workload is done.
+        unsigned int drainMs;
+
+        // Where the temporary tree is made.
+        fs::path directory;
+    };
+
+    const char *kUsage =
+        "usage: loadrunner [options]\n"
+        "  --rate=N          operations per second (1000)\n"
+        "  --duration=N      seconds to run for (10)\n"
+        "  --mix=C,M,R,D     weights of creates, modifications, renames and deletes (40,30,15,15)\n"
+        "  --depth=N         levels of directories in the tree (2)\n"
+        "  --fanout=N        directories in each directory (4)\n"
+        "  --watchers=N      watchers on the tree (1)\n"
+        "  --backend=NAME    default, inotify, fanotify or polling (default)\n"
+        "  --coalesce=N      coalescing window in milliseconds (0)\n"
+        "  --frame=N         milliseconds between calls to ProcessEvents (15)\n"
+        "  --drain=N         milliseconds to wait for late changes at the end (2000)\n"
+        "  --seed=N          seed for picking operations (1)\n"
+        "  --dir=PATH        where to make the temporary tree (the system temp directory)\n";
+
+    const char *GetBackendName(DirectoryWatcher::WatchBackend backend)
+    {
+        switch (backend)
+        {
+        case DirectoryWatcher::kInotify:
+            return "inotify";
+        case DirectoryWatcher::kFanotify:
+            return "fanotify";
+        case DirectoryWatcher::kPolling:
+            return "polling";
+        default:
+            return "default";
+        }
+    }
+
+    bool ParseUnsigned(const char *value, unsigned int &out)
+    {
+        char *end;
+        unsigned long parsed = std::strtoul(value, &end, 10);
+        if (end == value || *end)
+        {
+            return false;
+        }
+
+        out = (unsigned int)parsed;
+        return true;
+    }
+
+    bool ParseOptions(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const char *arg = argv[i];
+            const char *equals = std::strchr(arg, '=');
+            if (std::strncmp(arg, "--", 2) != 0 || !equals)
+            {
+                return false;
+            }
+
+            std::string name(arg + 2, equals);
+            const char *value = equals + 1;
+            unsigned int number = 0;
+
+            if (name == "mix")
+            {
+                unsigned int weights[4];
+                if (std::sscanf(value, "%u,%u,%u,%u", &weights[0], &weights[1], &weights[2], &weights[3]) != 4 ||
+                    weights[0] + weights[1] + weights[2] + weights[3] == 0)
+                {
+                    return false;
+                }
+
+                options.workload.createWeight = weights[0];
+                options.workload.modifyWeight = weights[1];
+                options.workload.renameWeight = weights[2];
+                options.workload.deleteWeight = weights[3];
+            }
+            else if (name == "backend")
+            {
+                if (std::strcmp(value, "default") == 0)
+                {
+                    options.backend = DirectoryWatcher::kAutomatic;
+                }
+                else if (std::strcmp(value, "inotify") == 0)
+                {
+                    options.backend = DirectoryWatcher::kInotify;
+                }
+                else if (std::strcmp(value, "fanotify") == 0)
+                {
+                    options.backend = DirectoryWatcher::kFanotify;
+                }
+                else if (std::strcmp(value, "polling") == 0)
+                {
+                    options.backend = DirectoryWatcher::kPolling;
+                }
+                else
+                {
+                    return false;
+                }
+            }
+            else if (name == "dir")
+            {
+                options.directory = value;
+            }
+            else if (!ParseUnsigned(value, number))
+            {
+                return false;
+            }
+            else if (name == "rate" && number > 0)
+            {
+                options.workload.rate = number;
+            }
+            else if (name == "duration")
+            {
+                options.workload.duration = std::chrono::seconds(number);
+            }
+            else if (name == "depth")
+            {
+                options.workload.depth = number;
+            }
+            else if (name == "fanout" && number > 0)
+            {
+                options.workload.fanout = number;
+            }
+            else if (name == "watchers" && number > 0)
+            {
+                options.watchers = number;
+            }
+            else if (name == "coalesce")
+            {
+                options.coalesceMs = number;
+            }
+            else if (name == "frame" && number > 0)
+            {
+                options.frameMs = number;
+            }
+            else if (name == "drain")
+            {
+                options.drainMs = number;
+            }
+            else if (name == "seed")
+            {
+                options.workload.seed = number;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Checks the changes a watcher reports against the operations the
+    // workload logged. A change can be reported before the operation behind
+    // it is logged, so changes that match nothing are tried again each frame
+    // until the run ends.
+    class LoadWatcher : public DirectoryWatcher
+    {
+    public:
+        LoadWatcher() : expected(0), matched(0), received(0), overflows(0)
+        {
+        }
+
+        void Expect(const std::vector<Workload::Operation> &operations)
+        {
+            for (auto it = operations.begin(); it != operations.end(); it++)
+            {
+                MakeKey(it->type, it->path);
+                pending[key].push_back(it->time);
+            }
+
+            expected += operations.size();
+        }
+
+        void Match()
+        {
+            carried.clear();
+
+            for (auto it = unmatched.begin(); it != unmatched.end(); it++)
+            {
+                if (!MatchChange(*it))
+                {
+                    carried.push_back(std::move(*it));
+                }
+            }
+
+            unmatched.swap(carried);
+        }
+
+        virtual void OnProcessEvent(const NotifyEvent &event) override
+        {
+            if (event.type == kOverflow || event.type == kResyncRequired)
+            {
+                overflows++;
+                return;
+            }
+
+            if (event.type != kFilesystem)
+            {
+                return;
+            }
+
+            received++;
+            lastEvent = event.GetDispatchTime();
+
+            path.clear();
+            event.AppendRelativePath(path);
+            unmatched.push_back({event.flags, fs::path(path).generic_string(), event.GetDispatchTime()});
+        }
+
+        inline bool IsSettled() const { return matched == expected; }
+        inline size_t GetUnexpected() const { return unmatched.size(); }
+
+        size_t expected;
+        size_t matched;
+        size_t received;
+        size_t overflows;
+        Clock::time_point lastEvent;
+
+        // From the operation being made to the change being dispatched.
+        LatencyHistogram latency;
+
+    private:
+        struct Change
+        {
+            NotifyFilterFlags flags;
+            std::string path;
+            Clock::time_point time;
+        };
+
+        void MakeKey(NotifyFilterFlags type, const std::string &changePath)
+        {
+            key.assign(1, (char)type);
+            key += changePath;
+        }
+
+        bool MatchChange(const Change &change)
+        {
+            // A folded change carries more than one flag.
+            const NotifyFilterFlags types[] = {kCreated, kModified, kRenamed, kDeleted};
+
+            for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+            {
+                if (!(change.flags & types[i]))
+                {
+                    continue;
+                }
+
+                MakeKey(types[i], change.path);
+
+                auto found = pending.find(key);
+                if (found == pending.end() || found->second.front() > change.time)
+                {
+                    continue;
+                }
+
+                latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(change.time - found->second.front()));
+                matched++;
+
+                found->second.pop_front();
+                if (found->second.empty())
+                {
+                    pending.erase(found);
+                }
+
+                return true;
+            }
+
+            return false;
+        }
+
+        // Times of the logged operations not yet reported, keyed by type and
+        // path.
+        std::unordered_map<std::string, std::deque<Clock::time_point>> pending;
+        std::vector<Change> unmatched;
+        std::vector<Change> carried;
+        std::string key;
+        std::string path;
+    };
+
+    struct Usage
+    {
+        std::chrono::microseconds userTime;
+        std::chrono::microseconds systemTime;
+        size_t residentKb;
+        size_t peakResidentKb;
+    };
+
+    Usage GetUsage()
+    {
+        Usage usage = {};
+
+#ifdef __linux__
+        struct rusage rusage;
+        if (getrusage(RUSAGE_SELF, &rusage) == 0)
+        {
+            usage.userTime = std::chrono::seconds(rusage.ru_utime.tv_sec) + std::chrono::microseconds(rusage.ru_utime.tv_usec);
+            usage.systemTime = std::chrono::seconds(rusage.ru_stime.tv_sec) + std::chrono::microseconds(rusage.ru_stime.tv_usec);
+            usage.peakResidentKb = (size_t)rusage.ru_maxrss;
+        }
+
+        size_t pages = 0, resident = 0;
+        std::ifstream("/proc/self/statm") >> pages >> resident;
+        usage.residentKb = resident * sysconf(_SC_PAGESIZE) / 1024;
+#else
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+        {
+            // In 100 nanosecond units.
+            usage.userTime = std::chrono::microseconds((((uint64_t)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime) / 10);
+            usage.systemTime = std::chrono::microseconds((((uint64_t)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime) / 10);
+        }
+
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        {
+            usage.residentKb = counters.WorkingSetSize / 1024;
+            usage.peakResidentKb = counters.PeakWorkingSetSize / 1024;
+        }
+#endif
+
+        // Counted a little differently from the current figure.
+        usage.peakResidentKb = std::max(usage.peakResidentKb, usage.residentKb);
+        return usage;
+    }
+
+    long long ToMilliseconds(std::chrono::microseconds time)
+    {
+        return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(time).count();
+    }
+
+    std::string GetJsonString(const std::string &value)
+    {
+        std::string out = "\"";
+        for (auto it = value.begin(); it != value.end(); it++)
+        {
+            if (*it == '"' || *it == '\\')
+            {
+                out.push_back('\\');
+            }
+
+            out.push_back(*it);
+        }
+
+        out.push_back('"');
+        return out;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options = {};
+    options.workload.rate = 1000;
+    options.workload.duration = std::chrono::seconds(10);
+    options.workload.createWeight = 40;
+    options.workload.modifyWeight = 30;
+    options.workload.renameWeight = 15;
+    options.workload.deleteWeight = 15;
+    options.workload.depth = 2;
+    options.workload.fanout = 4;
+    options.workload.seed = 1;
+    options.watchers = 1;
+    options.backend = DirectoryWatcher::kAutomatic;
+    options.frameMs = 15;
+    options.drainMs = 2000;
+
+    if (!ParseOptions(argc, argv, options))
+    {
+        std::fputs(kUsage, stderr);
+        return 1;
+    }
+
+    std::error_code ec;
+    if (options.directory.empty())
+    {
+        options.directory = fs::temp_directory_path(ec);
+    }
+
+#ifdef __linux__
+    long processId = (long)getpid();
+#else
+    long processId = (long)GetCurrentProcessId();
+#endif
+
+    fs::path base = options.directory / ("watcherload" + std::to_string(processId));
+    Workload workload(base, options.workload);
+    if (!workload.Prepare())
+    {
+        std::fprintf(stderr, "failed to create the tree in %s\n", base.string().c_str());
+        fs::remove_all(base, ec);
+        return 1;
+    }
+
+    DirectoryWatcher::WatchOptions watchOptions = {true, false, DirectoryWatcher::kNotifyAll, 8192};
+    watchOptions.backend = options.backend;
+    watchOptions.coalesceWindowMs = options.coalesceMs;
+
+    std::vector<std::unique_ptr<LoadWatcher>> watchers;
+    for (unsigned int i = 0; i < options.watchers; i++)
+    {
+        auto watcher = std::make_unique<LoadWatcher>();
+        if (!watcher->Watch(workload.GetTreePath(), watchOptions))
+        {
+            std::fprintf(stderr, "failed to watch %s\n", workload.GetTreePath().string().c_str());
+            fs::remove_all(base, ec);
+            return 1;
+        }
+
+        watchers.push_back(std::move(watcher));
+    }
+
+    auto armDeadline = Clock::now() + std::chrono::seconds(60);
+    for (auto it = watchers.begin(); it != watchers.end(); it++)
+    {
+        while (!(*it)->GetWatchProgress().armed && Clock::now() < armDeadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        (*it)->ProcessEvents();
+    }
+
+    if (Clock::now() >= armDeadline)
+    {
+        std::fprintf(stderr, "timed out waiting for the watchers to start\n");
+        watchers.clear();
+        fs::remove_all(base, ec);
+        return 1;
+    }
+
+    std::fprintf(stderr, "running %u operations/s for %lld s on %zu directories with %u %s watcher(s)\n",
+                 options.workload.rate, (long long)std::chrono::duration_cast<std::chrono::seconds>(options.workload.duration).count(),
+                 workload.GetDirectoryCount(), options.watchers, GetBackendName(watchers.front()->GetBackend()));
+
+    Usage startUsage = GetUsage();
+    auto startCpuTime = watchers.front()->GetStatistics().cpuTime;
+    auto start = Clock::now();
+    workload.Start();
+
+    auto frame = std::chrono::milliseconds(options.frameMs);
+    auto nextFrame = start;
+    auto drainDeadline = Clock::time_point::max();
+    std::vector<Workload::Operation> operations;
+
+    for (;;)
+    {
+        nextFrame += frame;
+        std::this_thread::sleep_until(nextFrame);
+
+        // Checked first, so nothing logged after the last take is missed.
+        bool finished = workload.IsFinished();
+
+        operations.clear();
+        workload.TakeOperations(operations);
+
+        bool settled = true;
+        for (auto it = watchers.begin(); it != watchers.end(); it++)
+        {
+            LoadWatcher &watcher = **it;
+            watcher.Expect(operations);
+            watcher.ProcessEvents();
+            watcher.Match();
+            settled = settled && watcher.IsSettled();
+        }
+
+        if (!finished)
+        {
+            continue;
+        }
+
+        if (drainDeadline == Clock::time_point::max())
+        {
+            drainDeadline = Clock::now() + std::chrono::milliseconds(options.drainMs);
+        }
+
+        if (settled || Clock::now() >= drainDeadline)
+        {
+            break;
+        }
+    }
+
+    Usage endUsage = GetUsage();
+    auto cpuTime = watchers.front()->GetStatistics().cpuTime - startCpuTime;
+
+    // Over all watchers.
+    const Workload::Counts &counts = workload.GetCounts();
+    size_t operationCount = counts.created + counts.modified + counts.renamed + counts.deleted;
+    size_t expected = 0, matched = 0, received = 0, unexpected = 0, overflows = 0;
+    auto end = start;
+    LatencyHistogram latency;
+
+    for (auto it = watchers.begin(); it != watchers.end(); it++)
+    {
+        LoadWatcher &watcher = **it;
+        expected += watcher.expected;
+        matched += watcher.matched;
+        received += watcher.received;
+        unexpected += watcher.GetUnexpected();
+        overflows += watcher.overflows;
+        end = std::max(end, watcher.lastEvent);
+        latency.Merge(watcher.latency);
+    }
+
+    double elapsed = std::chrono::duration<double>(end - start).count();
+    double generated = std::chrono::duration<double>(options.workload.duration).count();
+
+    std::printf("{\n");
+    std::printf("    \"config\": {\"rate\": %u, \"duration_s\": %.3f, \"mix\": [%u, %u, %u, %u], \"depth\": %u, \"fanout\": %u, "
+                "\"directories\": %zu, \"watchers\": %u, \"backend\": \"%s\", \"coalesce_ms\": %u, \"frame_ms\": %u, \"seed\": %u},\n",
+                options.workload.rate, generated,
+                options.workload.createWeight, options.workload.modifyWeight, options.workload.renameWeight, options.workload.deleteWeight,
+                options.workload.depth, options.workload.fanout, workload.GetDirectoryCount(), options.watchers,
+                GetBackendName(watchers.front()->GetBackend()), options.coalesceMs, options.frameMs, options.workload.seed);
+    std::printf("    \"directory\": %s,\n", GetJsonString(base.string()).c_str());
+    std::printf("    \"operations\": {\"created\": %zu, \"modified\": %zu, \"renamed\": %zu, \"deleted\": %zu, \"failed\": %zu, \"per_second\": %.1f},\n",
+                counts.created, counts.modified, counts.renamed, counts.deleted, counts.failed,
+                generated > 0 ? operationCount / generated : 0.0);
+    std::printf("    \"events\": {\"expected\": %zu, \"received\": %zu, \"matched\": %zu, \"unexpected\": %zu, \"overflows\": %zu, \"per_second\": %.1f},\n",
+                expected, received, matched, unexpected, overflows, elapsed > 0 ? received / elapsed : 0.0);
+    std::printf("    \"loss\": {\"lost\": %zu, \"ratio\": %.6f},\n",
+                expected - matched, expected ? (double)(expected - matched) / expected : 0.0);
+
+    std::printf("    \"latency_us\": {\"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld},\n",
+                (long long)latency.GetPercentile(50).count(), (long long)latency.GetPercentile(90).count(),
+                (long long)latency.GetPercentile(99).count(), (long long)latency.GetPercentile(99.9).count(),
+                (long long)latency.GetMax().count());
+    std::printf("    \"cpu_ms\": {\"user\": %lld, \"system\": %lld, \"reader\": %lld},\n",
+                ToMilliseconds(endUsage.userTime - startUsage.userTime),
+                ToMilliseconds(endUsage.systemTime - startUsage.systemTime),
+                ToMilliseconds(cpuTime));
+    std::printf("    \"rss_kb\": {\"start\": %zu, \"end\": %zu, \"peak\": %zu},\n",
+                startUsage.residentKb, endUsage.residentKb, endUsage.peakResidentKb);
+
+    std::printf("    \"watchers\": [\n");
+    for (size_t i = 0; i < watchers.size(); i++)
+    {
+        LoadWatcher &watcher = *watchers[i];
+        auto statistics = watcher.GetStatistics();
+
+        std::printf("        {\"records_read\": %zu, \"filtered\": %zu, \"queued\": %zu, \"dispatched\": %zu, \"dropped\": %zu, \"watches\": %zu, \"buffer_bytes\": %zu,\n",
+                    statistics.recordsRead, statistics.eventsFiltered, statistics.eventsQueued, statistics.eventsDispatched,
+                    statistics.eventsDropped, statistics.watchCount, statistics.bufferSize);
+        std::printf("         \"latency_us\": {\"queue\": {\"p50\": %lld, \"p99\": %lld, \"max\": %lld}, "
+                    "\"dispatch\": {\"p50\": %lld, \"p99\": %lld, \"max\": %lld}, "
+                    "\"end_to_end\": {\"p50\": %lld, \"p99\": %lld, \"max\": %lld}}}%s\n",
+                    (long long)statistics.queueLatency.p50.count(), (long long)statistics.queueLatency.p99.count(), (long long)statistics.queueLatency.max.count(),
+                    (long long)statistics.dispatchLatency.p50.count(), (long long)statistics.dispatchLatency.p99.count(), (long long)statistics.dispatchLatency.max.count(),
+                    (long long)watcher.latency.GetPercentile(50).count(), (long long)watcher.latency.GetPercentile(99).count(), (long long)watcher.latency.GetMax().count(),
+                    i + 1 < watchers.size() ? "," : "");
+    }
+    std::printf("    ]\n");
+    std::printf("}\n");
+
+    for (auto it = watchers.begin(); it != watchers.end(); it++)
+    {
+        (*it)->StopWatching();
+    }
+
+    fs::remove_all(base, ec);
+    return 0;
+}
@@ -0,0 +1,278 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "workload.h"
+
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+Workload::Workload(const fs::path &base, const WorkloadOptions &_options)
+    : options(_options),
+      stagingPath(base / "staging"),
+      treePath(base / "tree"),
+      nextName(0),
+      random(_options.seed),
+      counts{},
+      finished(false)
+{
+}
+
+Workload::~Workload()
+{
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+bool Workload::Prepare()
+{
+    std::error_code ec;
+    fs::create_directories(stagingPath, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    fs::create_directories(treePath, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    // Breadth first, so each level's parents exist before their children.
+    directories.push_back("");
+
+    size_t levelStart = 0;
+    for (unsigned int level = 0; level < options.depth; level++)
+    {
+        size_t levelEnd = directories.size();
+        for (size_t parent = levelStart; parent < levelEnd; parent++)
+        {
+            for (unsigned int i = 0; i < options.fanout; i++)
+            {
+                std::string child = directories[parent].empty() ? "" : directories[parent] + "/";
+                child += "d" + std::to_string(i);
+
+                fs::create_directory(treePath / child, ec);
+                if (ec)
+                {
+                    return false;
+                }
+
+                directories.push_back(child);
+            }
+        }
+
+        levelStart = levelEnd;
+    }
+
+    return true;
+}
+
+void Workload::Start()
+{
+    thread = std::thread(&Workload::ThreadProc, this);
+}
+
+void Workload::TakeOperations(std::vector<Operation> &out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    out.insert(out.end(), std::make_move_iterator(operations.begin()), std::make_move_iterator(operations.end()));
+    operations.clear();
+}
+
+void Workload::ThreadProc()
+{
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + options.duration;
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / options.rate));
+
+    // Paced against the start, not the last operation, so a slow one is
+    // caught up on instead of lowering the rate.
+    auto next = start;
+    while (next < end)
+    {
+        std::this_thread::sleep_until(next);
+        next += interval;
+
+        bool done = false;
+        switch (PickOperation())
+        {
+        case DirectoryWatcher::kCreated:
+            done = AddFile();
+            break;
+        case DirectoryWatcher::kModified:
+            done = ChangeFile();
+            break;
+        case DirectoryWatcher::kRenamed:
+            done = RenameFile();
+            break;
+        default:
+            done = RemoveFile();
+            break;
+        }
+
+        if (!done)
+        {
+            counts.failed++;
+        }
+    }
+
+    finished.store(true, std::memory_order_release);
+}
+
+DirectoryWatcher::NotifyFilterFlags Workload::PickOperation()
+{
+    // Nothing but creating makes sense in an empty tree.
+    if (files.empty())
+    {
+        return DirectoryWatcher::kCreated;
+    }
+
+    unsigned int total = options.createWeight + options.modifyWeight + options.renameWeight + options.deleteWeight;
+    unsigned int pick = std::uniform_int_distribution<unsigned int>(0, total - 1)(random);
+
+    if (pick < options.createWeight)
+    {
+        return DirectoryWatcher::kCreated;
+    }
+
+    pick -= options.createWeight;
+    if (pick < options.modifyWeight)
+    {
+        return DirectoryWatcher::kModified;
+    }
+
+    pick -= options.modifyWeight;
+    if (pick < options.renameWeight)
+    {
+        return DirectoryWatcher::kRenamed;
+    }
+
+    return DirectoryWatcher::kDeleted;
+}
+
+std::string Workload::MakeName()
+{
+    const std::string &directory = directories[std::uniform_int_distribution<size_t>(0, directories.size() - 1)(random)];
+    std::string name = "f" + std::to_string(nextName++);
+
+    return directory.empty() ? name : directory + "/" + name;
+}
+
+bool Workload::AddFile()
+{
+    std::string path = MakeName();
+    fs::path staged = stagingPath / fs::path(path).filename();
+
+    std::ofstream(staged) << path;
+
+    auto time = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    fs::rename(staged, treePath / path, ec);
+    if (ec)
+    {
+        fs::remove(staged, ec);
+        return false;
+    }
+
+    files.push_back(path);
+    counts.created++;
+    Log(DirectoryWatcher::kCreated, path, time);
+    return true;
+}
+
+bool Workload::ChangeFile()
+{
+    const std::string &path = files[std::uniform_int_distribution<size_t>(0, files.size() - 1)(random)];
+
+    auto time = std::chrono::steady_clock::now();
+
+    std::ofstream file(treePath / path, std::ios::app);
+    if (!file)
+    {
+        return false;
+    }
+
+    file << '.';
+    file.close();
+
+    counts.modified++;
+    Log(DirectoryWatcher::kModified, path, time);
+    return true;
+}
+
+bool Workload::RenameFile()
+{
+    size_t index = std::uniform_int_distribution<size_t>(0, files.size() - 1)(random);
+    std::string path = MakeName();
+
+    auto time = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    fs::rename(treePath / files[index], treePath / path, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    files[index] = path;
+    counts.renamed++;
+    Log(DirectoryWatcher::kRenamed, path, time);
+    return true;
+}
+
+bool Workload::RemoveFile()
+{
+    size_t index = std::uniform_int_distribution<size_t>(0, files.size() - 1)(random);
+    std::string path = std::move(files[index]);
+    files[index] = std::move(files.back());
+    files.pop_back();
+
+    auto time = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    if (!fs::remove(treePath / path, ec))
+    {
+        return false;
+    }
+
+    counts.deleted++;
+    Log(DirectoryWatcher::kDeleted, path, time);
+    return true;
+}
+
+void Workload::Log(DirectoryWatcher::NotifyFilterFlags type, const std::string &path, std::chrono::steady_clock::time_point time)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    operations.push_back({type, path, time});
+}
@@ -0,0 +1,142 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+#ifndef WORKLOAD_H_
+#define WORKLOAD_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "watcher.h"
+
+struct WorkloadOptions
+{
+    // Operations per second, spread evenly over the run.
+    unsigned int rate;
+    std::chrono::milliseconds duration;
+
+    // How often each kind of operation is picked, relative to the others.
+    unsigned int createWeight;
+    unsigned int modifyWeight;
+    unsigned int renameWeight;
+    unsigned int deleteWeight;
+
+    // Levels of directories below the root, and how many directories each
+    // one holds.
+    unsigned int depth;
+    unsigned int fanout;
+
+    uint32_t seed;
+};
+
+// Changes files in a tree at a steady rate from a thread of its own, and logs
+// each change as the event a watcher should report for it. New files are
+// written in a staging directory beside the tree and moved in, so each one
+// raises a single event whatever the backend.
+class Workload
+{
+public:
+    struct Operation
+    {
+        DirectoryWatcher::NotifyFilterFlags type;
+
+        // Relative to the tree, with forward slashes.
+        std::string path;
+
+        // Taken just before the change was made.
+        std::chrono::steady_clock::time_point time;
+    };
+
+    Workload(const std::filesystem::path &base, const WorkloadOptions &options);
+    ~Workload();
+
+    // Creates the staging directory and the tree's directories.
+    bool Prepare();
+
+    void Start();
+    inline bool IsFinished() const { return finished.load(std::memory_order_acquire); }
+
+    // Moves the operations logged since the last call into out.
+    void TakeOperations(std::vector<Operation> &out);
+
+    inline const std::filesystem::path &GetTreePath() const { return treePath; }
+    inline size_t GetDirectoryCount() const { return directories.size(); }
+
+    struct Counts
+    {
+        size_t created;
+        size_t modified;
+        size_t renamed;
+        size_t deleted;
+
+        // Operations the filesystem refused, which aren't logged.
+        size_t failed;
+    };
+
+    // Only complete once the run has finished.
+    inline const Counts &GetCounts() const { return counts; }
+
+private:
+    void ThreadProc();
+    DirectoryWatcher::NotifyFilterFlags PickOperation();
+    std::string MakeName();
+    bool AddFile();
+    bool ChangeFile();
+    bool RenameFile();
+    bool RemoveFile();
+    void Log(DirectoryWatcher::NotifyFilterFlags type, const std::string &path, std::chrono::steady_clock::time_point time);
+
+    const WorkloadOptions options;
+    std::filesystem::path stagingPath;
+    std::filesystem::path treePath;
+
+    // Relative to the tree; the root is the empty string.
+    std::vector<std::string> directories;
+
+    // Files in the tree right now, in no particular order.
+    std::vector<std::string> files;
+    size_t nextName;
+
+    std::mt19937 random;
+    Counts counts;
+
+    std::thread thread;
+    std::atomic<bool> finished;
+
+    std::mutex mutex;
+    std::vector<Operation> operations;
+};
+
+#endif // WORKLOAD_H_
@@ -79,6 +79,6 @@
 // #define SMEXT_ENABLE_TEXTPARSERS
 // #define SMEXT_ENABLE_USERMSGS
 // #define SMEXT_ENABLE_TRANSLATOR
-// #define SMEXT_ENABLE_ROOTCONSOLEMENU
+#define SMEXT_ENABLE_ROOTCONSOLEMENU
 
 #endif // _INCLUDE_SOURCEMOD_EXTENSION_CONFIG_H_
@@ -39,7 +39,8 @@ namespace fs = std::filesystem;
 
 void WatchEventCollector::OnProcessEvent(const NotifyEvent &event)
 {
-    events.emplace_back(event);
+    events.push_back({event.type, event.flags, event.GetLastPath(), event.GetPath(), event.GetContents(),
+                      event.GetReadTime(), event.GetQueueTime(), event.GetDispatchTime()});
 }
 
 std::string generate_random_string(size_t length)
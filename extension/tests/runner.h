@@ -1,12 +1,26 @@
 #include "watcher.h"
 
+// A copy of an event with its paths materialized, since events only live as
+// long as the batch they came in.
+struct CollectedEvent
+{
+    DirectoryWatcher::NotifyEventType type;
+    DirectoryWatcher::NotifyFilterFlags flags;
+    std::string lastPath;
+    std::string path;
+    std::shared_ptr<const FileContents> contents;
+    std::chrono::steady_clock::time_point readTime;
+    std::chrono::steady_clock::time_point queueTime;
+    std::chrono::steady_clock::time_point dispatchTime;
+};
+
 class WatchEventCollector : public DirectoryWatcher
 {
 public:
     using DirectoryWatcher::DirectoryWatcher;
     virtual void OnProcessEvent(const NotifyEvent &event) override;
 
-    std::vector<NotifyEvent> events;
+    std::vector<CollectedEvent> events;
 };
 
 class TempDir
@@ -0,0 +1,132 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cstdlib>
+#include <fcntl.h>
+#include <new>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Counts heap allocations made by any thread other than the test's own, which
+// here means the reactor thread that reads and parses events.
+namespace
+{
+    std::atomic<bool> countAllocations(false);
+    std::atomic<size_t> workerAllocations(0);
+    std::thread::id testThread;
+}
+
+void *operator new(size_t size)
+{
+    if (countAllocations.load(std::memory_order_relaxed) && std::this_thread::get_id() != testThread)
+    {
+        workerAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+    {
+        std::abort();
+    }
+
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+TEST(Allocations, SteadyStateWorker)
+{
+    constexpr int kFiles = 32;
+
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    testThread = std::this_thread::get_id();
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192}));
+
+    std::vector<std::string> paths;
+    for (int i = 0; i < kFiles; i++)
+    {
+        paths.push_back((dir.GetPath() / ("file" + std::to_string(i))).string());
+    }
+
+    // Create, write and delete each file, letting the game thread consume
+    // the events in between like it would every frame.
+    auto churn = [&]()
+    {
+        for (auto it = paths.begin(); it != paths.end(); it++)
+        {
+            int fd = open(it->c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+            write(fd, "x", 1);
+            close(fd);
+            unlink(it->c_str());
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            watcher.ProcessEvents();
+        }
+    };
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Warm up the batch pool.
+    for (int i = 0; i < 3; i++)
+    {
+        churn();
+    }
+
+    size_t eventsBefore = watcher.events.size();
+
+    countAllocations = true;
+    churn();
+    countAllocations = false;
+
+    watcher.StopWatching();
+
+    ASSERT_EQ(watcher.events.size() - eventsBefore, kFiles * 3);
+    ASSERT_EQ(workerAllocations.load(), 0);
+}
+
+#endif // __linux__
@@ -0,0 +1,128 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+static std::string MakePattern(size_t length)
+{
+    std::string data(length, '\0');
+    for (size_t i = 0; i < length; i++)
+    {
+        data[i] = (char)((i * 7 + 3) & 0xff);
+    }
+
+    return data;
+}
+
+TEST(ContentHash, MatchesReferenceVectors)
+{
+    ASSERT_EQ(ContentVerifier::HashContents("", 0), 0xef46db3751d8e999ull);
+    ASSERT_EQ(ContentVerifier::HashContents("abc", 3), 0x44bc2cf5ad770999ull);
+
+    std::string data = MakePattern(100000);
+    ASSERT_EQ(ContentVerifier::HashContents(data.data(), data.size()), 0x953e8a6a68df79c4ull);
+}
+
+TEST(ContentHash, ComparesWholeFile)
+{
+    TempDir dir;
+    std::string path = (dir.GetPath() / "data.bin").string();
+    std::string data = MakePattern(100000);
+
+    ContentVerifier verifier(1024 * 1024);
+
+    std::ofstream(path, std::ios::binary) << data;
+    ASSERT_TRUE(verifier.HasChanged(path));
+
+    std::ofstream(path, std::ios::binary) << data;
+    ASSERT_FALSE(verifier.HasChanged(path));
+
+    // Past the first chunk read.
+    data[70000] ^= 1;
+    std::ofstream(path, std::ios::binary) << data;
+    ASSERT_TRUE(verifier.HasChanged(path));
+
+    // Another file renamed over it, even with the same contents.
+    std::string other = (dir.GetPath() / "other.bin").string();
+    std::ofstream(other, std::ios::binary) << data;
+    fs::rename(other, path);
+    ASSERT_TRUE(verifier.HasChanged(path));
+}
+
+TEST(ContentHash, DropsIdenticalRewrites)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192};
+    options.verifyContents = true;
+    options.maxHashedSize = 16;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // The first write is reported, as nothing is known about the file yet.
+    std::ofstream(dir.GetPath() / "small.cfg") << "a";
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::ofstream(dir.GetPath() / "small.cfg") << "a";
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::ofstream(dir.GetPath() / "small.cfg") << "b";
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // Too large to hash, so a new modification time is a change.
+    std::ofstream(dir.GetPath() / "large.cfg") << MakePattern(64);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::ofstream(dir.GetPath() / "large.cfg") << MakePattern(64);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 8);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "small.cfg");
+    ASSERT_EQ(watcher.events[3].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "small.cfg");
+    ASSERT_EQ(watcher.events[4].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[5].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[5].path, dir.GetPath() / "large.cfg");
+    ASSERT_EQ(watcher.events[6].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[6].path, dir.GetPath() / "large.cfg");
+    ASSERT_EQ(watcher.events[7].type, DirectoryWatcher::NotifyEventType::kStop);
+}
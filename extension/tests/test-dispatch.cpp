@@ -0,0 +1,378 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+static void WaitUntilArmed(DirectoryWatcher &watcher)
+{
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+// Starts a watcher that queues at most 5 events, and creates 10 files far
+// enough apart that each is a batch of its own, without processing any.
+static void OverfillQueue(WatchEventCollector &watcher, TempDir &dir, DirectoryWatcher::QueuePolicy policy)
+{
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.maxQueuedEvents = 5;
+    options.queuePolicy = policy;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    watcher.ProcessEvents();
+    watcher.events.clear();
+
+    for (size_t i = 0; i < 10; i++)
+    {
+        std::ofstream(dir.GetPath() / ("file_" + std::to_string(i)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+TEST(Dispatch, CarriesOverPastDeadline)
+{
+    constexpr size_t kFiles = 10;
+
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    WaitUntilArmed(watcher);
+
+    for (size_t i = 0; i < kFiles; i++)
+    {
+        std::ofstream(dir.GetPath() / ("file_" + std::to_string(i)));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    ASSERT_TRUE(watcher.HasPendingEvents());
+
+    // A deadline that has already passed still lets one event through, and
+    // the next call picks up right after it.
+    for (size_t i = 0; i < kFiles; i++)
+    {
+        ASSERT_FALSE(watcher.ProcessEvents(std::chrono::steady_clock::now()));
+        ASSERT_EQ(watcher.events.size(), i + 1);
+    }
+
+    ASSERT_TRUE(watcher.ProcessEvents(std::chrono::steady_clock::now()));
+    ASSERT_FALSE(watcher.HasPendingEvents());
+
+    // Start, then every file in order.
+    ASSERT_EQ(watcher.events.size(), kFiles + 1);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    for (size_t i = 0; i < kFiles; i++)
+    {
+        ASSERT_EQ(watcher.events[i + 1].path, dir.GetPath() / ("file_" + std::to_string(i)));
+    }
+
+    // Each call left one event fewer behind.
+    ASSERT_EQ(watcher.GetDeferredEventCount(), kFiles * (kFiles + 1) / 2);
+
+    watcher.StopWatching();
+}
+
+TEST(Dispatch, DropsNewestPastLimit)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    OverfillQueue(watcher, dir, DirectoryWatcher::QueuePolicy::kDropNewest);
+
+    auto usage = watcher.GetQueueUsage();
+    ASSERT_EQ(usage.events, 5);
+    ASSERT_GT(usage.bytes, 0);
+    ASSERT_EQ(watcher.GetDroppedEventCount(), 5);
+
+    watcher.ProcessEvents();
+
+    usage = watcher.GetQueueUsage();
+    ASSERT_EQ(usage.events, 0);
+    ASSERT_EQ(usage.bytes, 0);
+    ASSERT_GT(usage.peakBytes, 0);
+
+    ASSERT_EQ(watcher.events.size(), 5);
+    for (size_t i = 0; i < 5; i++)
+    {
+        ASSERT_EQ(watcher.events[i].path, dir.GetPath() / ("file_" + std::to_string(i)));
+    }
+
+    watcher.StopWatching();
+}
+
+TEST(Dispatch, DropsOldestPastLimit)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    OverfillQueue(watcher, dir, DirectoryWatcher::QueuePolicy::kDropOldest);
+
+    ASSERT_EQ(watcher.GetQueueUsage().events, 5);
+    ASSERT_EQ(watcher.GetDroppedEventCount(), 5);
+
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 5);
+    for (size_t i = 0; i < 5; i++)
+    {
+        ASSERT_EQ(watcher.events[i].path, dir.GetPath() / ("file_" + std::to_string(i + 5)));
+    }
+
+    // The stop event is never held to the limit.
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+    ASSERT_EQ(watcher.events.back().type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(Dispatch, CollapsesPastLimit)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    OverfillQueue(watcher, dir, DirectoryWatcher::QueuePolicy::kCollapse);
+
+    // Everything is dropped for one marker, including what came after it.
+    ASSERT_EQ(watcher.GetQueueUsage().events, 1);
+    ASSERT_EQ(watcher.GetDroppedEventCount(), 10);
+
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 1);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kResyncRequired);
+
+    // Once it's taken, changes are queued again.
+    std::ofstream(dir.GetPath() / "after");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 2);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "after");
+
+    watcher.StopWatching();
+}
+
+TEST(Dispatch, KeepsStartAheadWhenDroppingOldest)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.maxQueuedEvents = 5;
+    options.queuePolicy = DirectoryWatcher::QueuePolicy::kDropOldest;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    for (size_t i = 0; i < 10; i++)
+    {
+        std::ofstream(dir.GetPath() / ("file_" + std::to_string(i)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    watcher.ProcessEvents();
+
+    // The start event was taken off to make room, but still comes first.
+    ASSERT_EQ(watcher.events.size(), 6);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    for (size_t i = 0; i < 5; i++)
+    {
+        ASSERT_EQ(watcher.events[i + 1].path, dir.GetPath() / ("file_" + std::to_string(i + 5)));
+    }
+
+    watcher.StopWatching();
+}
+
+TEST(Dispatch, DrainsWhileDroppingOldest)
+{
+    constexpr size_t kFiles = 2000;
+
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.maxQueuedEvents = 5;
+    options.queuePolicy = DirectoryWatcher::QueuePolicy::kDropOldest;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    // The worker makes room while the consumer keeps taking batches off.
+    std::atomic<bool> done{false};
+    std::thread producer([&dir, &done]()
+                         {
+                             for (size_t i = 0; i < kFiles; i++)
+                             {
+                                 std::ofstream(dir.GetPath() / ("file_" + std::to_string(i)));
+                             }
+
+                             done = true;
+                         });
+
+    while (!done)
+    {
+        watcher.ProcessEvents();
+    }
+
+    producer.join();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    // Every change was either dropped or delivered, in order, between the
+    // start and stop events.
+    ASSERT_GE(watcher.events.size(), 2);
+    ASSERT_EQ(watcher.events.front().type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events.back().type, DirectoryWatcher::NotifyEventType::kStop);
+    ASSERT_EQ(watcher.events.size() - 2 + watcher.GetDroppedEventCount(), kFiles);
+
+    long last = -1;
+    for (size_t i = 1; i + 1 < watcher.events.size(); i++)
+    {
+        std::string name = fs::path(watcher.events[i].path).filename().string();
+        long index = std::stol(name.substr(5));
+        ASSERT_GT(index, last);
+        last = index;
+    }
+}
+
+TEST(Dispatch, NeverDropsStartOrStop)
+{
+    constexpr size_t kWatches = DirectoryWatcher::kEventQueueCapacity + 10;
+
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    // Every watch queues a start event of its own, more than the queue holds.
+    for (size_t i = 0; i < kWatches; i++)
+    {
+        EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    }
+
+    WaitUntilArmed(watcher);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.ProcessEvents();
+    ASSERT_EQ(watcher.events.size(), kWatches);
+    ASSERT_EQ(watcher.GetDroppedEventCount(), 0);
+
+    watcher.events.clear();
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), kWatches);
+    for (size_t i = 0; i < kWatches; i++)
+    {
+        ASSERT_EQ(watcher.events[i].type, DirectoryWatcher::NotifyEventType::kStop);
+    }
+}
+
+TEST(Dispatch, CountsEventsAlongTheWay)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    auto matcher = std::make_shared<PathMatcher>();
+    matcher->AddInclude("*.cfg");
+
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.pathMatcher = matcher;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    for (size_t i = 0; i < 10; i++)
+    {
+        std::ofstream(dir.GetPath() / ("file_" + std::to_string(i) + (i < 4 ? ".cfg" : ".txt")));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto statistics = watcher.GetStatistics();
+    ASSERT_GE(statistics.recordsRead, 10);
+    ASSERT_EQ(statistics.eventsFiltered, 6);
+    ASSERT_EQ(statistics.eventsQueued, 5);
+    ASSERT_EQ(statistics.eventsDispatched, 0);
+    ASSERT_EQ(statistics.queueDepth, 5);
+    ASSERT_GE(statistics.watchCount, 1);
+    ASSERT_GT(statistics.bufferSize, 0);
+
+    watcher.ProcessEvents();
+
+    // Start, and the four that passed.
+    statistics = watcher.GetStatistics();
+    ASSERT_EQ(statistics.eventsDispatched, 5);
+    ASSERT_EQ(statistics.eventsDropped, 0);
+    ASSERT_EQ(statistics.queueDepth, 0);
+    ASSERT_EQ(watcher.events.size(), 5);
+    ASSERT_GT(statistics.cpuTime.count(), 0);
+
+    watcher.StopWatching();
+}
+
+TEST(Dispatch, StampsEachStage)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.coalesceWindowMs = 50;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    std::ofstream(dir.GetPath() / "file");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 2);
+    auto &event = watcher.events[1];
+    ASSERT_LE(event.readTime, event.queueTime);
+    ASSERT_LE(event.queueTime, event.dispatchTime);
+
+    // The change was held for the coalescing window, then waited in the
+    // queue until it was processed.
+    ASSERT_GE(event.queueTime - event.readTime, std::chrono::milliseconds(40));
+    ASSERT_GE(event.dispatchTime - event.queueTime, std::chrono::milliseconds(100));
+
+    // Only the change is counted, not the start event.
+    auto statistics = watcher.GetStatistics();
+    ASSERT_GE(statistics.queueLatency.p50, std::chrono::milliseconds(40));
+    ASSERT_GE(statistics.dispatchLatency.max, std::chrono::milliseconds(100));
+    ASSERT_EQ(statistics.totalLatency.max, std::chrono::duration_cast<std::chrono::microseconds>(event.dispatchTime - event.readTime));
+
+    watcher.StopWatching();
+}
@@ -0,0 +1,146 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#ifdef __linux__
+
+#include <cstdio>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+// Starts a fanotify watch, or returns false if it fell back to inotify, as it
+// does without CAP_SYS_ADMIN.
+static bool WatchWithFanotify(WatchEventCollector &watcher, const fs::path &path, DirectoryWatcher::WatchOptions options)
+{
+    options.backend = DirectoryWatcher::WatchBackend::kFanotify;
+    EXPECT_TRUE(watcher.Watch(path, options));
+
+    if (watcher.GetBackend() != DirectoryWatcher::WatchBackend::kFanotify)
+    {
+        std::printf("fanotify is unavailable, skipping\n");
+        watcher.StopWatching();
+        return false;
+    }
+
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return true;
+}
+
+TEST(Fanotify, ReportsChangesInTree)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+    TempDir outside;
+
+    fs::create_directories(dir.GetPath() / "sub");
+    fs::create_directories(dir.GetPath() / "logs");
+    std::ofstream(outside.GetPath() / "moved.txt");
+
+    auto filter = std::make_shared<PathMatcher>();
+    filter->AddExclude("logs");
+
+    DirectoryWatcher::WatchOptions options = {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192};
+    options.directoryFilter = filter;
+
+    if (!WatchWithFanotify(watcher, dir.GetPath(), options))
+    {
+        return;
+    }
+
+    fs::create_directory(dir.GetPath() / "sub" / "new");
+    std::ofstream(dir.GetPath() / "sub" / "a.txt");
+    fs::rename(dir.GetPath() / "sub" / "a.txt", dir.GetPath() / "sub" / "b.txt");
+    fs::rename(outside.GetPath() / "moved.txt", dir.GetPath() / "moved.txt");
+
+    // Neither is in the watched part of the filesystem.
+    std::ofstream(dir.GetPath() / "logs" / "skipped.txt");
+    std::ofstream(outside.GetPath() / "other.txt");
+
+    fs::remove(dir.GetPath() / "sub" / "b.txt");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 8);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "sub" / "new");
+
+    ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "sub" / "a.txt");
+
+    ASSERT_EQ(watcher.events[3].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "sub" / "a.txt");
+
+    ASSERT_EQ(watcher.events[4].flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
+    ASSERT_EQ(watcher.events[4].lastPath, dir.GetPath() / "sub" / "a.txt");
+    ASSERT_EQ(watcher.events[4].path, dir.GetPath() / "sub" / "b.txt");
+
+    ASSERT_EQ(watcher.events[5].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[5].path, dir.GetPath() / "moved.txt");
+
+    ASSERT_EQ(watcher.events[6].flags, DirectoryWatcher::NotifyFilterFlags::kDeleted);
+    ASSERT_EQ(watcher.events[6].path, dir.GetPath() / "sub" / "b.txt");
+
+    ASSERT_EQ(watcher.events[7].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(Fanotify, StopsWhenRootRemoved)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    fs::path root = dir.GetPath() / "root";
+    fs::create_directories(root);
+
+    if (!WatchWithFanotify(watcher, root, {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192}))
+    {
+        return;
+    }
+
+    fs::remove(root);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 2);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events[1].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+#endif // __linux__
@@ -145,4 +145,241 @@ TEST(File, MoveFileInAndOut)
 
     ASSERT_EQ(watcher.events[3].type, DirectoryWatcher::NotifyEventType::kStop);
     ASSERT_EQ(watcher.events[3].path, dir.GetPath());
-}
\ No newline at end of file
+}
+
+TEST(File, StopWatchingFromCallback)
+{
+    // Stopping from inside a callback used to deadlock, because the callback
+    // ran with the queue lock held while the worker waited on that lock.
+    class StoppingWatcher : public WatchEventCollector
+    {
+    public:
+        virtual void OnProcessEvent(const NotifyEvent &event) override
+        {
+            WatchEventCollector::OnProcessEvent(event);
+
+            if (event.type == DirectoryWatcher::NotifyEventType::kFilesystem)
+            {
+                StopWatching();
+            }
+        }
+    };
+
+    StoppingWatcher watcher;
+    TempDir dir;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    for (int i = 0; i < 100; i++)
+    {
+        auto file = std::ofstream(dir.GetPath() / ("file" + std::to_string(i)));
+        file << "Hello world";
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.ProcessEvents();
+
+    ASSERT_FALSE(watcher.IsWatching(dir.GetPath()));
+    ASSERT_GE(watcher.events.size(), 2);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events[1].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+}
+
+TEST(File, ProcessEventsFromCallback)
+{
+    // A nested call must leave the batch being dispatched alone; the outer
+    // call carries on with it.
+    class ReentrantWatcher : public WatchEventCollector
+    {
+    public:
+        virtual void OnProcessEvent(const NotifyEvent &event) override
+        {
+            WatchEventCollector::OnProcessEvent(event);
+            nestedResults.push_back(ProcessEvents(std::chrono::steady_clock::time_point::max()));
+        }
+
+        std::vector<bool> nestedResults;
+    };
+
+    constexpr int kFiles = 10;
+
+    ReentrantWatcher watcher;
+    TempDir dir;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    for (int i = 0; i < kFiles; i++)
+    {
+        std::ofstream(dir.GetPath() / ("file" + std::to_string(i)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.ProcessEvents();
+
+    // Start, then every file once and in order.
+    ASSERT_EQ(watcher.events.size(), kFiles + 1);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    for (int i = 0; i < kFiles; i++)
+    {
+        ASSERT_EQ(watcher.events[i + 1].path, dir.GetPath() / ("file" + std::to_string(i)));
+    }
+
+    for (auto it = watcher.nestedResults.begin(); it != watcher.nestedResults.end(); it++)
+    {
+        ASSERT_FALSE(*it);
+    }
+
+    ASSERT_FALSE(watcher.HasPendingEvents());
+    watcher.StopWatching();
+}
+
+#ifdef __linux__
+TEST(File, MassRenameSmallBuffer)
+{
+    constexpr int kFiles = 300;
+
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    for (int i = 0; i < kFiles; i++)
+    {
+        std::ofstream(dir.GetPath() / ("file_" + std::to_string(i)));
+    }
+
+    // Only a dozen or so events fit in each read(), and the buffer isn't
+    // allowed to grow, so plenty of renames are split across two of them.
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 400, 400}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    for (int i = 0; i < kFiles; i++)
+    {
+        fs::rename(dir.GetPath() / ("file_" + std::to_string(i)), dir.GetPath() / ("renamed_" + std::to_string(i)));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), kFiles + 2);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+
+    for (int i = 0; i < kFiles; i++)
+    {
+        auto &event = watcher.events[i + 1];
+        ASSERT_EQ(event.type, DirectoryWatcher::NotifyEventType::kFilesystem);
+        ASSERT_EQ(event.flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
+        ASSERT_EQ(event.lastPath, dir.GetPath() / ("file_" + std::to_string(i)));
+        ASSERT_EQ(event.path, dir.GetPath() / ("renamed_" + std::to_string(i)));
+    }
+
+    ASSERT_EQ(watcher.events[kFiles + 1].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+#endif
+
+TEST(File, ChangeFilterWhileWatching)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto file = std::ofstream(dir.GetPath() / "new_file");
+    file << "Hello world";
+    file.close();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.SetNotifyFilter(DirectoryWatcher::NotifyFilterFlags::kModified);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    file = std::ofstream(dir.GetPath() / "new_file");
+    file << "Hello again";
+    file.close();
+    fs::remove(dir.GetPath() / "new_file");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 4);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+
+    ASSERT_EQ(watcher.events[1].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "new_file");
+
+    ASSERT_EQ(watcher.events[2].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+    ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "new_file");
+
+    ASSERT_EQ(watcher.events[3].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(File, CoalesceWindow)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192, 0, 100}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Created and saved a few times, next to a temporary file that doesn't
+    // outlive the window: only the creation is reported.
+    for (int i = 0; i < 3; i++)
+    {
+        std::ofstream(dir.GetPath() / "config") << "Revision " << i;
+    }
+
+    std::ofstream(dir.GetPath() / "config.tmp") << "Scratch";
+    fs::remove(dir.GetPath() / "config.tmp");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    // Saved twice: one modification.
+    for (int i = 0; i < 2; i++)
+    {
+        std::ofstream(dir.GetPath() / "config") << "Edit " << i;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    // Saved, then deleted: only the deletion.
+    std::ofstream(dir.GetPath() / "config") << "Last edit";
+    fs::remove(dir.GetPath() / "config");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 5);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+
+    ASSERT_EQ(watcher.events[1].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "config");
+
+    ASSERT_EQ(watcher.events[2].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+    ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "config");
+
+    ASSERT_EQ(watcher.events[3].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+    ASSERT_EQ(watcher.events[3].flags, DirectoryWatcher::NotifyFilterFlags::kDeleted);
+    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "config");
+
+    ASSERT_EQ(watcher.events[4].type, DirectoryWatcher::NotifyEventType::kStop);
+}
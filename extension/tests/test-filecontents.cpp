@@ -0,0 +1,166 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+static void WaitUntilArmed(DirectoryWatcher &watcher)
+{
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+static void WaitForEvents(WatchEventCollector &watcher, size_t count)
+{
+    for (int i = 0; i < 100 && watcher.events.size() < count; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        watcher.ProcessEvents();
+    }
+}
+
+static std::string GetContents(const CollectedEvent &event)
+{
+    return std::string(event.contents->GetData(), event.contents->GetSize());
+}
+
+TEST(FileContents, SentWithChanges)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192};
+    options.coalesceWindowMs = 50;
+    options.contentsBudget = 1024 * 1024;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    std::string data(100000, 'x');
+    std::ofstream(dir.GetPath() / "data.txt") << data;
+    fs::create_directory(dir.GetPath() / "sub");
+    WaitForEvents(watcher, 3);
+
+    ASSERT_EQ(watcher.events.size(), 3);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_TRUE(watcher.events[1].contents);
+    ASSERT_EQ(GetContents(watcher.events[1]), data);
+    ASSERT_EQ(watcher.GetContentsSize(), data.size());
+
+    // Only files have contents.
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "sub");
+    ASSERT_FALSE(watcher.events[2].contents);
+
+    // Kept for as long as the consumer holds on to them.
+    watcher.events.clear();
+    ASSERT_EQ(watcher.GetContentsSize(), 0);
+
+    std::ofstream(dir.GetPath() / "data.txt") << "changed";
+    fs::remove(dir.GetPath() / "sub");
+    WaitForEvents(watcher, 2);
+
+    ASSERT_EQ(watcher.events.size(), 2);
+    ASSERT_EQ(watcher.events[0].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(GetContents(watcher.events[0]), "changed");
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kDeleted);
+    ASSERT_FALSE(watcher.events[1].contents);
+
+    watcher.StopWatching();
+}
+
+TEST(FileContents, HeldWithinBudget)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.coalesceWindowMs = 50;
+    options.contentsBudget = 1000;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    std::ofstream(dir.GetPath() / "a.txt") << std::string(600, 'a');
+    WaitForEvents(watcher, 2);
+    std::ofstream(dir.GetPath() / "b.txt") << std::string(600, 'b');
+    WaitForEvents(watcher, 3);
+
+    // The first is still held, so the second doesn't fit.
+    ASSERT_EQ(watcher.events.size(), 3);
+    ASSERT_TRUE(watcher.events[1].contents);
+    ASSERT_FALSE(watcher.events[2].contents);
+    ASSERT_EQ(watcher.GetContentsSize(), 600);
+
+    watcher.events.clear();
+    std::ofstream(dir.GetPath() / "c.txt") << std::string(600, 'c');
+    WaitForEvents(watcher, 1);
+
+    ASSERT_EQ(watcher.events.size(), 1);
+    ASSERT_TRUE(watcher.events[0].contents);
+    ASSERT_EQ(GetContents(watcher.events[0]), std::string(600, 'c'));
+
+    // Copies the consumer keeps outlive the watcher.
+    auto contents = watcher.events[0].contents;
+    watcher.StopWatching();
+    watcher.events.clear();
+    ASSERT_EQ(contents->GetSize(), 600);
+}
+
+TEST(FileContents, CappedPerFile)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    DirectoryWatcher::WatchOptions options = {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.coalesceWindowMs = 50;
+    options.contentsBudget = 1000;
+    options.maxContentsSize = 100;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    std::ofstream(dir.GetPath() / "large.txt") << std::string(600, 'l');
+    WaitForEvents(watcher, 2);
+    std::ofstream(dir.GetPath() / "small.txt") << std::string(50, 's');
+    WaitForEvents(watcher, 3);
+
+    // The large file fits in the budget, but not under the cap.
+    ASSERT_EQ(watcher.events.size(), 3);
+    ASSERT_FALSE(watcher.events[1].contents);
+    ASSERT_TRUE(watcher.events[2].contents);
+    ASSERT_EQ(GetContents(watcher.events[2]), std::string(50, 's'));
+    ASSERT_EQ(watcher.GetContentsSize(), 50);
+
+    watcher.StopWatching();
+}
@@ -0,0 +1,100 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include <unordered_map>
+#include "flatmap.h"
+
+TEST(FlatMap, InsertFindErase)
+{
+    FlatHashMap<uint32_t, int> map;
+
+    map.Insert(1, 10);
+    map.Insert(2, 20);
+    map.Insert(1, 11);
+
+    ASSERT_EQ(map.GetSize(), 2);
+    ASSERT_NE(map.Find(1), nullptr);
+    ASSERT_EQ(*map.Find(1), 11);
+    ASSERT_EQ(*map.Find(2), 20);
+    ASSERT_EQ(map.Find(3), nullptr);
+
+    ASSERT_TRUE(map.Erase(1));
+    ASSERT_FALSE(map.Erase(1));
+    ASSERT_EQ(map.Find(1), nullptr);
+    ASSERT_EQ(*map.Find(2), 20);
+    ASSERT_EQ(map.GetSize(), 1);
+
+    map.Clear();
+    ASSERT_TRUE(map.IsEmpty());
+    ASSERT_EQ(map.Find(2), nullptr);
+}
+
+TEST(FlatMap, MatchesUnorderedMap)
+{
+    FlatHashMap<int, int> map;
+    std::unordered_map<int, int> expected;
+
+    // Grows the table several times and erases from the middle of probe
+    // chains along the way.
+    uint32_t seed = 12345;
+    for (int i = 0; i < 20000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int key = (seed >> 8) % 2048;
+
+        if (seed & 1)
+        {
+            map.Insert(key, i);
+            expected[key] = i;
+        }
+        else
+        {
+            ASSERT_EQ(map.Erase(key), expected.erase(key) == 1);
+        }
+    }
+
+    ASSERT_EQ(map.GetSize(), expected.size());
+
+    for (int key = 0; key < 2048; key++)
+    {
+        auto it = expected.find(key);
+        int *value = map.Find(key);
+
+        if (it == expected.end())
+        {
+            ASSERT_EQ(value, nullptr);
+        }
+        else
+        {
+            ASSERT_NE(value, nullptr);
+            ASSERT_EQ(*value, it->second);
+        }
+    }
+}
@@ -0,0 +1,98 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+#include <gtest/gtest.h>
+#include "histogram.h"
+
+using std::chrono::microseconds;
+
+TEST(Histogram, EmptyReportsZero)
+{
+    LatencyHistogram histogram;
+
+    ASSERT_EQ(histogram.GetCount(), 0);
+    ASSERT_EQ(histogram.GetPercentile(50).count(), 0);
+    ASSERT_EQ(histogram.GetMax().count(), 0);
+}
+
+TEST(Histogram, PercentilesWithinBucketError)
+{
+    LatencyHistogram histogram;
+
+    // 1 to 10000 microseconds, once each.
+    for (int i = 1; i <= 10000; i++)
+    {
+        histogram.Record(microseconds(i));
+    }
+
+    ASSERT_EQ(histogram.GetCount(), 10000);
+    ASSERT_EQ(histogram.GetMax().count(), 10000);
+
+    auto summary = histogram.GetSummary();
+    ASSERT_GE(summary.p50.count(), 5000);
+    ASSERT_LE(summary.p50.count(), 5000 * 5 / 4);
+    ASSERT_GE(summary.p99.count(), 9900);
+    ASSERT_LE(summary.p99.count(), 10000);
+    ASSERT_EQ(summary.max.count(), 10000);
+
+    // Small values are counted exactly.
+    histogram.Clear();
+    histogram.Record(microseconds(0));
+    histogram.Record(microseconds(3));
+    histogram.Record(microseconds(-5));
+
+    ASSERT_EQ(histogram.GetPercentile(50).count(), 0);
+    ASSERT_EQ(histogram.GetPercentile(100).count(), 3);
+}
+
+TEST(Histogram, HugeValues)
+{
+    LatencyHistogram histogram;
+
+    histogram.Record(microseconds(1));
+    histogram.Record(microseconds(INT64_MAX));
+
+    ASSERT_EQ(histogram.GetPercentile(50).count(), 1);
+    ASSERT_EQ(histogram.GetPercentile(100).count(), INT64_MAX);
+}
+
+TEST(Histogram, MergeAddsCounts)
+{
+    LatencyHistogram first, second;
+
+    first.Record(microseconds(10));
+    second.Record(microseconds(1000));
+    second.Record(microseconds(2000));
+
+    first.Merge(second);
+
+    ASSERT_EQ(first.GetCount(), 3);
+    ASSERT_EQ(first.GetMax().count(), 2000);
+    ASSERT_LT(first.GetPercentile(30).count(), 1000);
+    ASSERT_GE(first.GetPercentile(50).count(), 1000);
+}
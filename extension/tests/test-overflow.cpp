@@ -0,0 +1,304 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#ifdef __linux__
+
+#include <atomic>
+#include <fcntl.h>
+#include <fstream>
+#include <set>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Holds up the shared reactor thread so inotify's queue can be overrun.
+class ReactorBlocker : public EventReactor::Handler
+{
+public:
+    virtual void OnReadable(int fd) override
+    {
+        uint64_t u;
+        read(fd, &u, sizeof(u));
+
+        entered = true;
+        while (!released)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::atomic<bool> entered{false};
+    std::atomic<bool> released{false};
+};
+
+TEST(Overflow, ResyncReportsMissedChanges)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    size_t maxQueuedEvents = 16384;
+    std::ifstream("/proc/sys/fs/inotify/max_queued_events") >> maxQueuedEvents;
+
+    // Each file raises a create and a close-write event.
+    const size_t fileCount = maxQueuedEvents / 2 + 1000;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 65536}));
+
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    auto reactor = EventReactor::Acquire();
+    ReactorBlocker blocker;
+    int blockEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ASSERT_TRUE(reactor->Register(blockEvent, &blocker));
+
+    uint64_t u = 1;
+    write(blockEvent, &u, sizeof(u));
+
+    while (!blocker.entered)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        std::string path = (dir.GetPath() / ("file_" + std::to_string(i))).string();
+        close(open(path.c_str(), O_CREAT | O_WRONLY, 0644));
+    }
+
+    blocker.released = true;
+    reactor->Unregister(blockEvent);
+    close(blockEvent);
+
+    // Wait for the resync to settle.
+    size_t lastCount = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        watcher.ProcessEvents();
+
+        if (watcher.events.size() == lastCount && i > 5)
+        {
+            break;
+        }
+
+        lastCount = watcher.events.size();
+    }
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    size_t overflows = 0;
+    std::multiset<std::string> created;
+
+    for (auto it = watcher.events.begin(); it != watcher.events.end(); it++)
+    {
+        if (it->type == DirectoryWatcher::NotifyEventType::kOverflow)
+        {
+            overflows++;
+        }
+        else if (it->type == DirectoryWatcher::NotifyEventType::kFilesystem && it->flags == DirectoryWatcher::NotifyFilterFlags::kCreated)
+        {
+            created.insert(fs::path(it->path).filename().string());
+        }
+    }
+
+    ASSERT_EQ(overflows, 1);
+
+    // Every file is reported exactly once, whether by its own event or by
+    // the resync.
+    ASSERT_EQ(created.size(), fileCount);
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        ASSERT_EQ(created.count("file_" + std::to_string(i)), 1);
+    }
+}
+
+TEST(Overflow, ResyncReportsMissedModifications)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    size_t maxQueuedEvents = 16384;
+    std::ifstream("/proc/sys/fs/inotify/max_queued_events") >> maxQueuedEvents;
+
+    fs::create_directory(dir.GetPath() / "sub");
+    std::ofstream(dir.GetPath() / "sub" / "kept.txt") << "x";
+    std::ofstream(dir.GetPath() / "sub" / "edited.txt") << "x";
+    std::ofstream(dir.GetPath() / "sub" / "removed.txt") << "x";
+
+    // Well before the watch, so it can't be taken as just changed.
+    fs::last_write_time(dir.GetPath() / "sub" / "kept.txt", fs::file_time_type::clock::now() - std::chrono::hours(1));
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 65536}));
+
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    auto reactor = EventReactor::Acquire();
+    ReactorBlocker blocker;
+    int blockEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ASSERT_TRUE(reactor->Register(blockEvent, &blocker));
+
+    uint64_t u = 1;
+    write(blockEvent, &u, sizeof(u));
+
+    while (!blocker.entered)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Fill the queue, so the changes after are lost.
+    for (size_t i = 0; i < maxQueuedEvents + 100; i++)
+    {
+        std::string path = (dir.GetPath() / ("file_" + std::to_string(i))).string();
+        close(open(path.c_str(), O_CREAT | O_WRONLY, 0644));
+    }
+
+    std::ofstream(dir.GetPath() / "sub" / "edited.txt", std::ios::app) << "y";
+    fs::remove(dir.GetPath() / "sub" / "removed.txt");
+
+    blocker.released = true;
+    reactor->Unregister(blockEvent);
+    close(blockEvent);
+
+    size_t lastCount = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        watcher.ProcessEvents();
+
+        if (watcher.events.size() == lastCount && i > 5)
+        {
+            break;
+        }
+
+        lastCount = watcher.events.size();
+    }
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    size_t overflows = 0;
+    std::multiset<std::string> modified;
+    std::multiset<std::string> deleted;
+
+    for (auto it = watcher.events.begin(); it != watcher.events.end(); it++)
+    {
+        if (it->type == DirectoryWatcher::NotifyEventType::kOverflow)
+        {
+            overflows++;
+        }
+        else if (it->flags == DirectoryWatcher::NotifyFilterFlags::kModified)
+        {
+            modified.insert(fs::path(it->path).lexically_relative(dir.GetPath()).string());
+        }
+        else if (it->flags == DirectoryWatcher::NotifyFilterFlags::kDeleted)
+        {
+            deleted.insert(fs::path(it->path).lexically_relative(dir.GetPath()).string());
+        }
+    }
+
+    ASSERT_EQ(overflows, 1);
+    ASSERT_EQ(modified.count("sub/edited.txt"), 1);
+    ASSERT_EQ(modified.count("sub/kept.txt"), 0);
+    ASSERT_EQ(deleted.count("sub/removed.txt"), 1);
+}
+
+TEST(Overflow, ReadBufferFollowsBacklog)
+{
+    constexpr size_t kFiles = 1000;
+
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // An idle watcher doesn't hold on to a large buffer.
+    auto usage = watcher.GetBufferUsage();
+    ASSERT_LE(usage.currentSize, 4096);
+
+    auto reactor = EventReactor::Acquire();
+    ReactorBlocker blocker;
+    int blockEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ASSERT_TRUE(reactor->Register(blockEvent, &blocker));
+
+    uint64_t u = 1;
+    write(blockEvent, &u, sizeof(u));
+
+    while (!blocker.entered)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for (size_t i = 0; i < kFiles; i++)
+    {
+        std::string path = (dir.GetPath() / ("file_" + std::to_string(i))).string();
+        close(open(path.c_str(), O_CREAT | O_WRONLY, 0644));
+    }
+
+    blocker.released = true;
+    reactor->Unregister(blockEvent);
+    close(blockEvent);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // The whole backlog was read at once.
+    usage = watcher.GetBufferUsage();
+    ASSERT_GE(usage.peakSize, kFiles * (sizeof(inotify_event) + 16));
+
+    // A quiet wakeup gives the memory back.
+    close(open((dir.GetPath() / "last").string().c_str(), O_CREAT | O_WRONLY, 0644));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    usage = watcher.GetBufferUsage();
+    ASSERT_LE(usage.currentSize, 4096);
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    // Start, every file, and stop.
+    ASSERT_EQ(watcher.events.size(), kFiles + 3);
+}
+
+#endif // __linux__
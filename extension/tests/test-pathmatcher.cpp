@@ -0,0 +1,116 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include "pathmatcher.h"
+
+namespace
+{
+    bool IsAccepted(const PathMatcher &matcher, const std::string &path)
+    {
+        return matcher.IsAccepted(path.data(), path.size());
+    }
+}
+
+TEST(PathMatcher, NamePatterns)
+{
+    PathMatcher matcher;
+    ASSERT_TRUE(matcher.AddInclude("*.cfg"));
+    ASSERT_TRUE(matcher.AddInclude("motd.txt"));
+    ASSERT_TRUE(matcher.AddInclude("map_?.nav"));
+
+    ASSERT_TRUE(IsAccepted(matcher, "server.cfg"));
+    ASSERT_TRUE(IsAccepted(matcher, "sourcemod/plugins.cfg"));
+    ASSERT_TRUE(IsAccepted(matcher, "archive.tar.cfg"));
+    ASSERT_TRUE(IsAccepted(matcher, "motd.txt"));
+    ASSERT_TRUE(IsAccepted(matcher, "docs/motd.txt"));
+    ASSERT_TRUE(IsAccepted(matcher, "map_a.nav"));
+
+    ASSERT_FALSE(IsAccepted(matcher, "server.cfg.bak"));
+    ASSERT_FALSE(IsAccepted(matcher, "cfg"));
+    ASSERT_FALSE(IsAccepted(matcher, "motd.txt/readme"));
+    ASSERT_FALSE(IsAccepted(matcher, "map_ab.nav"));
+}
+
+TEST(PathMatcher, PathPatterns)
+{
+    PathMatcher matcher;
+    ASSERT_TRUE(matcher.AddInclude("maps/**/*.bsp"));
+    ASSERT_TRUE(matcher.AddInclude("./cfg/server.cfg"));
+    ASSERT_TRUE(matcher.AddInclude("addons/*/data"));
+
+    ASSERT_TRUE(IsAccepted(matcher, "maps/ctf_2fort.bsp"));
+    ASSERT_TRUE(IsAccepted(matcher, "maps/workshop/123/pl_upward.bsp"));
+    ASSERT_TRUE(IsAccepted(matcher, "cfg/server.cfg"));
+    ASSERT_TRUE(IsAccepted(matcher, "addons/sourcemod/data"));
+
+    ASSERT_FALSE(IsAccepted(matcher, "ctf_2fort.bsp"));
+    ASSERT_FALSE(IsAccepted(matcher, "maps/ctf_2fort.nav"));
+    ASSERT_FALSE(IsAccepted(matcher, "server.cfg"));
+    ASSERT_FALSE(IsAccepted(matcher, "custom/cfg/server.cfg"));
+    ASSERT_FALSE(IsAccepted(matcher, "addons/sourcemod/configs/data"));
+}
+
+TEST(PathMatcher, CharacterClasses)
+{
+    PathMatcher matcher;
+    ASSERT_TRUE(matcher.AddInclude("log[0-9][!a-z].txt"));
+
+    ASSERT_TRUE(IsAccepted(matcher, "log10.txt"));
+    ASSERT_TRUE(IsAccepted(matcher, "logs/log2_.txt"));
+    ASSERT_FALSE(IsAccepted(matcher, "logx0.txt"));
+    ASSERT_FALSE(IsAccepted(matcher, "log1a.txt"));
+
+    ASSERT_FALSE(PathMatcher::IsValidPattern("log[0-9.txt"));
+    ASSERT_FALSE(PathMatcher::IsValidPattern(""));
+    ASSERT_FALSE(PathMatcher::IsValidPattern("/"));
+    ASSERT_FALSE(matcher.AddExclude("[abc"));
+}
+
+TEST(PathMatcher, IncludeAndExclude)
+{
+    PathMatcher matcher;
+    ASSERT_TRUE(matcher.IsEmpty());
+    ASSERT_TRUE(IsAccepted(matcher, "anything/at/all"));
+
+    ASSERT_TRUE(matcher.AddExclude("*.tmp"));
+    ASSERT_TRUE(matcher.AddExclude("cache/**"));
+    ASSERT_FALSE(matcher.IsEmpty());
+
+    // No includes means everything not excluded.
+    ASSERT_TRUE(IsAccepted(matcher, "server.cfg"));
+    ASSERT_FALSE(IsAccepted(matcher, "server.cfg.tmp"));
+    ASSERT_FALSE(IsAccepted(matcher, "cache/maps/a.bsp"));
+
+    ASSERT_TRUE(matcher.AddInclude("*.cfg"));
+    ASSERT_FALSE(IsAccepted(matcher, "readme.txt"));
+    ASSERT_TRUE(IsAccepted(matcher, "server.cfg"));
+    ASSERT_FALSE(IsAccepted(matcher, "cache/server.cfg"));
+}
@@ -0,0 +1,200 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#ifdef __linux__
+
+#include <fstream>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static void WaitUntilArmed(DirectoryWatcher &watcher)
+{
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+// Long enough for a pass to run after each step.
+static void WaitForPoll()
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+}
+
+// Holds up the shared reactor thread, as a handler stuck on slow I/O would.
+class ReactorBlocker : public EventReactor::Handler
+{
+public:
+    virtual void OnReadable(int fd) override
+    {
+        uint64_t u;
+        read(fd, &u, sizeof(u));
+
+        entered = true;
+        while (!released)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::atomic<bool> entered{false};
+    std::atomic<bool> released{false};
+};
+
+TEST(Polling, ReportsChangesFromSnapshots)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    DirectoryWatcher::WatchOptions options = {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192};
+    options.backend = DirectoryWatcher::WatchBackend::kPolling;
+    options.pollIntervalMs = 50;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+    ASSERT_EQ(watcher.GetBackend(), DirectoryWatcher::WatchBackend::kPolling);
+
+    std::ofstream(dir.GetPath() / "a.txt") << "x";
+    WaitForPoll();
+    std::ofstream(dir.GetPath() / "a.txt") << "longer";
+    WaitForPoll();
+    fs::rename(dir.GetPath() / "a.txt", dir.GetPath() / "b.txt");
+    WaitForPoll();
+
+    fs::create_directory(dir.GetPath() / "sub");
+    WaitForPoll();
+    std::ofstream(dir.GetPath() / "sub" / "c.txt");
+    WaitForPoll();
+
+    // Keeps its snapshots, and is still compared, under the new name.
+    fs::rename(dir.GetPath() / "sub", dir.GetPath() / "moved");
+    WaitForPoll();
+    std::ofstream(dir.GetPath() / "moved" / "d.txt");
+    WaitForPoll();
+
+    fs::remove(dir.GetPath() / "b.txt");
+    WaitForPoll();
+
+    ASSERT_EQ(watcher.GetWatchProgress().registeredDirectories, 2);
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 10);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "a.txt");
+    ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "a.txt");
+    ASSERT_EQ(watcher.events[3].flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
+    ASSERT_EQ(watcher.events[3].lastPath, dir.GetPath() / "a.txt");
+    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "b.txt");
+    ASSERT_EQ(watcher.events[4].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[4].path, dir.GetPath() / "sub");
+    ASSERT_EQ(watcher.events[5].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[5].path, dir.GetPath() / "sub" / "c.txt");
+    ASSERT_EQ(watcher.events[6].flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
+    ASSERT_EQ(watcher.events[6].lastPath, dir.GetPath() / "sub");
+    ASSERT_EQ(watcher.events[6].path, dir.GetPath() / "moved");
+    ASSERT_EQ(watcher.events[7].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[7].path, dir.GetPath() / "moved" / "d.txt");
+    ASSERT_EQ(watcher.events[8].flags, DirectoryWatcher::NotifyFilterFlags::kDeleted);
+    ASSERT_EQ(watcher.events[8].path, dir.GetPath() / "b.txt");
+    ASSERT_EQ(watcher.events[9].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(Polling, StopsWhenRootRemoved)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    fs::create_directories(dir.GetPath() / "root" / "sub");
+
+    DirectoryWatcher::WatchOptions options = {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192};
+    options.backend = DirectoryWatcher::WatchBackend::kPolling;
+    options.pollIntervalMs = 50;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath() / "root", options));
+    WaitUntilArmed(watcher);
+
+    fs::remove_all(dir.GetPath() / "root");
+    WaitForPoll();
+
+    watcher.ProcessEvents();
+
+    ASSERT_FALSE(watcher.IsWatching(dir.GetPath() / "root"));
+    ASSERT_EQ(watcher.events.back().type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(Polling, RunsWhileReactorIsBusy)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    auto reactor = EventReactor::Acquire();
+    ReactorBlocker blocker;
+    int blockEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ASSERT_TRUE(reactor->Register(blockEvent, &blocker));
+
+    uint64_t u = 1;
+    write(blockEvent, &u, sizeof(u));
+
+    while (!blocker.entered)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    DirectoryWatcher::WatchOptions options = {true, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.backend = DirectoryWatcher::WatchBackend::kPolling;
+    options.pollIntervalMs = 50;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+    WaitUntilArmed(watcher);
+
+    std::ofstream(dir.GetPath() / "a.txt");
+    WaitForPoll();
+    watcher.ProcessEvents();
+
+    blocker.released = true;
+    reactor->Unregister(blockEvent);
+    close(blockEvent);
+
+    // Polling has a thread of its own, so a stuck reactor doesn't hold it up.
+    ASSERT_EQ(watcher.events.size(), 2);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "a.txt");
+
+    watcher.StopWatching();
+}
+
+#endif // __linux__
@@ -0,0 +1,118 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "queue.h"
+
+TEST(Queue, PushPopOrder)
+{
+    BoundedQueue<int> queue(4);
+
+    ASSERT_EQ(queue.Capacity(), 4);
+
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE(queue.TryPush(int(i)));
+    }
+
+    ASSERT_FALSE(queue.TryPush(4));
+    ASSERT_EQ(queue.SizeApprox(), 4);
+
+    int value;
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE(queue.TryPop(value));
+        ASSERT_EQ(value, i);
+    }
+
+    ASSERT_FALSE(queue.TryPop(value));
+    ASSERT_EQ(queue.SizeApprox(), 0);
+}
+
+TEST(Queue, FailedPushKeepsValue)
+{
+    BoundedQueue<std::unique_ptr<int>> queue(2);
+
+    ASSERT_TRUE(queue.TryPush(std::make_unique<int>(1)));
+    ASSERT_TRUE(queue.TryPush(std::make_unique<int>(2)));
+
+    auto value = std::make_unique<int>(3);
+    ASSERT_FALSE(queue.TryPush(std::move(value)));
+    ASSERT_NE(value, nullptr);
+    ASSERT_EQ(*value, 3);
+}
+
+TEST(Queue, MultipleProducers)
+{
+    constexpr int kProducers = 4;
+    constexpr int kItemsPerProducer = 10000;
+
+    BoundedQueue<int> queue(64);
+    std::vector<std::thread> producers;
+
+    for (int i = 0; i < kProducers; i++)
+    {
+        producers.emplace_back([&queue, i]()
+        {
+            for (int j = 0; j < kItemsPerProducer; j++)
+            {
+                while (!queue.TryPush(i * kItemsPerProducer + j))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Items from the same producer must come out in the order they went in.
+    std::vector<int> next(kProducers, 0);
+    int received = 0;
+
+    while (received < kProducers * kItemsPerProducer)
+    {
+        int value;
+        if (!queue.TryPop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        int producer = value / kItemsPerProducer;
+        ASSERT_EQ(value % kItemsPerProducer, next[producer]);
+        next[producer]++;
+        received++;
+    }
+
+    for (auto it = producers.begin(); it != producers.end(); it++)
+    {
+        it->join();
+    }
+}
@@ -0,0 +1,264 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#ifdef __linux__
+
+#include <fstream>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static void WaitUntilArmed(DirectoryWatcher &watcher)
+{
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+// Holds up the shared reactor thread, as a handler stuck on slow I/O would.
+class ReactorBlocker : public EventReactor::Handler
+{
+public:
+    virtual void OnReadable(int fd) override
+    {
+        uint64_t u;
+        read(fd, &u, sizeof(u));
+
+        entered = true;
+        while (!released)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::atomic<bool> entered{false};
+    std::atomic<bool> released{false};
+};
+
+TEST(Registry, OverlappingWatchersShareWatches)
+{
+    WatchEventCollector outer;
+    WatchEventCollector inner;
+    TempDir dir;
+
+    fs::create_directories(dir.GetPath() / "a" / "b");
+    std::ofstream(dir.GetPath() / "a" / "config.txt");
+
+    auto registry = WatchRegistry::Acquire();
+    size_t baseCount = registry->GetWatchCount();
+
+    EXPECT_TRUE(outer.Watch(dir.GetPath(), {true, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    WaitUntilArmed(outer);
+    ASSERT_EQ(registry->GetWatchCount(), baseCount + 3);
+
+    // Everything under "a" is already watched.
+    EXPECT_TRUE(inner.Watch(dir.GetPath() / "a", {true, false, DirectoryWatcher::NotifyFilterFlags::kModified, 8192}));
+    WaitUntilArmed(inner);
+    ASSERT_EQ(registry->GetWatchCount(), baseCount + 3);
+
+    // Each only hears about what it asked for.
+    std::ofstream(dir.GetPath() / "a" / "b" / "new.txt");
+    std::ofstream(dir.GetPath() / "a" / "config.txt") << "changed";
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    inner.StopWatching();
+    inner.ProcessEvents();
+
+    // The outer watcher's watches outlive the inner one.
+    ASSERT_EQ(registry->GetWatchCount(), baseCount + 3);
+
+    std::ofstream(dir.GetPath() / "a" / "b" / "later.txt");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    outer.StopWatching();
+    outer.ProcessEvents();
+
+    ASSERT_EQ(registry->GetWatchCount(), baseCount);
+
+    ASSERT_EQ(inner.events.size(), 4);
+    ASSERT_EQ(inner.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(inner.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(inner.events[1].path, dir.GetPath() / "a" / "b" / "new.txt");
+    ASSERT_EQ(inner.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(inner.events[2].path, dir.GetPath() / "a" / "config.txt");
+    ASSERT_EQ(inner.events[3].type, DirectoryWatcher::NotifyEventType::kStop);
+
+    ASSERT_EQ(outer.events.size(), 4);
+    ASSERT_EQ(outer.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(outer.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(outer.events[1].path, dir.GetPath() / "a" / "b" / "new.txt");
+    ASSERT_EQ(outer.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(outer.events[2].path, dir.GetPath() / "a" / "b" / "later.txt");
+    ASSERT_EQ(outer.events[3].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(Registry, ExtraWatchersShareTree)
+{
+    WatchEventCollector first;
+    WatchEventCollector second;
+    WatchEventCollector inner;
+    TempDir dir;
+
+    fs::create_directories(dir.GetPath() / "a" / "b");
+
+    auto registry = WatchRegistry::Acquire();
+    size_t baseCount = registry->GetTreeCount();
+
+    EXPECT_TRUE(first.Watch(dir.GetPath(), {true, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    WaitUntilArmed(first);
+    ASSERT_EQ(registry->GetTreeCount(), baseCount + 1);
+
+    // Neither lists anything; both are views of the first one's tree.
+    EXPECT_TRUE(second.Watch(dir.GetPath(), {true, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    EXPECT_TRUE(inner.Watch(dir.GetPath() / "a", {true, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    WaitUntilArmed(second);
+    WaitUntilArmed(inner);
+    ASSERT_EQ(registry->GetTreeCount(), baseCount + 1);
+
+    std::ofstream(dir.GetPath() / "a" / "b" / "new.txt");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Moving its directory ends the inner watch, as it would on a tree of
+    // its own. The others see a rename, which they didn't ask for.
+    fs::rename(dir.GetPath() / "a", dir.GetPath() / "moved");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    inner.ProcessEvents();
+    first.StopWatching();
+    first.ProcessEvents();
+
+    // The tree outlives the watcher that started it.
+    ASSERT_EQ(registry->GetTreeCount(), baseCount + 1);
+
+    second.StopWatching();
+    second.ProcessEvents();
+    ASSERT_EQ(registry->GetTreeCount(), baseCount);
+
+    ASSERT_EQ(inner.events.size(), 3);
+    ASSERT_EQ(inner.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(inner.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(inner.events[1].path, dir.GetPath() / "a" / "b" / "new.txt");
+    ASSERT_EQ(inner.events[2].type, DirectoryWatcher::NotifyEventType::kStop);
+
+    for (WatchEventCollector *collector : {&first, &second})
+    {
+        ASSERT_EQ(collector->events.size(), 3);
+        ASSERT_EQ(collector->events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+        ASSERT_EQ(collector->events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+        ASSERT_EQ(collector->events[1].path, dir.GetPath() / "a" / "b" / "new.txt");
+        ASSERT_EQ(collector->events[2].type, DirectoryWatcher::NotifyEventType::kStop);
+    }
+}
+
+TEST(Registry, NarrowingFilterKeepsOthersWatches)
+{
+    WatchEventCollector first;
+    WatchEventCollector second;
+    TempDir dir;
+
+    EXPECT_TRUE(first.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    EXPECT_TRUE(second.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    WaitUntilArmed(first);
+    WaitUntilArmed(second);
+
+    // Stops asking the kernel for creations on the shared watch.
+    second.SetNotifyFilter(DirectoryWatcher::NotifyFilterFlags::kDeleted);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::ofstream(dir.GetPath() / "file.txt");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    first.StopWatching();
+    first.ProcessEvents();
+    second.StopWatching();
+    second.ProcessEvents();
+
+    ASSERT_EQ(first.events.size(), 3);
+    ASSERT_EQ(first.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(first.events[1].path, dir.GetPath() / "file.txt");
+
+    ASSERT_EQ(second.events.size(), 2);
+}
+
+TEST(Registry, WatchStartsWhileReactorIsBusy)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    auto reactor = EventReactor::Acquire();
+    ReactorBlocker blocker;
+    int blockEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ASSERT_TRUE(reactor->Register(blockEvent, &blocker));
+
+    uint64_t u = 1;
+    write(blockEvent, &u, sizeof(u));
+
+    while (!blocker.entered)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Let go of from elsewhere, in case starting waits for it after all.
+    std::thread releaser([&blocker]()
+                         {
+                             std::this_thread::sleep_for(std::chrono::seconds(1));
+                             blocker.released = true;
+                         });
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    watcher.SetNotifyFilter(DirectoryWatcher::NotifyFilterFlags::kNotifyAll);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+
+    releaser.join();
+    reactor->Unregister(blockEvent);
+    close(blockEvent);
+
+    // The watch is registered once the reactor gets to it.
+    WaitUntilArmed(watcher);
+    std::ofstream(dir.GetPath() / "file.txt");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_GE(watcher.events.size(), 3);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "file.txt");
+    ASSERT_EQ(watcher.events.back().type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+#endif // __linux__
@@ -56,7 +56,7 @@ TEST(SubDirectory, CreateRenameDeleteDir)
     watcher.StopWatching();
     watcher.ProcessEvents();
 
-    ASSERT_EQ(watcher.events.size(), 6);
+    ASSERT_GE(watcher.events.size(), 5);
     ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
     ASSERT_EQ(watcher.events[0].path, dir.GetPath());
 
@@ -64,19 +64,314 @@ TEST(SubDirectory, CreateRenameDeleteDir)
     ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
     ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "deep");
 
+    // If "deep" is listed before the rename, the rename is seen. Otherwise
+    // the listing only finds the directory under its new name.
+    size_t next = 2;
+    if (watcher.events.size() == 6)
+    {
+        ASSERT_EQ(watcher.events[2].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+        ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+        ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "deep" / "new_dir");
+
+        ASSERT_EQ(watcher.events[3].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+        ASSERT_EQ(watcher.events[3].flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
+        ASSERT_EQ(watcher.events[3].lastPath, dir.GetPath() / "deep" / "new_dir");
+        ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "deep" / "my_new_dir");
+
+        next = 4;
+    }
+    else
+    {
+        ASSERT_EQ(watcher.events.size(), 5);
+        ASSERT_EQ(watcher.events[2].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+        ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+        ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "deep" / "my_new_dir");
+
+        next = 3;
+    }
+
+    ASSERT_EQ(watcher.events[next].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+    ASSERT_EQ(watcher.events[next].flags, DirectoryWatcher::NotifyFilterFlags::kDeleted);
+    ASSERT_EQ(watcher.events[next].path, dir.GetPath() / "deep" / "my_new_dir");
+
+    ASSERT_EQ(watcher.events[next + 1].type, DirectoryWatcher::NotifyEventType::kStop);
+    ASSERT_EQ(watcher.events[next + 1].path, dir.GetPath());
+}
+
+TEST(SubDirectory, RenamedDirKeepsWatching)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    fs::create_directories(dir.GetPath() / "old_name" / "inner");
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    fs::rename(dir.GetPath() / "old_name", dir.GetPath() / "new_name");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    fs::create_directory(dir.GetPath() / "new_name" / "inner" / "child");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 4);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+
+    ASSERT_EQ(watcher.events[1].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
+    ASSERT_EQ(watcher.events[1].lastPath, dir.GetPath() / "old_name");
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "new_name");
+
+    // Reported under the directory's new name.
     ASSERT_EQ(watcher.events[2].type, DirectoryWatcher::NotifyEventType::kFilesystem);
     ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
-    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "deep" / "new_dir");
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "new_name" / "inner" / "child");
 
-    ASSERT_EQ(watcher.events[3].type, DirectoryWatcher::NotifyEventType::kFilesystem);
-    ASSERT_EQ(watcher.events[3].flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
-    ASSERT_EQ(watcher.events[3].lastPath, dir.GetPath() / "deep" / "new_dir");
-    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "deep" / "my_new_dir");
+    ASSERT_EQ(watcher.events[3].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(SubDirectory, MoveDirOut)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+    TempDir otherDir;
+
+    fs::create_directories(dir.GetPath() / "leaving" / "inner");
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
-    ASSERT_EQ(watcher.events[4].type, DirectoryWatcher::NotifyEventType::kFilesystem);
-    ASSERT_EQ(watcher.events[4].flags, DirectoryWatcher::NotifyFilterFlags::kDeleted);
-    ASSERT_EQ(watcher.events[4].path, dir.GetPath() / "deep" / "my_new_dir");
+    fs::rename(dir.GetPath() / "leaving", otherDir.GetPath() / "left");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // No longer part of the tree, so no longer reported.
+    fs::create_directory(otherDir.GetPath() / "left" / "inner" / "child");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 3);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+
+    ASSERT_EQ(watcher.events[1].type, DirectoryWatcher::NotifyEventType::kFilesystem);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kDeleted);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "leaving");
+
+    ASSERT_EQ(watcher.events[2].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(SubDirectory, NewDirContentsReported)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Whether each level is seen through its own event or found while its
+    // parent is listed, it's reported exactly once.
+    fs::create_directories(dir.GetPath() / "a" / "b" / "c" / "d");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 6);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "a");
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "a" / "b");
+    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "a" / "b" / "c");
+    ASSERT_EQ(watcher.events[4].path, dir.GetPath() / "a" / "b" / "c" / "d");
+
+    for (int i = 1; i <= 4; i++)
+    {
+        ASSERT_EQ(watcher.events[i].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    }
 
     ASSERT_EQ(watcher.events[5].type, DirectoryWatcher::NotifyEventType::kStop);
-    ASSERT_EQ(watcher.events[5].path, dir.GetPath());
-}
\ No newline at end of file
+}
+
+TEST(SubDirectory, RegistersInBackground)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    for (int i = 0; i < 20; i++)
+    {
+        for (int j = 0; j < 20; j++)
+        {
+            fs::create_directories(dir.GetPath() / std::to_string(i) / std::to_string(j));
+        }
+    }
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {true, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192}));
+
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    auto progress = watcher.GetWatchProgress();
+    ASSERT_TRUE(progress.armed);
+    ASSERT_EQ(progress.registeredDirectories, 1 + 20 + 20 * 20);
+    ASSERT_EQ(progress.pendingDirectories, 0);
+
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 1);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+
+    watcher.StopWatching();
+}
+
+TEST(SubDirectory, PathPatterns)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    auto matcher = std::make_shared<PathMatcher>();
+    matcher->AddInclude("*.cfg");
+    matcher->AddExclude("cache/**");
+
+    auto flags = (DirectoryWatcher::NotifyFilterFlags)(DirectoryWatcher::NotifyFilterFlags::kCreated | DirectoryWatcher::NotifyFilterFlags::kRenamed);
+    DirectoryWatcher::WatchOptions options = {true, false, flags, 8192};
+    options.pathMatcher = matcher;
+
+    fs::create_directories(dir.GetPath() / "sub");
+    fs::create_directories(dir.GetPath() / "cache");
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::ofstream(dir.GetPath() / "readme.txt");
+    std::ofstream(dir.GetPath() / "server.cfg");
+    std::ofstream(dir.GetPath() / "sub" / "plugin.cfg");
+    std::ofstream(dir.GetPath() / "cache" / "stale.cfg");
+
+    // Kept, since one of its paths passes.
+    fs::rename(dir.GetPath() / "readme.txt", dir.GetPath() / "readme.cfg");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 5);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "server.cfg");
+
+    ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "sub" / "plugin.cfg");
+
+    ASSERT_EQ(watcher.events[3].flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
+    ASSERT_EQ(watcher.events[3].lastPath, dir.GetPath() / "readme.txt");
+    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "readme.cfg");
+
+    ASSERT_EQ(watcher.events[4].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(SubDirectory, ExcludedDirectoriesArentWatched)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    auto filter = std::make_shared<PathMatcher>();
+    filter->AddExclude("logs");
+    filter->AddExclude("maps/workshop");
+
+    DirectoryWatcher::WatchOptions options = {true, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.directoryFilter = filter;
+
+    fs::create_directories(dir.GetPath() / "logs" / "a" / "b");
+    fs::create_directories(dir.GetPath() / "maps" / "workshop" / "1");
+    fs::create_directories(dir.GetPath() / "cfg" / "logs" / "c");
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // The root, "maps" and "cfg".
+    ASSERT_EQ(watcher.GetWatchProgress().registeredDirectories, 3);
+
+    std::ofstream(dir.GetPath() / "logs" / "a" / "ignored.log");
+    std::ofstream(dir.GetPath() / "cfg" / "logs" / "ignored.log");
+    std::ofstream(dir.GetPath() / "maps" / "workshop" / "ignored.bsp");
+
+    // A new excluded directory is reported, but not what goes in it.
+    fs::create_directories(dir.GetPath() / "cfg" / "sub" / "logs");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::ofstream(dir.GetPath() / "cfg" / "sub" / "logs" / "ignored.log");
+    std::ofstream(dir.GetPath() / "cfg" / "sub" / "server.cfg");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 5);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "cfg" / "sub");
+    ASSERT_EQ(watcher.events[2].path, dir.GetPath() / "cfg" / "sub" / "logs");
+    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "cfg" / "sub" / "server.cfg");
+    ASSERT_EQ(watcher.events[4].type, DirectoryWatcher::NotifyEventType::kStop);
+}
+
+TEST(SubDirectory, MoveAcrossExclusion)
+{
+    WatchEventCollector watcher;
+    TempDir dir;
+
+    auto filter = std::make_shared<PathMatcher>();
+    filter->AddExclude("cache");
+
+    DirectoryWatcher::WatchOptions options = {true, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192};
+    options.directoryFilter = filter;
+
+    fs::create_directories(dir.GetPath() / "cache");
+    fs::create_directories(dir.GetPath() / "data");
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), options));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Renamed out of the exclusion, it starts being watched; renamed into
+    // it, it stops.
+    fs::rename(dir.GetPath() / "cache", dir.GetPath() / "kept");
+    fs::rename(dir.GetPath() / "data", dir.GetPath() / "cache");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::ofstream(dir.GetPath() / "kept" / "seen");
+    std::ofstream(dir.GetPath() / "cache" / "ignored");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // The root and "kept".
+    ASSERT_EQ(watcher.GetWatchProgress().registeredDirectories, 2);
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(watcher.events.size(), 3);
+    ASSERT_EQ(watcher.events[0].type, DirectoryWatcher::NotifyEventType::kStart);
+    ASSERT_EQ(watcher.events[1].path, dir.GetPath() / "kept" / "seen");
+    ASSERT_EQ(watcher.events[2].type, DirectoryWatcher::NotifyEventType::kStop);
+}
@@ -0,0 +1,165 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include "runner.h"
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static void WaitUntilArmed(DirectoryWatcher &watcher)
+{
+    for (int i = 0; i < 100 && !watcher.GetWatchProgress().armed; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+class FailingReader : public EventReactor::Handler
+{
+public:
+    virtual void OnReadable(int fd) override {}
+    virtual size_t GetReadSize(int fd) override { return 64; }
+    virtual void OnRead(int fd, const char *data, ssize_t length) override { reads++; }
+    virtual void OnError(int fd, int error) override { errors.push_back(error); }
+
+    std::atomic<size_t> reads{0};
+    std::vector<int> errors;
+};
+
+TEST(Uring, PostedReadsDeliverChanges)
+{
+    constexpr size_t kFiles = 500;
+
+    EventReactor::SetPreferredBackend(EventReactor::kIoUring);
+    auto reactor = EventReactor::Acquire();
+    EventReactor::SetPreferredBackend(EventReactor::kEpoll);
+
+    if (reactor->GetBackend() != EventReactor::kIoUring)
+    {
+        printf("io_uring is unavailable, skipping.\n");
+        return;
+    }
+
+    WatchEventCollector watcher;
+    WatchEventCollector shortLived;
+    TempDir dir;
+
+    EXPECT_TRUE(watcher.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kNotifyAll, 8192}));
+    EXPECT_TRUE(shortLived.Watch(dir.GetPath(), {false, false, DirectoryWatcher::NotifyFilterFlags::kCreated, 8192}));
+    WaitUntilArmed(watcher);
+    WaitUntilArmed(shortLived);
+
+    std::ofstream(dir.GetPath() / "file.txt");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // Leaving while the other keeps its read posted.
+    shortLived.StopWatching();
+    shortLived.ProcessEvents();
+
+    fs::rename(dir.GetPath() / "file.txt", dir.GetPath() / "renamed.txt");
+    fs::remove(dir.GetPath() / "renamed.txt");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // More than the smallest read holds at once.
+    for (size_t i = 0; i < kFiles; i++)
+    {
+        std::string path = (dir.GetPath() / ("burst_" + std::to_string(i))).string();
+        close(open(path.c_str(), O_CREAT | O_WRONLY, 0644));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    watcher.StopWatching();
+    watcher.ProcessEvents();
+
+    ASSERT_EQ(shortLived.events.size(), 3);
+    ASSERT_EQ(shortLived.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(shortLived.events[1].path, dir.GetPath() / "file.txt");
+
+    // Start, created and modified, renamed, deleted, the burst, and stop.
+    ASSERT_EQ(watcher.events.size(), 5 + 2 * kFiles + 1);
+    ASSERT_EQ(watcher.events[1].flags, DirectoryWatcher::NotifyFilterFlags::kCreated);
+    ASSERT_EQ(watcher.events[2].flags, DirectoryWatcher::NotifyFilterFlags::kModified);
+    ASSERT_EQ(watcher.events[3].flags, DirectoryWatcher::NotifyFilterFlags::kRenamed);
+    ASSERT_EQ(watcher.events[3].path, dir.GetPath() / "renamed.txt");
+    ASSERT_EQ(watcher.events[4].flags, DirectoryWatcher::NotifyFilterFlags::kDeleted);
+
+    size_t created = 0;
+    for (auto it = watcher.events.begin() + 5; it != watcher.events.end() - 1; it++)
+    {
+        if (it->flags == DirectoryWatcher::NotifyFilterFlags::kCreated)
+        {
+            created++;
+        }
+    }
+
+    ASSERT_EQ(created, kFiles);
+}
+
+TEST(Uring, ReportsFailedReads)
+{
+    EventReactor::SetPreferredBackend(EventReactor::kIoUring);
+    auto reactor = EventReactor::Acquire();
+    EventReactor::SetPreferredBackend(EventReactor::kEpoll);
+
+    if (reactor->GetBackend() != EventReactor::kIoUring)
+    {
+        printf("io_uring is unavailable, skipping.\n");
+        return;
+    }
+
+    TempDir dir;
+    FailingReader reader;
+
+    // Reading a directory fails every time.
+    int fd = open(dir.GetPath().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ASSERT_NE(fd, -1);
+    ASSERT_TRUE(reactor->RegisterReader(fd, &reader));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::vector<int> errors;
+    reactor->Call([&]()
+                  { errors = reader.errors; });
+
+    ASSERT_EQ(reader.reads, 0);
+    ASSERT_EQ(errors.size(), 1);
+    ASSERT_EQ(errors[0], EISDIR);
+
+    ASSERT_TRUE(reactor->Unregister(fd));
+    close(fd);
+}
+
+#endif // __linux__
@@ -0,0 +1,103 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include "watchtree.h"
+
+static std::string GetPath(const WatchTree &tree, uint32_t node)
+{
+    std::string path;
+    tree.AppendPath(node, path);
+    return path;
+}
+
+TEST(WatchTree, PathsFollowMoves)
+{
+    WatchTree tree;
+
+    uint32_t root = tree.Add(WatchTree::kInvalidNode, 1, "", 0);
+    uint32_t a = tree.Add(root, 2, "a", 1);
+    uint32_t b = tree.Add(a, 3, "b", 1);
+    uint32_t c = tree.Add(root, 4, "c", 1);
+
+    ASSERT_EQ(tree.GetSize(), 4);
+    ASSERT_EQ(tree.Add(c, 3, "dup", 3), WatchTree::kInvalidNode);
+
+    ASSERT_EQ(GetPath(tree, root), "");
+    ASSERT_EQ(GetPath(tree, b), "a/b");
+    ASSERT_EQ(tree.Find(3), b);
+    ASSERT_EQ(tree.FindChild(root, "c", 1), c);
+    ASSERT_EQ(tree.FindChild(root, "b", 1), WatchTree::kInvalidNode);
+
+    tree.Move(a, c, "renamed", 7);
+
+    ASSERT_EQ(GetPath(tree, a), "c/renamed");
+    ASSERT_EQ(GetPath(tree, b), "c/renamed/b");
+    ASSERT_EQ(tree.FindChild(root, "a", 1), WatchTree::kInvalidNode);
+    ASSERT_EQ(tree.FindChild(c, "renamed", 7), a);
+
+    // Relative to a directory inside the tree.
+    std::string path;
+    tree.AppendPath(b, path, c);
+    ASSERT_EQ(path, "renamed/b");
+    ASSERT_TRUE(tree.IsWithin(b, c));
+    ASSERT_TRUE(tree.IsWithin(c, c));
+    ASSERT_FALSE(tree.IsWithin(c, a));
+}
+
+TEST(WatchTree, RemoveSubtree)
+{
+    WatchTree tree;
+
+    uint32_t root = tree.Add(WatchTree::kInvalidNode, 1, "", 0);
+    uint32_t a = tree.Add(root, 2, "a", 1);
+    tree.Add(a, 3, "b", 1);
+    tree.Add(a, 4, "c", 1);
+    uint32_t d = tree.Add(root, 5, "d", 1);
+
+    std::vector<int> removed;
+    tree.Remove(a, removed);
+
+    std::sort(removed.begin(), removed.end());
+    ASSERT_EQ(removed, std::vector<int>({2, 3, 4}));
+    ASSERT_EQ(tree.GetSize(), 2);
+    ASSERT_EQ(tree.Find(3), WatchTree::kInvalidNode);
+    ASSERT_EQ(tree.FindChild(root, "d", 1), d);
+
+    // Freed nodes are reused.
+    uint32_t e = tree.Add(d, 6, "e", 1);
+    ASSERT_EQ(GetPath(tree, e), "d/e");
+
+    removed.clear();
+    tree.Remove(root, removed);
+
+    ASSERT_EQ(removed.size(), 3);
+    ASSERT_TRUE(tree.IsEmpty());
+}
@@ -0,0 +1,335 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "contenthash.h"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <Windows.h>
+#endif
+
+namespace
+{
+    constexpr uint64_t kPrime1 = 11400714785074694791ull;
+    constexpr uint64_t kPrime2 = 14029467366897019727ull;
+    constexpr uint64_t kPrime3 = 1609587929392839161ull;
+    constexpr uint64_t kPrime4 = 9650029242287828579ull;
+    constexpr uint64_t kPrime5 = 2870177450012600261ull;
+
+    inline uint64_t RotateLeft(uint64_t value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    inline uint64_t Read64(const unsigned char *p)
+    {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline uint32_t Read32(const unsigned char *p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline uint64_t Round(uint64_t accumulator, uint64_t input)
+    {
+        accumulator += input * kPrime2;
+        accumulator = RotateLeft(accumulator, 31);
+        return accumulator * kPrime1;
+    }
+
+    inline uint64_t MergeRound(uint64_t hash, uint64_t lane)
+    {
+        hash ^= Round(0, lane);
+        return hash * kPrime1 + kPrime4;
+    }
+
+    // XXH64, fed in pieces. Every piece but the last must be a whole number
+    // of 32-byte stripes.
+    class StreamingHash
+    {
+    public:
+        StreamingHash() : length(0)
+        {
+            lanes[0] = kPrime1 + kPrime2;
+            lanes[1] = kPrime2;
+            lanes[2] = 0;
+            lanes[3] = 0 - kPrime1;
+        }
+
+        void Update(const unsigned char *data, size_t size)
+        {
+            length += size;
+
+            for (size_t i = 0; i + 32 <= size; i += 32)
+            {
+                lanes[0] = Round(lanes[0], Read64(data + i));
+                lanes[1] = Round(lanes[1], Read64(data + i + 8));
+                lanes[2] = Round(lanes[2], Read64(data + i + 16));
+                lanes[3] = Round(lanes[3], Read64(data + i + 24));
+            }
+        }
+
+        // The tail is whatever the last piece left over past its stripes.
+        uint64_t Finish(const unsigned char *tail, size_t size)
+        {
+            length += size;
+
+            uint64_t hash;
+            if (length >= 32)
+            {
+                hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+                hash = MergeRound(hash, lanes[0]);
+                hash = MergeRound(hash, lanes[1]);
+                hash = MergeRound(hash, lanes[2]);
+                hash = MergeRound(hash, lanes[3]);
+            }
+            else
+            {
+                hash = kPrime5;
+            }
+
+            hash += length;
+
+            for (; size >= 8; tail += 8, size -= 8)
+            {
+                hash ^= Round(0, Read64(tail));
+                hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+            }
+
+            if (size >= 4)
+            {
+                hash ^= (uint64_t)Read32(tail) * kPrime1;
+                hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+                tail += 4;
+                size -= 4;
+            }
+
+            for (; size > 0; tail++, size--)
+            {
+                hash ^= *tail * kPrime5;
+                hash = RotateLeft(hash, 11) * kPrime1;
+            }
+
+            hash ^= hash >> 33;
+            hash *= kPrime2;
+            hash ^= hash >> 29;
+            hash *= kPrime3;
+            hash ^= hash >> 32;
+
+            return hash;
+        }
+
+    private:
+        uint64_t lanes[4];
+        uint64_t length;
+    };
+}
+
+ContentVerifier::ContentVerifier(uint64_t maxHashedSize) : maxHashedSize(maxHashedSize),
+                                                           files(64)
+{
+}
+
+bool ContentVerifier::HasChanged(const std::string &path)
+{
+    FileState state;
+    if (!ReadState(path, state))
+    {
+        Forget(path);
+        return true;
+    }
+
+    uint64_t key = HashPath(path);
+    FileState *known = files.Find(key);
+
+    bool changed;
+    if (!known || known->fileId != state.fileId)
+    {
+        changed = true;
+    }
+    else if (state.hashed && known->hashed)
+    {
+        changed = state.contentHash != known->contentHash;
+    }
+    else
+    {
+        changed = state.size != known->size || state.modifiedTime != known->modifiedTime;
+    }
+
+    if (!known && files.GetSize() >= kMaxFiles)
+    {
+        files.Clear();
+    }
+
+    files.Insert(key, state);
+
+    return changed;
+}
+
+void ContentVerifier::Forget(const std::string &path)
+{
+    files.Erase(HashPath(path));
+}
+
+uint64_t ContentVerifier::HashContents(const void *data, size_t length)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t stripes = length / 32 * 32;
+
+    StreamingHash hash;
+    hash.Update(bytes, stripes);
+    return hash.Finish(bytes + stripes, length - stripes);
+}
+
+bool ContentVerifier::ReadState(const std::string &path, FileState &state)
+{
+    state.hashed = false;
+    state.contentHash = 0;
+
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    state.fileId = st.st_ino;
+    state.size = st.st_size;
+    state.modifiedTime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(file, &info) || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    state.fileId = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    state.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    state.modifiedTime = ((int64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#endif
+
+    if (state.size <= maxHashedSize)
+    {
+        if (!chunk)
+        {
+            chunk = std::make_unique<unsigned char[]>(kChunkSize);
+        }
+
+        StreamingHash hash;
+        size_t filled = 0;
+        bool failed = false;
+
+        // Chunks are only handed on full, so every piece but the last is a
+        // whole number of stripes.
+        for (;;)
+        {
+#ifdef __linux__
+            ssize_t got = read(fd, chunk.get() + filled, kChunkSize - filled);
+            if (got < 0)
+            {
+                failed = true;
+                break;
+            }
+#else
+            DWORD got = 0;
+            if (!ReadFile(file, chunk.get() + filled, (DWORD)(kChunkSize - filled), &got, nullptr))
+            {
+                failed = true;
+                break;
+            }
+#endif
+            filled += got;
+
+            if (got == 0 || filled == kChunkSize)
+            {
+                if (got == 0)
+                {
+                    break;
+                }
+
+                hash.Update(chunk.get(), filled);
+                filled = 0;
+            }
+        }
+
+        if (!failed)
+        {
+            size_t stripes = filled / 32 * 32;
+            hash.Update(chunk.get(), stripes);
+            state.contentHash = hash.Finish(chunk.get() + stripes, filled - stripes);
+            state.hashed = true;
+        }
+    }
+
+#ifdef __linux__
+    close(fd);
+#else
+    CloseHandle(file);
+#endif
+
+    return true;
+}
+
+uint64_t ContentVerifier::HashPath(const std::string &path)
+{
+    // FNV-1a, as elsewhere; only ever compared within one watcher.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        hash ^= (unsigned char)path[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
@@ -0,0 +1,89 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef CONTENTHASH_H_
+#define CONTENTHASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "flatmap.h"
+
+// Remembers what each file held the last time it was reported modified, as
+// a 64-bit hash of its contents, so that rewriting a file with the same
+// bytes can be told apart from changing it. Files larger than the limit are
+// only compared by size and modification time. A different file under the
+// same name, such as one renamed over it, always counts as changed.
+class ContentVerifier
+{
+public:
+    explicit ContentVerifier(uint64_t maxHashedSize);
+
+    // Whether the file differs from the last time it was checked. One that
+    // hasn't been checked before, or can't be read, counts as changed.
+    bool HasChanged(const std::string &path);
+
+    // Drops what is known about the file, once it is deleted or renamed.
+    void Forget(const std::string &path);
+
+    inline size_t GetSize() const { return files.GetSize(); }
+
+    // XXH64 with a seed of 0.
+    static uint64_t HashContents(const void *data, size_t length);
+
+private:
+    struct FileState
+    {
+        uint64_t fileId;
+        uint64_t size;
+        int64_t modifiedTime;
+        uint64_t contentHash;
+        bool hashed;
+    };
+
+    bool ReadState(const std::string &path, FileState &state);
+    static uint64_t HashPath(const std::string &path);
+
+    uint64_t maxHashedSize;
+    FlatHashMap<uint64_t, FileState> files;
+
+    // Files are read in chunks rather than mapped, as a file truncated while
+    // mapped would fault the whole process.
+    std::unique_ptr<unsigned char[]> chunk;
+
+    static constexpr size_t kChunkSize = 64 * 1024;
+
+    // Past this many files, everything is forgotten rather than letting the
+    // table grow with every file ever written.
+    static constexpr size_t kMaxFiles = 65536;
+};
+
+#endif // CONTENTHASH_H_
@@ -0,0 +1,330 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "watcher.h"
+
+#include <algorithm>
+
+namespace
+{
+#ifdef __linux__
+    constexpr char kSeparator = '/';
+#else
+    constexpr char kSeparator = '\\';
+#endif
+
+    void AppendComponent(std::string &out, bool separate, const char *data, size_t length)
+    {
+        if (length == 0)
+        {
+            return;
+        }
+
+        if (separate && !out.empty() && out.back() != kSeparator && out.back() != '/')
+        {
+            out += kSeparator;
+        }
+
+        out.append(data, length);
+    }
+
+    uint64_t HashPath(uint32_t directory, const char *name, size_t length)
+    {
+        // FNV-1a over the directory index, then the name.
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        for (int i = 0; i < 4; i++)
+        {
+            hash ^= (directory >> (i * 8)) & 0xff;
+            hash *= 0x100000001b3ull;
+        }
+
+        for (size_t i = 0; i < length; i++)
+        {
+            hash ^= (unsigned char)name[i];
+            hash *= 0x100000001b3ull;
+        }
+
+        return hash;
+    }
+}
+
+std::string DirectoryWatcher::NotifyEvent::GetPath() const
+{
+    std::string path;
+    AppendPath(path, directory, nameOffset, nameLength, false);
+    return path;
+}
+
+std::string DirectoryWatcher::NotifyEvent::GetLastPath() const
+{
+    std::string path;
+    if (flags & kRenamed)
+    {
+        AppendPath(path, lastDirectory, lastNameOffset, lastNameLength, false);
+    }
+
+    return path;
+}
+
+void DirectoryWatcher::NotifyEvent::AppendRelativePath(std::string &out) const
+{
+    AppendPath(out, directory, nameOffset, nameLength, true);
+}
+
+void DirectoryWatcher::NotifyEvent::AppendRelativeLastPath(std::string &out) const
+{
+    if (flags & kRenamed)
+    {
+        AppendPath(out, lastDirectory, lastNameOffset, lastNameLength, true);
+    }
+}
+
+std::shared_ptr<const FileContents> DirectoryWatcher::NotifyEvent::GetContents() const
+{
+    if (contents == kNoContents)
+    {
+        return nullptr;
+    }
+
+    return batch->contents[contents];
+}
+
+std::chrono::steady_clock::time_point DirectoryWatcher::NotifyEvent::GetQueueTime() const
+{
+    return batch->GetQueueTime();
+}
+
+void DirectoryWatcher::NotifyEvent::AppendPath(std::string &out, uint32_t dir, uint32_t offset, uint32_t length, bool relative) const
+{
+    // Only the components after the first one get a separator, so relative
+    // paths can be appended onto whatever the caller already has.
+    bool separate = false;
+
+    if (!relative)
+    {
+        out += batch->root;
+        separate = true;
+    }
+
+    if (type != kFilesystem)
+    {
+        return;
+    }
+
+    const char *slab = batch->slab.data();
+    auto &span = batch->directories[dir];
+
+    AppendComponent(out, separate, slab + span.offset, span.length);
+    separate = separate || span.length > 0;
+
+    AppendComponent(out, separate, slab + offset, length);
+}
+
+DirectoryWatcher::EventBatch::EventBatch()
+{
+    // Enough for a typical wakeup, so recycled batches rarely have to grow.
+    slab.reserve(1024);
+    directories.reserve(8);
+    events.reserve(32);
+}
+
+void DirectoryWatcher::EventBatch::Reset(const std::string &rootPath)
+{
+    root.assign(rootPath);
+    slab.clear();
+    directories.clear();
+    events.clear();
+    contents.clear();
+    changes.Clear();
+}
+
+uint32_t DirectoryWatcher::EventBatch::AppendToSlab(const char *data, size_t length)
+{
+    uint32_t offset = (uint32_t)slab.size();
+    slab.append(data, length);
+    return offset;
+}
+
+uint32_t DirectoryWatcher::EventBatch::AddDirectory(const char *relPath, size_t length)
+{
+    Span span;
+    span.offset = AppendToSlab(relPath, length);
+    span.length = (uint32_t)length;
+
+    directories.push_back(span);
+    return (uint32_t)(directories.size() - 1);
+}
+
+DirectoryWatcher::NotifyEvent &DirectoryWatcher::EventBatch::AddEvent(
+    NotifyEventType type,
+    NotifyFilterFlags flags,
+    uint32_t directory,
+    const char *name,
+    size_t length)
+{
+    events.emplace_back();
+
+    auto &event = events.back();
+    event.type = type;
+    event.flags = flags;
+    event.batch = this;
+    event.directory = directory;
+    event.nameOffset = AppendToSlab(name, length);
+    event.nameLength = (uint32_t)length;
+    event.lastDirectory = directory;
+    event.lastNameOffset = 0;
+    event.lastNameLength = 0;
+    event.contents = kNoContents;
+    event.readTime = std::chrono::steady_clock::now();
+    event.dispatchTime = std::chrono::steady_clock::time_point();
+
+    return event;
+}
+
+void DirectoryWatcher::EventBatch::AttachContents(NotifyEvent &event, std::shared_ptr<const FileContents> &&fileContents)
+{
+    contents.push_back(std::move(fileContents));
+    event.contents = (uint32_t)(contents.size() - 1);
+}
+
+void DirectoryWatcher::EventBatch::ClearContents()
+{
+    contents.clear();
+}
+
+void DirectoryWatcher::EventBatch::AddChange(NotifyFilterFlags flags, uint32_t directory, const char *name, size_t length)
+{
+    uint64_t key = HashPath(directory, name, length);
+
+    uint32_t *last = changes.Find(key);
+    if (last && HasPath(events[*last], directory, name, length))
+    {
+        NotifyEvent &previous = events[*last];
+
+        if (flags == kModified && (previous.flags & (kCreated | kModified)))
+        {
+            return;
+        }
+
+        if (flags == kDeleted && (previous.flags & (kCreated | kModified)))
+        {
+            // Cancelled events are left in place, since others may be
+            // referred to by index, and dropped by Filter().
+            bool created = (previous.flags & kCreated) != 0;
+            previous.flags = kNone;
+
+            if (created)
+            {
+                changes.Erase(key);
+                return;
+            }
+        }
+    }
+
+    AddEvent(kFilesystem, flags, directory, name, length);
+    changes.Insert(key, (uint32_t)(events.size() - 1));
+}
+
+void DirectoryWatcher::EventBatch::BreakChanges(uint32_t directory, const char *name, size_t length)
+{
+    changes.Erase(HashPath(directory, name, length));
+}
+
+bool DirectoryWatcher::EventBatch::HasPath(const NotifyEvent &event, uint32_t directory, const char *name, size_t length) const
+{
+    return event.directory == directory &&
+           event.nameLength == length &&
+           slab.compare(event.nameOffset, length, name, length) == 0;
+}
+
+void DirectoryWatcher::EventBatch::SetRenamed(NotifyEvent &event, uint32_t directory, const char *name, size_t length)
+{
+    event.lastDirectory = event.directory;
+    event.lastNameOffset = event.nameOffset;
+    event.lastNameLength = event.nameLength;
+
+    event.directory = directory;
+    event.nameOffset = AppendToSlab(name, length);
+    event.nameLength = (uint32_t)length;
+}
+
+size_t DirectoryWatcher::EventBatch::Filter(NotifyFilterFlags flags, const PathMatcher *matcher)
+{
+    auto filtered = [this, flags, matcher](const NotifyEvent &event)
+    {
+        if (event.type != kFilesystem)
+        {
+            return false;
+        }
+
+        if (!(event.flags & flags))
+        {
+            return true;
+        }
+
+        if (!matcher)
+        {
+            return false;
+        }
+
+        matchPath.clear();
+        event.AppendRelativePath(matchPath);
+        if (matcher->IsAccepted(matchPath.data(), matchPath.size()))
+        {
+            return false;
+        }
+
+        if (event.flags & kRenamed)
+        {
+            matchPath.clear();
+            event.AppendRelativeLastPath(matchPath);
+            return !matcher->IsAccepted(matchPath.data(), matchPath.size());
+        }
+
+        return true;
+    };
+
+    size_t size = events.size();
+    events.erase(std::remove_if(events.begin(), events.end(), filtered), events.end());
+    return size - events.size();
+}
+
+bool DirectoryWatcher::EventBatch::IsOversized() const
+{
+    return slab.capacity() > 256 * 1024 || events.capacity() > 8192;
+}
+
+size_t DirectoryWatcher::EventBatch::GetMemoryUsage() const
+{
+    return sizeof(EventBatch) + root.capacity() + slab.capacity() +
+           directories.capacity() * sizeof(Span) +
+           events.capacity() * sizeof(NotifyEvent) +
+           contents.capacity() * sizeof(contents[0]);
+}
@@ -0,0 +1,370 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "fanotify.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    uint64_t HashBytes(const char *data, size_t length)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            hash ^= (unsigned char)data[i];
+            hash *= 0x100000001b3ull;
+        }
+
+        return hash;
+    }
+
+    // The name that follows the handle in a DFID_NAME record.
+    const char *GetRecordName(const fanotify_event_info_fid *info, const char *end, size_t &length)
+    {
+        const file_handle *handle = (const file_handle *)info->handle;
+        const char *name = (const char *)handle->f_handle + handle->handle_bytes;
+
+        length = name < end ? strnlen(name, end - name) : 0;
+        return name;
+    }
+}
+
+FanotifyWatch::FanotifyWatch() : fileDescriptor(-1),
+                                 mountDescriptor(-1),
+                                 subtree(false),
+                                 directoryFilter(nullptr),
+                                 mask(0),
+                                 bufferSize(0),
+                                 stale(false)
+{
+}
+
+FanotifyWatch::~FanotifyWatch()
+{
+    if (mountDescriptor != -1)
+    {
+        close(mountDescriptor);
+    }
+
+    // Closing the group removes its marks.
+    if (fileDescriptor != -1)
+    {
+        close(fileDescriptor);
+    }
+}
+
+bool FanotifyWatch::Open(const std::string &path, bool watchSubtree, const PathMatcher *filter, uint64_t eventMask, size_t size)
+{
+    // Handles resolve to the real path, so that is what's compared against.
+    char resolved[PATH_MAX];
+    if (!realpath(path.c_str(), resolved))
+    {
+        return false;
+    }
+
+    rootPath = resolved;
+    subtree = watchSubtree;
+    directoryFilter = filter;
+
+    fileDescriptor = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor == -1)
+    {
+        return false;
+    }
+
+    // Any descriptor on the filesystem will do to resolve handles against.
+    // One on the watched directory would keep it from being freed, and so
+    // from reporting its removal, so its parent is used unless that is on
+    // another filesystem; a mount point can't be removed anyway.
+    struct stat rootStat, parentStat;
+    if (stat(rootPath.c_str(), &rootStat) == -1)
+    {
+        return false;
+    }
+
+    std::string parentPath = rootPath + "/..";
+    bool sameDevice = stat(parentPath.c_str(), &parentStat) == 0 && parentStat.st_dev == rootStat.st_dev;
+
+    mountDescriptor = open(sameDevice ? parentPath.c_str() : rootPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mountDescriptor == -1)
+    {
+        return false;
+    }
+
+    // A mark of its own on the watched directory, so its removal is noticed
+    // without asking for every deletion on the filesystem.
+    if (fanotify_mark(fileDescriptor, FAN_MARK_ADD | FAN_MARK_ONLYDIR, FAN_DELETE_SELF | FAN_MOVE_SELF | FAN_ONDIR, AT_FDCWD, rootPath.c_str()) == -1)
+    {
+        return false;
+    }
+
+    if (!SetMask(eventMask))
+    {
+        return false;
+    }
+
+    bufferSize = size;
+    buffer = std::make_unique<char[]>(bufferSize);
+
+    return true;
+}
+
+bool FanotifyWatch::SetMask(uint64_t eventMask)
+{
+    uint64_t removed = mask & ~eventMask;
+    uint64_t added = eventMask & ~mask;
+
+    if ((removed & ~FAN_ONDIR) &&
+        fanotify_mark(fileDescriptor, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, removed, AT_FDCWD, rootPath.c_str()) == -1)
+    {
+        return false;
+    }
+
+    // A mark can't be added without any events in it.
+    if ((eventMask & ~FAN_ONDIR) && (added & ~FAN_ONDIR) &&
+        fanotify_mark(fileDescriptor, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, eventMask, AT_FDCWD, rootPath.c_str()) == -1)
+    {
+        return false;
+    }
+
+    mask = eventMask;
+    return true;
+}
+
+bool FanotifyWatch::IsInTree(const std::string &path) const
+{
+    if (!directoryFilter)
+    {
+        return true;
+    }
+
+    // Nothing below a directory the filter turns away is watched.
+    for (size_t i = 0; i <= path.size(); i++)
+    {
+        if ((i == path.size() || path[i] == '/') && !directoryFilter->IsAccepted(path.data(), i))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint32_t FanotifyWatch::Resolve(const void *record)
+{
+    const fanotify_event_info_fid *info = (const fanotify_event_info_fid *)record;
+    const file_handle *handle = (const file_handle *)info->handle;
+
+    // The filesystem id and the handle that follows it identify the
+    // directory.
+    const char *key = (const char *)&info->fsid;
+    size_t keyLength = sizeof(info->fsid) + sizeof(file_handle) + handle->handle_bytes;
+    uint64_t hash = HashBytes(key, keyLength);
+
+    const uint32_t *index = handles.Find(hash);
+    if (index)
+    {
+        const Directory &directory = directories[*index];
+        if (directory.handle.size() == keyLength && memcmp(directory.handle.data(), key, keyLength) == 0)
+        {
+            return directory.inTree ? *index : kOutside;
+        }
+    }
+
+    int fd = open_by_handle_at(mountDescriptor, (file_handle *)handle, O_PATH | O_CLOEXEC);
+    if (fd == -1)
+    {
+        // It has been removed since.
+        return kOutside;
+    }
+
+    char link[32];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+
+    char path[PATH_MAX];
+    ssize_t length = readlink(link, path, sizeof(path));
+    close(fd);
+
+    if (length <= 0 || (size_t)length >= sizeof(path))
+    {
+        return kOutside;
+    }
+
+    Directory directory;
+    directory.handle.assign(key, keyLength);
+    directory.inTree = false;
+
+    size_t rootLength = rootPath.size();
+    bool atTop = rootPath.back() == '/';
+
+    if ((size_t)length >= rootLength && memcmp(path, rootPath.data(), rootLength) == 0)
+    {
+        if ((size_t)length == rootLength)
+        {
+            directory.inTree = true;
+        }
+        else if (subtree && (atTop || path[rootLength] == '/'))
+        {
+            size_t start = atTop ? rootLength : rootLength + 1;
+            directory.path.assign(path + start, length - start);
+            directory.inTree = IsInTree(directory.path);
+        }
+    }
+
+    uint32_t id = (uint32_t)directories.size();
+    directories.push_back(std::move(directory));
+
+    if (!index)
+    {
+        handles.Insert(hash, id);
+    }
+
+    return directories[id].inTree ? id : kOutside;
+}
+
+bool FanotifyWatch::Read(std::vector<Event> &events)
+{
+    events.clear();
+    names.clear();
+
+    // Nothing refers to the directories resolved before anymore.
+    if (stale || directories.size() > kMaxDirectories)
+    {
+        directories.clear();
+        handles.Clear();
+        stale = false;
+    }
+
+    for (;;)
+    {
+        ssize_t len = read(fileDescriptor, buffer.get(), bufferSize);
+        if (len == -1)
+        {
+            return errno == EAGAIN || errno == EINTR;
+        }
+
+        if (len == 0)
+        {
+            return true;
+        }
+
+        const fanotify_event_metadata *metadata = (const fanotify_event_metadata *)buffer.get();
+        for (; FAN_EVENT_OK(metadata, len); metadata = FAN_EVENT_NEXT(metadata, len))
+        {
+            if (metadata->vers != FANOTIFY_METADATA_VERSION)
+            {
+                return false;
+            }
+
+            if (metadata->fd >= 0)
+            {
+                close(metadata->fd);
+            }
+
+            // Only the mark on the watched directory itself asks for these.
+            if (metadata->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF))
+            {
+                return false;
+            }
+
+            Event event = {};
+            event.mask = metadata->mask;
+            event.directory = kOutside;
+            event.oldDirectory = kOutside;
+
+            if (metadata->mask & FAN_Q_OVERFLOW)
+            {
+                events.push_back(event);
+                continue;
+            }
+
+            const char *record = (const char *)metadata + metadata->metadata_len;
+            const char *end = (const char *)metadata + metadata->event_len;
+
+            while (record + sizeof(fanotify_event_info_header) <= end)
+            {
+                const fanotify_event_info_header *header = (const fanotify_event_info_header *)record;
+                if (header->len == 0 || record + header->len > end)
+                {
+                    break;
+                }
+
+                bool isOld = header->info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME;
+                if (isOld ||
+                    header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ||
+                    header->info_type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME)
+                {
+                    uint32_t directory = Resolve(record);
+                    if (directory != kOutside)
+                    {
+                        size_t nameLength;
+                        const char *name = GetRecordName((const fanotify_event_info_fid *)record, record + header->len, nameLength);
+
+                        uint32_t nameOffset = (uint32_t)names.size();
+                        names.append(name, nameLength);
+                        names.push_back('\0');
+
+                        (isOld ? event.oldDirectory : event.directory) = directory;
+                        (isOld ? event.oldNameOffset : event.nameOffset) = nameOffset;
+                        (isOld ? event.oldNameLength : event.nameLength) = (uint32_t)nameLength;
+                    }
+                }
+
+                record += header->len;
+            }
+
+            // Renaming a directory changes the path of everything below it,
+            // so later events have to look them up again.
+            if ((metadata->mask & FAN_RENAME) && (metadata->mask & FAN_ONDIR))
+            {
+                handles.Clear();
+                stale = true;
+            }
+
+            if (event.directory != kOutside || event.oldDirectory != kOutside)
+            {
+                events.push_back(event);
+            }
+        }
+    }
+}
+
+#endif // __linux__
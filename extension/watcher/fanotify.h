@@ -0,0 +1,135 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef FANOTIFY_H_
+#define FANOTIFY_H_
+
+#ifdef __linux__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flatmap.h"
+#include "pathmatcher.h"
+
+// Watches a whole tree with one fanotify mark on the filesystem it lives on,
+// instead of a watch per directory. Events name the directory they happened
+// in by handle; those are resolved back to paths here, and anything outside
+// the watched tree is dropped.
+//
+// Handles are resolved when the event is read, not when it happened, so a
+// change in a directory that was renamed or removed since is reported at
+// its new path, or not at all.
+class FanotifyWatch
+{
+public:
+    struct Event
+    {
+        uint64_t mask;
+
+        // The directory the entry is in, or kOutside, and where its name was
+        // copied to. For FAN_RENAME, these describe where it moved to, and
+        // the old ones where it came from.
+        uint32_t directory;
+        uint32_t nameOffset;
+        uint32_t nameLength;
+
+        uint32_t oldDirectory;
+        uint32_t oldNameOffset;
+        uint32_t oldNameLength;
+    };
+
+    static constexpr uint32_t kOutside = UINT32_MAX;
+
+    FanotifyWatch();
+    ~FanotifyWatch();
+
+    FanotifyWatch(const FanotifyWatch &) = delete;
+    FanotifyWatch &operator=(const FanotifyWatch &) = delete;
+
+    // Fails if fanotify can't report directory entry events here, such as
+    // without CAP_SYS_ADMIN or on a kernel without FAN_RENAME. Directories
+    // the filter turns away are treated as outside the tree, along with
+    // everything below them.
+    bool Open(const std::string &path, bool subtree, const PathMatcher *directoryFilter, uint64_t mask, size_t bufferSize);
+
+    bool SetMask(uint64_t mask);
+
+    // Reads everything queued. Returns false once the watch can't go on,
+    // because reading failed or the watched directory was removed or moved.
+    bool Read(std::vector<Event> &events);
+
+    // Paths are relative to the watched directory. Both stay valid until
+    // the next Read().
+    inline const std::string &GetPath(uint32_t directory) const { return directories[directory].path; }
+    inline const char *GetName(uint32_t offset) const { return names.data() + offset; }
+
+    inline int GetDescriptor() const { return fileDescriptor; }
+    inline size_t GetBufferSize() const { return bufferSize; }
+
+private:
+    uint32_t Resolve(const void *info);
+    bool IsInTree(const std::string &path) const;
+
+    int fileDescriptor;
+    int mountDescriptor;
+    std::string rootPath;
+    bool subtree;
+    const PathMatcher *directoryFilter;
+    uint64_t mask;
+
+    std::unique_ptr<char[]> buffer;
+    size_t bufferSize;
+
+    // Names from the last Read().
+    std::string names;
+
+    // Directories resolved so far, looked up by a hash of their handle. A
+    // directory being renamed makes the lookup forget them, and once the
+    // events that refer to them have been handled, they are dropped.
+    struct Directory
+    {
+        std::string handle;
+        std::string path;
+        bool inTree;
+    };
+
+    std::vector<Directory> directories;
+    FlatHashMap<uint64_t, uint32_t> handles;
+    bool stale;
+
+    static constexpr size_t kMaxDirectories = 4096;
+};
+
+#endif // __linux__
+
+#endif // FANOTIFY_H_
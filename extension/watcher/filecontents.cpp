@@ -0,0 +1,166 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "filecontents.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <Windows.h>
+#endif
+
+ContentBudget::ContentBudget() : limit(0),
+                                 used(0)
+{
+}
+
+bool ContentBudget::Reserve(size_t size)
+{
+    size_t bytes = GetLimit();
+    size_t current = used.load(std::memory_order_relaxed);
+
+    do
+    {
+        if (current > bytes || size > bytes - current)
+        {
+            return false;
+        }
+    } while (!used.compare_exchange_weak(current, current + size, std::memory_order_relaxed));
+
+    return true;
+}
+
+void ContentBudget::Release(size_t size)
+{
+    used.fetch_sub(size, std::memory_order_relaxed);
+}
+
+FileContents::FileContents(const std::shared_ptr<ContentBudget> &budget, size_t reserved) : budget(budget),
+                                                                                         size(0),
+                                                                                         reserved(reserved)
+{
+}
+
+FileContents::~FileContents()
+{
+    budget->Release(reserved);
+}
+
+std::shared_ptr<const FileContents> FileContents::Read(const std::string &path, const std::shared_ptr<ContentBudget> &budget, size_t maxSize)
+{
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    size_t length = (size_t)st.st_size;
+#else
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return nullptr;
+    }
+
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(file, &info) || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    size_t length = (size_t)(((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow);
+#endif
+
+    std::shared_ptr<FileContents> contents;
+    if (length <= maxSize && budget->Reserve(length))
+    {
+        contents.reset(new FileContents(budget, length));
+        contents->data.reset(new char[length ? length : 1]);
+    }
+
+#ifdef __linux__
+    if (contents)
+    {
+        // The whole file is read straight away, so let the kernel read ahead
+        // as far as it will.
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+
+    // Only what the file held when it was opened is taken; a file that
+    // shrinks in the meantime is cut short.
+    while (contents && contents->size < length)
+    {
+        char *at = contents->data.get() + contents->size;
+        size_t wanted = length - contents->size;
+#ifdef __linux__
+        ssize_t got = read(fd, at, wanted);
+        if (got < 0)
+        {
+            contents.reset();
+            break;
+        }
+#else
+        DWORD got = 0;
+        if (!ReadFile(file, at, (DWORD)(wanted < 0x40000000 ? wanted : 0x40000000), &got, nullptr))
+        {
+            contents.reset();
+            break;
+        }
+#endif
+        if (got == 0)
+        {
+            budget->Release(contents->reserved - contents->size);
+            contents->reserved = contents->size;
+            break;
+        }
+
+        contents->size += (size_t)got;
+    }
+
+#ifdef __linux__
+    close(fd);
+#else
+    CloseHandle(file);
+#endif
+
+    return contents;
+}
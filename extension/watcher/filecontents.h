@@ -0,0 +1,87 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef FILECONTENTS_H_
+#define FILECONTENTS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// How many bytes of file contents a watcher may hold at once, counting both
+// those still queued and those the consumer kept. Shared with every copy, so
+// one that outlives its watcher still gives its bytes back.
+class ContentBudget
+{
+public:
+    ContentBudget();
+
+    // Takes the bytes from the budget, unless that would exceed the limit.
+    bool Reserve(size_t size);
+    void Release(size_t size);
+
+    inline void SetLimit(size_t bytes) { limit.store(bytes, std::memory_order_relaxed); }
+    inline size_t GetLimit() const { return limit.load(std::memory_order_relaxed); }
+    inline size_t GetUsed() const { return used.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<size_t> limit;
+    std::atomic<size_t> used;
+};
+
+// An immutable copy of a file, taken by the worker as the change that made it
+// is reported, so the consumer can read it without touching the disk. The
+// file is copied rather than mapped: a mapping follows later writes, and one
+// truncated while mapped would fault the whole process.
+class FileContents
+{
+public:
+    // Returns null if the path isn't a regular file, can't be read, or is
+    // larger than the limit or than what is left of the budget.
+    static std::shared_ptr<const FileContents> Read(const std::string &path, const std::shared_ptr<ContentBudget> &budget, size_t maxSize);
+
+    FileContents(const FileContents &) = delete;
+    FileContents &operator=(const FileContents &) = delete;
+    ~FileContents();
+
+    inline const char *GetData() const { return data.get(); }
+    inline size_t GetSize() const { return size; }
+
+private:
+    FileContents(const std::shared_ptr<ContentBudget> &budget, size_t reserved);
+
+    std::shared_ptr<ContentBudget> budget;
+    std::unique_ptr<char[]> data;
+    size_t size;
+    size_t reserved;
+};
+
+#endif // FILECONTENTS_H_
@@ -0,0 +1,223 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef FLATMAP_H_
+#define FLATMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Open-addressing hash map for integer keys. Slots live in one array and
+// collisions probe linearly, so lookups touch one or two cache lines and
+// erasing never leaves tombstones behind.
+template <typename Key, typename Value>
+class FlatHashMap
+{
+public:
+    explicit FlatHashMap(size_t capacity = 16)
+    {
+        Allocate(capacity);
+    }
+
+    FlatHashMap(const FlatHashMap &) = delete;
+    FlatHashMap &operator=(const FlatHashMap &) = delete;
+
+    Value *Find(Key key)
+    {
+        for (size_t i = Hash(key);; i = (i + 1) & mask)
+        {
+            Slot &slot = slots[i];
+            if (!slot.used)
+            {
+                return nullptr;
+            }
+
+            if (slot.key == key)
+            {
+                return &slot.value;
+            }
+        }
+    }
+
+    inline const Value *Find(Key key) const
+    {
+        return const_cast<FlatHashMap *>(this)->Find(key);
+    }
+
+    // Inserts the key if it isn't present, then assigns the value.
+    Value &Insert(Key key, Value value)
+    {
+        // Keep the load factor at or below one half.
+        if ((size + 1) * 2 > mask + 1)
+        {
+            Grow();
+        }
+
+        size_t i = Hash(key);
+        for (; slots[i].used; i = (i + 1) & mask)
+        {
+            if (slots[i].key == key)
+            {
+                slots[i].value = std::move(value);
+                return slots[i].value;
+            }
+        }
+
+        slots[i].used = true;
+        slots[i].key = key;
+        slots[i].value = std::move(value);
+        size++;
+
+        return slots[i].value;
+    }
+
+    bool Erase(Key key)
+    {
+        size_t i = Hash(key);
+        for (;; i = (i + 1) & mask)
+        {
+            if (!slots[i].used)
+            {
+                return false;
+            }
+
+            if (slots[i].key == key)
+            {
+                break;
+            }
+        }
+
+        // Shift later members of the probe chain back into the hole so
+        // lookups never have to skip over deleted slots.
+        for (size_t j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask)
+        {
+            size_t home = Hash(slots[j].key);
+            if (((j - home) & mask) >= ((j - i) & mask))
+            {
+                slots[i] = std::move(slots[j]);
+                i = j;
+            }
+        }
+
+        slots[i].used = false;
+        slots[i].value = Value();
+        size--;
+
+        return true;
+    }
+
+    // Empties the map but keeps its storage.
+    void Clear()
+    {
+        if (size == 0)
+        {
+            return;
+        }
+
+        for (size_t i = 0; i <= mask; i++)
+        {
+            slots[i].used = false;
+            slots[i].value = Value();
+        }
+
+        size = 0;
+    }
+
+    template <typename F>
+    void ForEach(F &&callback)
+    {
+        for (size_t i = 0; i <= mask; i++)
+        {
+            if (slots[i].used)
+            {
+                callback(slots[i].key, slots[i].value);
+            }
+        }
+    }
+
+    inline size_t GetSize() const { return size; }
+    inline bool IsEmpty() const { return size == 0; }
+
+private:
+    struct Slot
+    {
+        Key key;
+        Value value;
+        bool used;
+    };
+
+    inline size_t Hash(Key key) const
+    {
+        // Fibonacci hashing spreads sequential keys such as watch descriptors
+        // and rename cookies across the table.
+        return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    }
+
+    void Allocate(size_t capacity)
+    {
+        size_t count = 8;
+        while (count < capacity)
+        {
+            count <<= 1;
+        }
+
+        slots = std::make_unique<Slot[]>(count);
+        mask = count - 1;
+        size = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            slots[i].used = false;
+        }
+    }
+
+    void Grow()
+    {
+        std::unique_ptr<Slot[]> old = std::move(slots);
+        size_t oldCount = mask + 1;
+
+        Allocate(oldCount * 2);
+
+        for (size_t i = 0; i < oldCount; i++)
+        {
+            if (old[i].used)
+            {
+                Insert(old[i].key, std::move(old[i].value));
+            }
+        }
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    size_t size;
+};
+
+#endif // FLATMAP_H_
@@ -0,0 +1,144 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "histogram.h"
+
+#include <cmath>
+#include <cstring>
+
+LatencyHistogram::LatencyHistogram()
+{
+    Clear();
+}
+
+void LatencyHistogram::Clear()
+{
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    max = 0;
+}
+
+size_t LatencyHistogram::GetBucket(uint64_t value)
+{
+    if (value < kSubBuckets)
+    {
+        return (size_t)value;
+    }
+
+    // The position of the highest set bit picks the power of two, and the
+    // two bits below it the bucket within it.
+    unsigned int exponent = 0;
+    for (unsigned int shift = 32; shift; shift >>= 1)
+    {
+        if (value >> (exponent + shift))
+        {
+            exponent += shift;
+        }
+    }
+
+    size_t subBucket = (size_t)(value >> (exponent - 2)) & (kSubBuckets - 1);
+    return (exponent - 1) * kSubBuckets + subBucket;
+}
+
+uint64_t LatencyHistogram::GetBucketLimit(size_t bucket)
+{
+    if (bucket < kSubBuckets)
+    {
+        return bucket;
+    }
+
+    unsigned int exponent = (unsigned int)(bucket / kSubBuckets) + 1;
+    uint64_t subBucket = bucket % kSubBuckets;
+
+    // Wraps around to the largest value for the very last bucket.
+    return ((kSubBuckets + subBucket + 1) << (exponent - 2)) - 1;
+}
+
+void LatencyHistogram::Record(std::chrono::microseconds latency)
+{
+    uint64_t value = latency.count() > 0 ? (uint64_t)latency.count() : 0;
+
+    buckets[GetBucket(value)]++;
+    count++;
+
+    if (value > max)
+    {
+        max = value;
+    }
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other)
+{
+    for (size_t i = 0; i < kBucketCount; i++)
+    {
+        buckets[i] += other.buckets[i];
+    }
+
+    count += other.count;
+    if (other.max > max)
+    {
+        max = other.max;
+    }
+}
+
+std::chrono::microseconds LatencyHistogram::GetPercentile(double percentile) const
+{
+    if (!count)
+    {
+        return std::chrono::microseconds(0);
+    }
+
+    uint64_t rank = (uint64_t)std::ceil(percentile / 100.0 * (double)count);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t limit = GetBucketLimit(i);
+            return std::chrono::microseconds(limit < max ? limit : max);
+        }
+    }
+
+    return std::chrono::microseconds(max);
+}
+
+LatencyHistogram::Summary LatencyHistogram::GetSummary() const
+{
+    Summary summary;
+    summary.p50 = GetPercentile(50);
+    summary.p99 = GetPercentile(99);
+    summary.max = GetMax();
+    return summary;
+}
@@ -0,0 +1,80 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Counts latencies in buckets that widen with the value, four to every power
+// of two, so a percentile comes out within a quarter of the true value while
+// everything from a microsecond to centuries fits in a fixed table. Not
+// thread-safe; it is meant to be recorded into and read by one thread.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void Record(std::chrono::microseconds latency);
+    void Clear();
+
+    // Adds everything recorded in another histogram.
+    void Merge(const LatencyHistogram &other);
+
+    // The upper bound of the bucket the given percentile, from 0 to 100,
+    // falls in, but never more than the largest latency recorded. 0 if
+    // nothing was recorded.
+    std::chrono::microseconds GetPercentile(double percentile) const;
+
+    inline std::chrono::microseconds GetMax() const { return std::chrono::microseconds(max); }
+    inline uint64_t GetCount() const { return count; }
+
+    struct Summary
+    {
+        std::chrono::microseconds p50;
+        std::chrono::microseconds p99;
+        std::chrono::microseconds max;
+    };
+
+    Summary GetSummary() const;
+
+private:
+    static size_t GetBucket(uint64_t value);
+    static uint64_t GetBucketLimit(size_t bucket);
+
+    static constexpr size_t kSubBuckets = 4;
+    static constexpr size_t kBucketCount = 64 * kSubBuckets;
+
+    uint64_t buckets[kBucketCount];
+    uint64_t count;
+    uint64_t max;
+};
+
+#endif // HISTOGRAM_H_
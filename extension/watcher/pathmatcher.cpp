@@ -0,0 +1,454 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "pathmatcher.h"
+
+namespace
+{
+    inline bool IsSeparator(char c)
+    {
+#ifdef __linux__
+        return c == '/';
+#else
+        return c == '/' || c == '\\';
+#endif
+    }
+
+    inline char Fold(char c)
+    {
+#ifdef __linux__
+        return c;
+#else
+        return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+#endif
+    }
+
+    inline bool IsWildcard(char c)
+    {
+        return c == '*' || c == '?' || c == '[';
+    }
+
+    bool IsSame(const char *a, const char *b, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            if (Fold(a[i]) != Fold(b[i]) && !(IsSeparator(a[i]) && IsSeparator(b[i])))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    uint64_t HashText(const char *text, size_t length)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            hash ^= (unsigned char)(IsSeparator(text[i]) ? '/' : Fold(text[i]));
+            hash *= 0x100000001b3ull;
+        }
+
+        return hash;
+    }
+
+    // Returns the end of the character class starting at p, past its closing
+    // bracket, or nullptr if it isn't closed.
+    const char *FindClassEnd(const char *p, const char *end)
+    {
+        p++;
+        if (p < end && (*p == '!' || *p == '^'))
+        {
+            p++;
+        }
+
+        // A leading bracket is part of the class.
+        if (p < end && *p == ']')
+        {
+            p++;
+        }
+
+        while (p < end && *p != ']')
+        {
+            p++;
+        }
+
+        return p < end ? p + 1 : nullptr;
+    }
+
+    bool MatchClass(const char *p, const char *classEnd, char c)
+    {
+        p++;
+
+        bool negate = *p == '!' || *p == '^';
+        if (negate)
+        {
+            p++;
+        }
+
+        bool matched = false;
+        const char *first = p;
+
+        for (; p < classEnd - 1; p++)
+        {
+            if (*p == ']' && p != first)
+            {
+                break;
+            }
+
+            if (p + 2 < classEnd - 1 && p[1] == '-')
+            {
+                if (Fold(c) >= Fold(p[0]) && Fold(c) <= Fold(p[2]))
+                {
+                    matched = true;
+                }
+
+                p += 2;
+            }
+            else if (Fold(c) == Fold(*p))
+            {
+                matched = true;
+            }
+        }
+
+        return matched != negate;
+    }
+
+    bool MatchGlob(const char *p, const char *pe, const char *s, const char *se)
+    {
+        while (p < pe)
+        {
+            if (*p == '*')
+            {
+                if (p + 1 < pe && p[1] == '*')
+                {
+                    p += 2;
+
+                    // "**/" also matches no directories at all.
+                    if (p < pe && *p == '/' && MatchGlob(p + 1, pe, s, se))
+                    {
+                        return true;
+                    }
+
+                    for (const char *t = s; t <= se; t++)
+                    {
+                        if (MatchGlob(p, pe, t, se))
+                        {
+                            return true;
+                        }
+                    }
+
+                    return false;
+                }
+
+                p++;
+
+                for (const char *t = s;; t++)
+                {
+                    if (MatchGlob(p, pe, t, se))
+                    {
+                        return true;
+                    }
+
+                    if (t == se || IsSeparator(*t))
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            if (s == se)
+            {
+                return false;
+            }
+
+            if (*p == '?')
+            {
+                if (IsSeparator(*s))
+                {
+                    return false;
+                }
+
+                p++;
+            }
+            else if (*p == '[')
+            {
+                const char *classEnd = FindClassEnd(p, pe);
+                if (IsSeparator(*s) || !MatchClass(p, classEnd, *s))
+                {
+                    return false;
+                }
+
+                p = classEnd;
+            }
+            else
+            {
+                if (!IsSame(p, s, 1))
+                {
+                    return false;
+                }
+
+                p++;
+            }
+
+            s++;
+        }
+
+        return s == se;
+    }
+}
+
+PathMatcher::PatternSet::PatternSet() : size(0)
+{
+}
+
+bool PathMatcher::PatternSet::AddLiteral(FlatHashMap<uint64_t, uint32_t> &table, const char *text, size_t length)
+{
+    uint64_t key = HashText(text, length);
+
+    const uint32_t *index = table.Find(key);
+    if (index)
+    {
+        // A different literal with the same hash is tried as a glob instead.
+        const std::string &literal = literals[*index];
+        return literal.size() == length && IsSame(literal.data(), text, length);
+    }
+
+    literals.emplace_back(text, length);
+    table.Insert(key, (uint32_t)(literals.size() - 1));
+    return true;
+}
+
+bool PathMatcher::PatternSet::FindLiteral(
+    const FlatHashMap<uint64_t, uint32_t> &table,
+    const std::vector<std::string> &literals,
+    const char *text,
+    size_t length)
+{
+    if (table.IsEmpty())
+    {
+        return false;
+    }
+
+    const uint32_t *index = table.Find(HashText(text, length));
+    if (!index)
+    {
+        return false;
+    }
+
+    const std::string &literal = literals[*index];
+    return literal.size() == length && IsSame(literal.data(), text, length);
+}
+
+void PathMatcher::PatternSet::Add(const std::string &pattern)
+{
+    size++;
+
+    size_t wildcard = pattern.find_first_of("*?[");
+    bool matchName = pattern.find('/') == std::string::npos;
+
+    if (wildcard == std::string::npos)
+    {
+        if (AddLiteral(matchName ? names : paths, pattern.data(), pattern.size()))
+        {
+            return;
+        }
+    }
+    else if (matchName && pattern.size() > 2 && pattern[0] == '*' && pattern[1] == '.' &&
+             pattern.find_first_of("*?[.", 2) == std::string::npos)
+    {
+        if (AddLiteral(extensions, pattern.data() + 2, pattern.size() - 2))
+        {
+            return;
+        }
+    }
+
+    Glob glob;
+    glob.pattern = pattern;
+    glob.matchName = matchName;
+
+    size_t last = pattern.find_last_of("*?]");
+    glob.prefix = pattern.substr(0, wildcard);
+    glob.suffix = pattern.substr(last + 1);
+
+    // Only when "**" can't reach into the last component.
+    size_t name = pattern.rfind('/');
+    if (!matchName && name != std::string::npos && pattern.find("**", name) == std::string::npos)
+    {
+        size_t nameWildcard = pattern.find_first_of("*?[", name + 1);
+        glob.namePrefix = pattern.substr(name + 1, nameWildcard - name - 1);
+    }
+
+    globs.push_back(std::move(glob));
+}
+
+bool PathMatcher::PatternSet::Matches(const char *path, size_t length, const char *name, size_t nameLength) const
+{
+    if (FindLiteral(names, literals, name, nameLength) || FindLiteral(paths, literals, path, length))
+    {
+        return true;
+    }
+
+    if (!extensions.IsEmpty())
+    {
+        const char *dot = name + nameLength;
+        while (dot > name && dot[-1] != '.')
+        {
+            dot--;
+        }
+
+        if (dot > name && FindLiteral(extensions, literals, dot, name + nameLength - dot))
+        {
+            return true;
+        }
+    }
+
+    for (auto it = globs.begin(); it != globs.end(); it++)
+    {
+        const char *text = it->matchName ? name : path;
+        size_t textLength = it->matchName ? nameLength : length;
+
+        if (it->prefix.size() + it->suffix.size() > textLength ||
+            it->namePrefix.size() > nameLength ||
+            !IsSame(it->prefix.data(), text, it->prefix.size()) ||
+            !IsSame(it->suffix.data(), text + textLength - it->suffix.size(), it->suffix.size()) ||
+            !IsSame(it->namePrefix.data(), name, it->namePrefix.size()))
+        {
+            continue;
+        }
+
+        if (MatchGlob(it->pattern.data(), it->pattern.data() + it->pattern.size(), text, text + textLength))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool PathMatcher::Normalize(const char *pattern, std::string &out)
+{
+    out.clear();
+
+    for (const char *p = pattern; *p; p++)
+    {
+        char c = IsSeparator(*p) ? '/' : *p;
+
+        // Leading "./" and "/" refer to the watched directory itself, and
+        // doubled separators mean nothing.
+        if (c == '/' && (out.empty() || out.back() == '/'))
+        {
+            continue;
+        }
+
+        if (c == '.' && out.empty() && IsSeparator(p[1]))
+        {
+            continue;
+        }
+
+        out += c;
+    }
+
+    while (!out.empty() && out.back() == '/')
+    {
+        out.pop_back();
+    }
+
+    if (out.empty())
+    {
+        return false;
+    }
+
+    const char *end = out.data() + out.size();
+    for (const char *p = out.data(); p < end; p++)
+    {
+        if (*p == '[')
+        {
+            const char *classEnd = FindClassEnd(p, end);
+            if (!classEnd)
+            {
+                return false;
+            }
+
+            p = classEnd - 1;
+        }
+    }
+
+    return true;
+}
+
+bool PathMatcher::IsValidPattern(const char *pattern)
+{
+    std::string normalized;
+    return Normalize(pattern, normalized);
+}
+
+bool PathMatcher::AddInclude(const char *pattern)
+{
+    std::string normalized;
+    if (!Normalize(pattern, normalized))
+    {
+        return false;
+    }
+
+    includes.Add(normalized);
+    return true;
+}
+
+bool PathMatcher::AddExclude(const char *pattern)
+{
+    std::string normalized;
+    if (!Normalize(pattern, normalized))
+    {
+        return false;
+    }
+
+    excludes.Add(normalized);
+    return true;
+}
+
+bool PathMatcher::IsAccepted(const char *path, size_t length) const
+{
+    const char *name = path + length;
+    while (name > path && !IsSeparator(name[-1]))
+    {
+        name--;
+    }
+
+    size_t nameLength = path + length - name;
+
+    if (!includes.IsEmpty() && !includes.Matches(path, length, name, nameLength))
+    {
+        return false;
+    }
+
+    return excludes.IsEmpty() || !excludes.Matches(path, length, name, nameLength);
+}
@@ -0,0 +1,107 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef PATHMATCHER_H_
+#define PATHMATCHER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "flatmap.h"
+
+// Include and exclude glob patterns, compiled once and then checked against
+// paths relative to the watched directory without allocating.
+//
+// A pattern without a separator is matched against the last component of a
+// path, so "*.cfg" matches "server.cfg" and "cfg/sourcemod/plugin.cfg". One
+// with a separator is matched against the whole path. "*" and "?" don't cross
+// separators, "**" does, and "[abc]", "[a-z]" and "[!abc]" match one
+// character. Matching is case-insensitive on Windows.
+class PathMatcher
+{
+public:
+    // Returns false, and adds nothing, if the pattern is malformed.
+    bool AddInclude(const char *pattern);
+    bool AddExclude(const char *pattern);
+
+    static bool IsValidPattern(const char *pattern);
+
+    // Whether a path passes: it matches an include pattern, or there are
+    // none, and it matches no exclude pattern.
+    bool IsAccepted(const char *path, size_t length) const;
+
+    inline bool IsEmpty() const { return includes.IsEmpty() && excludes.IsEmpty(); }
+
+private:
+    class PatternSet
+    {
+    public:
+        PatternSet();
+
+        void Add(const std::string &pattern);
+        bool Matches(const char *path, size_t length, const char *name, size_t nameLength) const;
+
+        inline bool IsEmpty() const { return size == 0; }
+
+    private:
+        struct Glob
+        {
+            std::string pattern;
+            bool matchName;
+
+            // Literal text a matching path has to start and end with, and
+            // that its last component has to start with. Most paths are
+            // turned away by these alone.
+            std::string prefix;
+            std::string suffix;
+            std::string namePrefix;
+        };
+
+        bool AddLiteral(FlatHashMap<uint64_t, uint32_t> &table, const char *text, size_t length);
+        static bool FindLiteral(const FlatHashMap<uint64_t, uint32_t> &table, const std::vector<std::string> &literals, const char *text, size_t length);
+
+        // Patterns without wildcards, and "*.ext" patterns, are looked up by
+        // hash instead of being tried one by one.
+        std::vector<std::string> literals;
+        FlatHashMap<uint64_t, uint32_t> names;
+        FlatHashMap<uint64_t, uint32_t> paths;
+        FlatHashMap<uint64_t, uint32_t> extensions;
+        std::vector<Glob> globs;
+        size_t size;
+    };
+
+    static bool Normalize(const char *pattern, std::string &out);
+
+    PatternSet includes;
+    PatternSet excludes;
+};
+
+#endif // PATHMATCHER_H_
@@ -0,0 +1,886 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "reactor.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+    std::mutex reactorMutex;
+    std::weak_ptr<EventReactor> reactorInstance;
+    std::weak_ptr<EventReactor> blockingReactorInstance;
+    EventReactor::Backend preferredBackend = EventReactor::kEpoll;
+
+    int SetUpIoUring(unsigned entries, io_uring_params *params)
+    {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int EnterIoUring(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+}
+
+std::shared_ptr<EventReactor> EventReactor::Acquire()
+{
+    std::lock_guard<std::mutex> lock(reactorMutex);
+
+    auto reactor = reactorInstance.lock();
+    if (!reactor)
+    {
+        reactor = std::shared_ptr<EventReactor>(new EventReactor(preferredBackend));
+        reactorInstance = reactor;
+    }
+
+    return reactor;
+}
+
+std::shared_ptr<EventReactor> EventReactor::AcquireBlocking()
+{
+    std::lock_guard<std::mutex> lock(reactorMutex);
+
+    // Its handlers only wait on timers, which epoll serves just as well.
+    auto reactor = blockingReactorInstance.lock();
+    if (!reactor)
+    {
+        reactor = std::shared_ptr<EventReactor>(new EventReactor(kEpoll));
+        blockingReactorInstance = reactor;
+    }
+
+    return reactor;
+}
+
+void EventReactor::SetPreferredBackend(Backend backend)
+{
+    std::lock_guard<std::mutex> lock(reactorMutex);
+    preferredBackend = backend;
+}
+
+EventReactor::EventReactor(Backend backend) : ring{}, epollDescriptor(-1), exited(false)
+{
+    ring.fd = -1;
+    if (backend == kIoUring)
+    {
+        SetUpRing();
+    }
+
+    bool useRing = ring.fd != -1;
+
+    // With io_uring the reactor reads its own events, so they can block.
+    if (!useRing)
+    {
+        epollDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    cancelEvent = eventfd(0, EFD_CLOEXEC);
+    wakeEvent = eventfd(0, (useRing ? 0 : EFD_NONBLOCK) | EFD_CLOEXEC);
+
+    if ((!useRing && epollDescriptor == -1) || cancelEvent == -1 || wakeEvent == -1)
+    {
+        return;
+    }
+
+    if (useRing)
+    {
+        if (!AddRequest(cancelEvent, nullptr) || !AddRequest(wakeEvent, nullptr))
+        {
+            return;
+        }
+    }
+    else
+    {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = cancelEvent;
+        epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, cancelEvent, &event);
+
+        event.data.fd = wakeEvent;
+        epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, wakeEvent, &event);
+    }
+
+    thread = std::thread(&EventReactor::ThreadProc, this);
+}
+
+EventReactor::~EventReactor()
+{
+    if (thread.joinable())
+    {
+        uint64_t u = 1;
+        write(cancelEvent, &u, sizeof(u));
+
+        thread.join();
+    }
+
+    // The thread reaps every request it posted before it exits, so nothing
+    // in the kernel refers to the buffers any more.
+    CloseRing();
+    requests.clear();
+
+    if (cancelEvent != -1)
+    {
+        close(cancelEvent);
+    }
+
+    if (wakeEvent != -1)
+    {
+        close(wakeEvent);
+    }
+
+    if (epollDescriptor != -1)
+    {
+        close(epollDescriptor);
+    }
+}
+
+bool EventReactor::Register(int fd, Handler *handler)
+{
+    if (!thread.joinable())
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (ring.fd != -1)
+    {
+        // Polled rather than read; the handler is told through OnReadable()
+        // unless it asks for reads.
+        if (!AddRequest(fd, handler))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+
+        if (epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            return false;
+        }
+    }
+
+    handlers.insert_or_assign(fd, handler);
+
+    return true;
+}
+
+bool EventReactor::RegisterReader(int fd, Handler *handler)
+{
+    // Whether a request reads or polls is decided each time it is posted,
+    // from what the handler asks for.
+    return Register(fd, handler);
+}
+
+bool EventReactor::Unregister(int fd)
+{
+    // Handlers are called without the lock held, so waiting out a call in
+    // progress takes running on the reactor thread, between calls.
+    if (!IsReactorThread())
+    {
+        bool removed = false;
+        Call([this, fd, &removed]()
+             { removed = Unregister(fd); });
+
+        return removed;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = handlers.find(fd);
+    if (it == handlers.end())
+    {
+        return false;
+    }
+
+    handlers.erase(it);
+
+    if (ring.fd != -1)
+    {
+        for (auto jt = requests.begin(); jt != requests.end(); jt++)
+        {
+            if ((*jt)->fd == fd && !(*jt)->orphaned)
+            {
+                Request *request = jt->get();
+                Orphan(request);
+
+                // Nothing will complete for it again.
+                if (request->idle)
+                {
+                    reposts.erase(std::remove(reposts.begin(), reposts.end(), request), reposts.end());
+                    FreeRequest(request);
+                }
+
+                break;
+            }
+        }
+    }
+    else
+    {
+        epoll_ctl(epollDescriptor, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    return true;
+}
+
+void EventReactor::ScheduleWork(Handler *handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (std::find(work.begin(), work.end(), handler) == work.end())
+    {
+        work.push_back(handler);
+    }
+
+    // Break the reactor out of a blocking wait so it picks up the work.
+    if (!IsReactorThread())
+    {
+        uint64_t u = 1;
+        write(wakeEvent, &u, sizeof(u));
+    }
+}
+
+void EventReactor::CancelWork(Handler *handler)
+{
+    if (!IsReactorThread())
+    {
+        Call([this, handler]()
+             { CancelWork(handler); });
+
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = std::find(work.begin(), work.end(), handler);
+    if (it != work.end())
+    {
+        work.erase(it);
+    }
+}
+
+std::chrono::microseconds EventReactor::GetCpuTime()
+{
+    clockid_t clock;
+    struct timespec ts;
+    if (pthread_getcpuclockid(thread.native_handle(), &clock) != 0 || clock_gettime(clock, &ts) != 0)
+    {
+        return std::chrono::microseconds(0);
+    }
+
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(ts.tv_nsec));
+}
+
+void EventReactor::Call(const std::function<void()> &task)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Nothing else calls handlers once the thread is gone.
+    if (IsReactorThread() || !thread.joinable() || exited)
+    {
+        lock.unlock();
+        task();
+        return;
+    }
+
+    PendingCall call = {&task, false};
+    calls.push_back(&call);
+
+    uint64_t u = 1;
+    write(wakeEvent, &u, sizeof(u));
+
+    callsDone.wait(lock, [&call]()
+                   { return call.done; });
+}
+
+void EventReactor::ThreadProc()
+{
+    if (ring.fd != -1)
+    {
+        RunRing();
+    }
+    else
+    {
+        RunEpoll();
+    }
+
+    // Whatever was left waiting runs on its caller's thread from now on.
+    std::unique_lock<std::mutex> lock(mutex);
+    RunCalls(lock);
+    exited = true;
+}
+
+void EventReactor::RunEpoll()
+{
+    epoll_event events[64];
+    int timeout = -1;
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+
+    for (;;)
+    {
+        int count = epoll_wait(epollDescriptor, events, sizeof(events) / sizeof(events[0]), timeout);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        lock.lock();
+
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == cancelEvent)
+            {
+                return;
+            }
+
+            if (fd == wakeEvent)
+            {
+                uint64_t u;
+                read(wakeEvent, &u, sizeof(u));
+                continue;
+            }
+
+            // The descriptor may have been unregistered since epoll_wait()
+            // returned.
+            auto it = handlers.find(fd);
+            if (it != handlers.end())
+            {
+                Handler *handler = it->second;
+
+                lock.unlock();
+                handler->OnReadable(fd);
+                lock.lock();
+            }
+        }
+
+        RunCalls(lock);
+        RunWork(lock);
+
+        timeout = work.empty() && calls.empty() ? -1 : 0;
+        lock.unlock();
+    }
+}
+
+void EventReactor::RunRing()
+{
+    bool wait = true;
+    unsigned toSubmit = 0;
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+
+    for (;;)
+    {
+        // Everything posted since the last call, from handlers and work
+        // slices alike, goes to the kernel in the same call that waits.
+        // Other threads submit their own requests as they post them.
+        if (EnterIoUring(ring.fd, toSubmit, wait ? 1 : 0, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR && errno != EBUSY)
+        {
+            break;
+        }
+
+        lock.lock();
+
+        if (!ReapCompletions(lock))
+        {
+            DrainRing();
+            return;
+        }
+
+        Repost();
+        RunCalls(lock);
+        RunWork(lock);
+
+        wait = work.empty() && reposts.empty() && calls.empty();
+        toSubmit = ring.tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+        lock.unlock();
+    }
+
+    lock.lock();
+    DrainRing();
+}
+
+void EventReactor::RunWork(std::unique_lock<std::mutex> &lock)
+{
+    // Give every handler with pending work one slice, then poll again
+    // without blocking so I/O is serviced in between slices. A handler
+    // may cancel its own or another's work while running.
+    activeWork.assign(work.begin(), work.end());
+
+    for (auto it = activeWork.begin(); it != activeWork.end(); it++)
+    {
+        auto jt = std::find(work.begin(), work.end(), *it);
+        if (jt == work.end())
+        {
+            continue;
+        }
+
+        lock.unlock();
+        bool more = (*it)->OnWork();
+        lock.lock();
+
+        if (!more)
+        {
+            jt = std::find(work.begin(), work.end(), *it);
+            if (jt != work.end())
+            {
+                work.erase(jt);
+            }
+        }
+    }
+}
+
+void EventReactor::RunCalls(std::unique_lock<std::mutex> &lock)
+{
+    while (!calls.empty())
+    {
+        activeCalls.swap(calls);
+
+        lock.unlock();
+        for (auto it = activeCalls.begin(); it != activeCalls.end(); it++)
+        {
+            (*(*it)->task)();
+        }
+        lock.lock();
+
+        for (auto it = activeCalls.begin(); it != activeCalls.end(); it++)
+        {
+            (*it)->done = true;
+        }
+
+        activeCalls.clear();
+        callsDone.notify_all();
+    }
+}
+
+bool EventReactor::SetUpRing()
+{
+    io_uring_params params = {};
+    int fd = SetUpIoUring(kRingEntries, &params);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    // Reads on descriptors that have nothing to read yet are only worth
+    // posting if the kernel waits for them by polling internally, rather than
+    // parking a worker thread on each one.
+    if (!(params.features & IORING_FEAT_FAST_POLL) || !(params.features & IORING_FEAT_NODROP))
+    {
+        close(fd);
+        return false;
+    }
+
+    ring.sqMemorySize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cqMemorySize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMapping)
+    {
+        ring.sqMemorySize = ring.cqMemorySize = std::max(ring.sqMemorySize, ring.cqMemorySize);
+    }
+
+    ring.sqMemory = mmap(nullptr, ring.sqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring.cqMemory = singleMapping ? ring.sqMemory : mmap(nullptr, ring.cqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(nullptr, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    ring.fd = fd;
+
+    if (ring.sqMemory == MAP_FAILED || ring.cqMemory == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        ring.sqes = sqes == MAP_FAILED ? nullptr : (io_uring_sqe *)sqes;
+        CloseRing();
+        return false;
+    }
+
+    char *sq = (char *)ring.sqMemory;
+    ring.sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring.sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring.sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sqEntries = params.sq_entries;
+    ring.tail = *ring.sqTail;
+
+    char *cq = (char *)ring.cqMemory;
+    ring.cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring.cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring.cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+
+    ring.sqes = (io_uring_sqe *)sqes;
+
+    return true;
+}
+
+void EventReactor::CloseRing()
+{
+    if (ring.fd == -1)
+    {
+        return;
+    }
+
+    if (ring.sqes)
+    {
+        munmap(ring.sqes, ring.sqesSize);
+    }
+
+    if (ring.cqMemory && ring.cqMemory != MAP_FAILED && ring.cqMemory != ring.sqMemory)
+    {
+        munmap(ring.cqMemory, ring.cqMemorySize);
+    }
+
+    if (ring.sqMemory && ring.sqMemory != MAP_FAILED)
+    {
+        munmap(ring.sqMemory, ring.sqMemorySize);
+    }
+
+    close(ring.fd);
+
+    ring = {};
+    ring.fd = -1;
+}
+
+io_uring_sqe *EventReactor::GetSubmission()
+{
+    unsigned head = __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+    if (ring.tail - head >= ring.sqEntries)
+    {
+        // Hand what is queued to the kernel to make room.
+        EnterIoUring(ring.fd, ring.tail - head, 0, 0);
+
+        head = __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+        if (ring.tail - head >= ring.sqEntries)
+        {
+            return nullptr;
+        }
+    }
+
+    unsigned index = ring.tail & ring.sqMask;
+    io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sqArray[index] = index;
+
+    return sqe;
+}
+
+void EventReactor::PublishSubmission()
+{
+    ring.tail++;
+    __atomic_store_n(ring.sqTail, ring.tail, __ATOMIC_RELEASE);
+
+    // The reactor thread submits on its way back into the wait; anyone else
+    // has to, or the request would sit in the ring until the next wakeup.
+    if (!IsReactorThread())
+    {
+        EnterIoUring(ring.fd, ring.tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE), 0, 0);
+    }
+}
+
+bool EventReactor::AddRequest(int fd, Handler *handler)
+{
+    auto request = std::make_unique<Request>();
+    request->fd = fd;
+    request->handler = handler;
+    request->reading = false;
+    request->waitReadable = false;
+    request->pending = false;
+    request->orphaned = false;
+    request->idle = false;
+    request->bufferSize = 0;
+
+    Request *r = request.get();
+    requests.push_back(std::move(request));
+
+    if (!Post(r))
+    {
+        requests.pop_back();
+        return false;
+    }
+
+    return true;
+}
+
+bool EventReactor::Post(Request *request)
+{
+    // The reactor's own events are read into an eight-byte counter.
+    size_t readSize = request->handler ? request->handler->GetReadSize(request->fd) : sizeof(uint64_t);
+
+    io_uring_sqe *sqe = GetSubmission();
+    if (!sqe)
+    {
+        return false;
+    }
+
+    request->reading = readSize > 0 && !request->waitReadable;
+    if (request->reading)
+    {
+        if (request->bufferSize != readSize)
+        {
+            request->buffer = std::make_unique<char[]>(readSize);
+            request->bufferSize = readSize;
+        }
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = request->fd;
+        sqe->addr = (uint64_t)(uintptr_t)request->buffer.get();
+        sqe->len = (uint32_t)readSize;
+        sqe->off = (uint64_t)-1;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = request->fd;
+        sqe->poll32_events = POLLIN;
+    }
+
+    sqe->user_data = (uint64_t)(uintptr_t)request;
+    request->pending = true;
+
+    PublishSubmission();
+
+    return true;
+}
+
+void EventReactor::Orphan(Request *request)
+{
+    request->orphaned = true;
+    request->handler = nullptr;
+
+    // Without a pending operation, the request is freed as soon as the
+    // completion being dispatched is done with it.
+    if (!request->pending)
+    {
+        return;
+    }
+
+    io_uring_sqe *sqe = GetSubmission();
+    if (!sqe)
+    {
+        // It will be freed when the descriptor next becomes readable.
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uint64_t)(uintptr_t)request;
+    sqe->user_data = 0;
+
+    PublishSubmission();
+}
+
+void EventReactor::FreeRequest(Request *request)
+{
+    auto it = std::find_if(requests.begin(), requests.end(), [request](const std::unique_ptr<Request> &r) { return r.get() == request; });
+    if (it != requests.end())
+    {
+        requests.erase(it);
+    }
+}
+
+bool EventReactor::ReapCompletions(std::unique_lock<std::mutex> &lock)
+{
+    unsigned head = *ring.cqHead;
+    unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+    bool running = true;
+
+    for (; head != tail && running; head++)
+    {
+        io_uring_cqe *cqe = &ring.cqes[head & ring.cqMask];
+        Request *request = (Request *)(uintptr_t)cqe->user_data;
+
+        // Cancellations complete on their own.
+        if (request)
+        {
+            running = Complete(request, cqe->res, lock);
+        }
+    }
+
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+
+    return running;
+}
+
+bool EventReactor::Complete(Request *request, int result, std::unique_lock<std::mutex> &lock)
+{
+    request->pending = false;
+
+    if (request->orphaned)
+    {
+        FreeRequest(request);
+        return true;
+    }
+
+    if (request->fd == cancelEvent)
+    {
+        return false;
+    }
+
+    if (request->reading && result == -EAGAIN)
+    {
+        // Non-blocking descriptor with nothing to read; wait for it first.
+        request->waitReadable = true;
+    }
+    else if (!request->reading && request->waitReadable)
+    {
+        request->waitReadable = false;
+    }
+    else if (request->fd != wakeEvent && result != -EINTR)
+    {
+        // Reposting a read or poll that failed outright would only fail
+        // again, so the handler is told the descriptor is dead instead.
+        Handler *handler = request->handler;
+
+        if (result < 0)
+        {
+            lock.unlock();
+            handler->OnError(request->fd, -result);
+            lock.lock();
+
+            if (request->orphaned)
+            {
+                FreeRequest(request);
+            }
+            else
+            {
+                request->idle = true;
+            }
+
+            return true;
+        }
+
+        // The buffer belongs to the request, which is only freed on this
+        // thread.
+        lock.unlock();
+        if (request->reading)
+        {
+            handler->OnRead(request->fd, request->buffer.get(), result);
+        }
+        else
+        {
+            handler->OnReadable(request->fd);
+        }
+        lock.lock();
+
+        // Unregistered from inside the handler.
+        if (request->orphaned)
+        {
+            FreeRequest(request);
+            return true;
+        }
+    }
+
+    if (!Post(request))
+    {
+        request->idle = true;
+        reposts.push_back(request);
+    }
+
+    return true;
+}
+
+void EventReactor::Repost()
+{
+    size_t posted = 0;
+    while (posted < reposts.size() && Post(reposts[posted]))
+    {
+        reposts[posted]->idle = false;
+        posted++;
+    }
+
+    reposts.erase(reposts.begin(), reposts.begin() + posted);
+}
+
+void EventReactor::DrainRing()
+{
+    for (auto it = requests.begin(); it != requests.end(); it++)
+    {
+        if ((*it)->pending)
+        {
+            io_uring_sqe *sqe = GetSubmission();
+            if (!sqe)
+            {
+                break;
+            }
+
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t)(uintptr_t)it->get();
+            sqe->user_data = 0;
+
+            PublishSubmission();
+        }
+    }
+
+    auto isPending = [](const std::unique_ptr<Request> &r) { return r->pending; };
+
+    while (std::any_of(requests.begin(), requests.end(), isPending))
+    {
+        unsigned toSubmit = ring.tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+        if (EnterIoUring(ring.fd, toSubmit, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR)
+        {
+            break;
+        }
+
+        unsigned head = *ring.cqHead;
+        unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++)
+        {
+            Request *request = (Request *)(uintptr_t)ring.cqes[head & ring.cqMask].user_data;
+            if (request)
+            {
+                request->pending = false;
+            }
+        }
+
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+#endif // __linux__
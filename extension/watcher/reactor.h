@@ -0,0 +1,242 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#ifdef __linux__
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Multiplexes the file descriptors of every watcher in the process onto a
+// single epoll instance, or io_uring, serviced by one thread.
+//
+// Handlers are called one at a time on that thread, without the reactor's
+// own lock held, so one that blocks on I/O holds up the other handlers but
+// never a thread that registers, schedules or unregisters something.
+class EventReactor
+{
+public:
+    enum Backend
+    {
+        kEpoll = 0,
+
+        // Reads stay posted on the descriptors registered for reading, so
+        // one system call submits and reaps the completions of every watcher
+        // at once. Falls back to epoll where io_uring is unavailable.
+        kIoUring
+    };
+
+    class Handler
+    {
+    public:
+        virtual ~Handler() {}
+
+        // Called on the reactor thread when a registered descriptor becomes
+        // readable.
+        virtual void OnReadable(int fd) = 0;
+
+        // Called on the reactor thread between polls once ScheduleWork() has
+        // been called, for as long as it returns true. Each call should do a
+        // bounded amount of work so other handlers aren't starved.
+        virtual bool OnWork() { return false; }
+
+        // For descriptors registered with RegisterReader() on io_uring: how
+        // much the next read may return, or 0 to be told through OnReadable()
+        // instead, and what a read returned, or -errno.
+        virtual size_t GetReadSize(int fd) { return 0; }
+        virtual void OnRead(int fd, const char *data, ssize_t length) {}
+
+        // Called on the reactor thread when a read or poll posted on io_uring
+        // fails with the given errno. The descriptor is not read or polled
+        // again, but stays registered until Unregister().
+        virtual void OnError(int fd, int error) {}
+    };
+
+    ~EventReactor();
+
+    // Returns the process-wide reactor, starting it if necessary. The reactor
+    // thread is stopped once the last reference is released.
+    static std::shared_ptr<EventReactor> Acquire();
+
+    // Returns a second process-wide reactor, with a thread of its own, for
+    // handlers that spend their time in blocking I/O, such as polling a
+    // remote filesystem. They can then be as slow as the filesystem is
+    // without holding up the handlers on the first one.
+    static std::shared_ptr<EventReactor> AcquireBlocking();
+
+    // The backend used the next time the reactor is started. One already
+    // running keeps its own until the last reference is released.
+    static void SetPreferredBackend(Backend backend);
+
+    inline Backend GetBackend() const { return ring.fd != -1 ? kIoUring : kEpoll; }
+
+    bool Register(int fd, Handler *handler);
+
+    // With io_uring, the reactor reads the descriptor itself and hands the
+    // data over through OnRead(), so the descriptor should be blocking. With
+    // epoll, this is the same as Register().
+    bool RegisterReader(int fd, Handler *handler);
+
+    // Removes the descriptor from the reactor. Once this returns, the handler
+    // will not be called for the descriptor again. Returns false if the
+    // descriptor was not registered. From another thread, this goes through
+    // Call().
+    bool Unregister(int fd);
+
+    void ScheduleWork(Handler *handler);
+
+    // Once this returns, OnWork() will not be called for the handler until it
+    // is scheduled again. From another thread, this goes through Call().
+    void CancelWork(Handler *handler);
+
+    // Runs the task on the reactor thread, between calls to handlers, and
+    // waits for it to finish, so state the handlers share can be touched from
+    // elsewhere. At most one handler call is waited out. On the reactor
+    // thread, the task runs right away.
+    void Call(const std::function<void()> &task);
+
+    // CPU time the reactor thread has used, read from its clock so it can
+    // be asked for from any thread.
+    std::chrono::microseconds GetCpuTime();
+
+    inline bool IsReactorThread() const { return std::this_thread::get_id() == thread.get_id(); }
+
+private:
+    EventReactor(Backend backend);
+    void ThreadProc();
+    void RunEpoll();
+    void RunRing();
+    void RunWork(std::unique_lock<std::mutex> &lock);
+    void RunCalls(std::unique_lock<std::mutex> &lock);
+
+    // A read or poll kept posted on a descriptor. The reactor owns the
+    // buffer, so an unregistered request can be left for the kernel to
+    // finish or cancel without anything else having to wait for it.
+    struct Request
+    {
+        int fd;
+        Handler *handler;
+        bool reading;
+        bool waitReadable;
+        bool pending;
+        bool orphaned;
+
+        // Nothing is posted and no completion is being handled, because the
+        // descriptor failed or is waiting for room to be posted again.
+        bool idle;
+        std::unique_ptr<char[]> buffer;
+        size_t bufferSize;
+    };
+
+    bool SetUpRing();
+    void CloseRing();
+    io_uring_sqe *GetSubmission();
+    void PublishSubmission();
+    bool AddRequest(int fd, Handler *handler);
+    bool Post(Request *request);
+    void Orphan(Request *request);
+    void FreeRequest(Request *request);
+    bool ReapCompletions(std::unique_lock<std::mutex> &lock);
+    bool Complete(Request *request, int result, std::unique_lock<std::mutex> &lock);
+    void Repost();
+    void DrainRing();
+
+    struct Ring
+    {
+        int fd;
+        void *sqMemory;
+        size_t sqMemorySize;
+        void *cqMemory;
+        size_t cqMemorySize;
+        io_uring_sqe *sqes;
+        size_t sqesSize;
+
+        unsigned *sqHead;
+        unsigned *sqTail;
+        unsigned *sqArray;
+        unsigned sqMask;
+        unsigned sqEntries;
+        unsigned tail;
+
+        unsigned *cqHead;
+        unsigned *cqTail;
+        io_uring_cqe *cqes;
+        unsigned cqMask;
+    };
+
+    static constexpr unsigned kRingEntries = 256;
+
+    Ring ring;
+    std::vector<std::unique_ptr<Request>> requests;
+
+    // Requests that found the submission queue full, posted again on the next
+    // pass once the kernel has taken what was in it.
+    std::vector<Request *> reposts;
+
+    int epollDescriptor;
+    int cancelEvent;
+    int wakeEvent;
+    std::thread thread;
+
+    // A task passed to Call() by another thread, which waits for it on
+    // callsDone.
+    struct PendingCall
+    {
+        const std::function<void()> *task;
+        bool done;
+    };
+
+    // Held by the reactor thread except while it calls out to a handler or a
+    // task.
+    std::mutex mutex;
+    std::unordered_map<int, Handler *> handlers;
+    std::vector<Handler *> work;
+    std::vector<Handler *> activeWork;
+    std::vector<PendingCall *> calls;
+    std::vector<PendingCall *> activeCalls;
+    std::condition_variable callsDone;
+    bool exited;
+};
+
+#endif // __linux__
+
+#endif // REACTOR_H_
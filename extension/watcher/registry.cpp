@@ -0,0 +1,543 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "registry.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <errno.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace
+{
+    std::mutex registryMutex;
+    std::weak_ptr<WatchRegistry> registryInstance;
+}
+
+std::shared_ptr<WatchRegistry> WatchRegistry::Acquire()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    auto registry = registryInstance.lock();
+    if (!registry)
+    {
+        registry = std::shared_ptr<WatchRegistry>(new WatchRegistry());
+        registryInstance = registry;
+    }
+
+    return registry;
+}
+
+WatchRegistry::WatchRegistry() : reactor(EventReactor::Acquire()),
+                                 reactorReads(reactor->GetBackend() == EventReactor::kIoUring),
+                                 watchCount(0),
+                                 treeCount(0),
+                                 bufferSize(0),
+                                 peakBufferSize(0),
+                                 minBufferSize(sizeof(inotify_event) + NAME_MAX + 1),
+                                 maxBufferSize(sizeof(inotify_event) + NAME_MAX + 1)
+{
+    ResizeBuffer(minBufferSize);
+
+    // A posted read on a blocking descriptor waits in the kernel until there
+    // is something to return, rather than failing and being polled for.
+    fileDescriptor = inotify_init1((reactorReads ? 0 : IN_NONBLOCK) | IN_CLOEXEC);
+    if (fileDescriptor == -1)
+    {
+        return;
+    }
+
+    if (!reactor->RegisterReader(fileDescriptor, this))
+    {
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+}
+
+WatchRegistry::~WatchRegistry()
+{
+    if (fileDescriptor != -1)
+    {
+        reactor->Unregister(fileDescriptor);
+
+        // Closing the instance drops every watch still on it.
+        close(fileDescriptor);
+    }
+}
+
+bool WatchRegistry::Subscribe(Subscriber *subscriber, size_t minSize, size_t maxSize)
+{
+    if (fileDescriptor == -1)
+    {
+        return false;
+    }
+
+    auto it = std::find_if(subscribers.begin(), subscribers.end(), [subscriber](const Subscription &subscription)
+                           { return subscription.subscriber == subscriber; });
+
+    if (it == subscribers.end())
+    {
+        Subscription subscription;
+        subscription.subscriber = subscriber;
+        subscribers.push_back(subscription);
+        it = subscribers.end() - 1;
+    }
+
+    it->minBufferSize = minSize;
+    it->maxBufferSize = maxSize;
+
+    UpdateBufferBounds();
+    return true;
+}
+
+void WatchRegistry::Unsubscribe(Subscriber *subscriber)
+{
+    auto it = std::find_if(subscribers.begin(), subscribers.end(), [subscriber](const Subscription &subscription)
+                           { return subscription.subscriber == subscriber; });
+
+    if (it == subscribers.end())
+    {
+        return;
+    }
+
+    subscribers.erase(it);
+
+    // Its watches are collected first, as removing them reshuffles the map.
+    std::vector<int> held;
+    watches.ForEach([subscriber, &held](int wd, Watch &watch)
+                    {
+                        for (auto jt = watch.subscribers.begin(); jt != watch.subscribers.end(); jt++)
+                        {
+                            if (jt->first == subscriber)
+                            {
+                                held.push_back(wd);
+                                break;
+                            }
+                        }
+                    });
+
+    for (auto jt = held.begin(); jt != held.end(); jt++)
+    {
+        RemoveWatch(*jt, subscriber);
+    }
+
+    // It may be unsubscribing from inside a call made while handing out
+    // events.
+    std::replace(recipients.begin(), recipients.end(), subscriber, (Subscriber *)nullptr);
+    std::replace(notified.begin(), notified.end(), subscriber, (Subscriber *)nullptr);
+
+    UpdateBufferBounds();
+}
+
+uint32_t WatchRegistry::GetMask(const Watch &watch) const
+{
+    uint32_t mask = 0;
+    for (auto it = watch.subscribers.begin(); it != watch.subscribers.end(); it++)
+    {
+        mask |= it->second;
+    }
+
+    return mask;
+}
+
+int WatchRegistry::AddWatch(const char *path, uint32_t mask, Subscriber *subscriber)
+{
+    // Whatever else is watching the directory keeps what it asked for.
+    int wd = inotify_add_watch(fileDescriptor, path, mask | IN_MASK_ADD);
+    if (wd == -1)
+    {
+        return -1;
+    }
+
+    Watch *watch = watches.Find(wd);
+    if (!watch)
+    {
+        watch = &watches.Insert(wd, Watch());
+        watchCount.store(watches.GetSize(), std::memory_order_relaxed);
+    }
+
+    // A subscriber reaching the same directory twice holds it once.
+    for (auto it = watch->subscribers.begin(); it != watch->subscribers.end(); it++)
+    {
+        if (it->first == subscriber)
+        {
+            it->second = mask;
+            watch->mask = GetMask(*watch);
+            return wd;
+        }
+    }
+
+    watch->subscribers.emplace_back(subscriber, mask);
+    watch->mask = GetMask(*watch);
+
+    return wd;
+}
+
+int WatchRegistry::UpdateWatch(const char *path, int wd, uint32_t mask, Subscriber *subscriber)
+{
+    Watch *watch = watches.Find(wd);
+    if (!watch)
+    {
+        return -1;
+    }
+
+    for (auto it = watch->subscribers.begin(); it != watch->subscribers.end(); it++)
+    {
+        if (it->first == subscriber)
+        {
+            it->second = mask;
+            break;
+        }
+    }
+
+    uint32_t oldMask = watch->mask;
+    watch->mask = GetMask(*watch);
+    if (watch->mask == oldMask)
+    {
+        return wd;
+    }
+
+    // Without IN_MASK_ADD the kernel's mask is replaced, so it can narrow
+    // as well as widen.
+    int newWd = inotify_add_watch(fileDescriptor, path, watch->mask);
+    if (newWd == -1 || newWd == wd)
+    {
+        return newWd;
+    }
+
+    // The path now leads somewhere else, such as a directory whose move
+    // hasn't been resolved yet. Put back what that watch had, or drop it
+    // if nobody asked for it.
+    Watch *other = watches.Find(newWd);
+    if (other)
+    {
+        inotify_add_watch(fileDescriptor, path, other->mask);
+    }
+    else
+    {
+        inotify_rm_watch(fileDescriptor, newWd);
+    }
+
+    return newWd;
+}
+
+void WatchRegistry::RemoveWatch(int wd, Subscriber *subscriber)
+{
+    Watch *watch = watches.Find(wd);
+    if (!watch)
+    {
+        return;
+    }
+
+    auto it = std::find_if(watch->subscribers.begin(), watch->subscribers.end(), [subscriber](const std::pair<Subscriber *, uint32_t> &entry)
+                           { return entry.first == subscriber; });
+
+    if (it == watch->subscribers.end())
+    {
+        return;
+    }
+
+    watch->subscribers.erase(it);
+
+    if (!watch->subscribers.empty())
+    {
+        // Narrowing to what the others still want isn't worth a syscall;
+        // anything extra is filtered out when the events are handed out.
+        watch->mask = GetMask(*watch);
+        return;
+    }
+
+    inotify_rm_watch(fileDescriptor, wd);
+    watches.Erase(wd);
+    watchCount.store(watches.GetSize(), std::memory_order_relaxed);
+}
+
+void WatchRegistry::AddTree(const std::string &root, const std::shared_ptr<TreeWatch> &tree)
+{
+    trees.emplace(root, tree);
+    treeCount.store(trees.size(), std::memory_order_relaxed);
+}
+
+void WatchRegistry::RemoveTree(const std::string &root, const TreeWatch *tree)
+{
+    // One already being destroyed can't be told apart by pointer any more,
+    // but it can't be found either.
+    auto range = trees.equal_range(root);
+    for (auto it = range.first; it != range.second;)
+    {
+        std::shared_ptr<TreeWatch> held = it->second.lock();
+        if (!held || held.get() == tree)
+        {
+            it = trees.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    treeCount.store(trees.size(), std::memory_order_relaxed);
+}
+
+void WatchRegistry::FindTrees(const std::string &root, std::vector<std::shared_ptr<TreeWatch>> &found)
+{
+    auto range = trees.equal_range(root);
+    for (auto it = range.first; it != range.second; it++)
+    {
+        std::shared_ptr<TreeWatch> tree = it->second.lock();
+        if (tree)
+        {
+            found.push_back(std::move(tree));
+        }
+    }
+}
+
+void WatchRegistry::UpdateBufferBounds()
+{
+    if (subscribers.empty())
+    {
+        return;
+    }
+
+    size_t minSize = subscribers.front().minBufferSize;
+    size_t maxSize = subscribers.front().maxBufferSize;
+
+    for (auto it = subscribers.begin(); it != subscribers.end(); it++)
+    {
+        minSize = std::min(minSize, it->minBufferSize);
+        maxSize = std::max(maxSize, it->maxBufferSize);
+    }
+
+    minBufferSize = minSize;
+    maxBufferSize = std::max(maxSize, minSize);
+
+    size_t size = bufferSize.load(std::memory_order_relaxed);
+    if ((!buffer && !reactorReads) || size < minBufferSize || size > maxBufferSize)
+    {
+        ResizeBuffer(minBufferSize);
+    }
+}
+
+void WatchRegistry::ResizeBuffer(size_t size)
+{
+    size_t capacity = minBufferSize;
+    while (capacity < size && capacity < maxBufferSize)
+    {
+        capacity *= 2;
+    }
+
+    capacity = std::min(capacity, maxBufferSize);
+    if (capacity == bufferSize && (buffer || reactorReads))
+    {
+        return;
+    }
+
+    if (!reactorReads)
+    {
+        buffer = std::make_unique<char[]>(capacity);
+    }
+
+    bufferSize.store(capacity, std::memory_order_relaxed);
+
+    if (capacity > peakBufferSize.load(std::memory_order_relaxed))
+    {
+        peakBufferSize.store(capacity, std::memory_order_relaxed);
+    }
+}
+
+void WatchRegistry::Dispatch(const inotify_event *event)
+{
+    recipients.clear();
+
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        // Nobody knows what they missed, so everybody resyncs.
+        for (auto it = subscribers.begin(); it != subscribers.end(); it++)
+        {
+            recipients.push_back(it->subscriber);
+        }
+    }
+    else
+    {
+        Watch *watch = watches.Find(event->wd);
+        if (!watch)
+        {
+            return;
+        }
+
+        // The kernel has dropped the watch, because the directory is gone
+        // or the last subscriber removed it.
+        if (event->mask & IN_IGNORED)
+        {
+            watches.Erase(event->wd);
+            watchCount.store(watches.GetSize(), std::memory_order_relaxed);
+            return;
+        }
+
+        // The kernel reports whatever any subscriber asked for.
+        for (auto it = watch->subscribers.begin(); it != watch->subscribers.end(); it++)
+        {
+            if ((event->mask & it->second & IN_ALL_EVENTS) || (event->mask & IN_UNMOUNT))
+            {
+                recipients.push_back(it->first);
+            }
+        }
+    }
+
+    // Subscribers add and remove watches as they go, so the list is walked
+    // from a copy.
+    for (size_t i = 0; i < recipients.size(); i++)
+    {
+        Subscriber *subscriber = recipients[i];
+        if (!subscriber)
+        {
+            continue;
+        }
+
+        if (std::find(notified.begin(), notified.end(), subscriber) == notified.end())
+        {
+            notified.push_back(subscriber);
+        }
+
+        subscriber->OnWatchEvent(event);
+    }
+}
+
+void WatchRegistry::OnReadable(int fd)
+{
+    // The most this wakeup needed the buffer to hold at once.
+    size_t demand = 0;
+
+    for (;;)
+    {
+        int pending = 0;
+        if (ioctl(fileDescriptor, FIONREAD, &pending) == 0 && pending > 0)
+        {
+            demand = std::max(demand, (size_t)pending);
+            if ((size_t)pending > bufferSize && bufferSize < maxBufferSize)
+            {
+                ResizeBuffer(pending);
+            }
+        }
+
+        size_t capacity = bufferSize.load(std::memory_order_relaxed);
+        ssize_t len = read(fileDescriptor, buffer.get(), capacity);
+
+        if (len <= 0)
+        {
+            break;
+        }
+
+        demand = std::max(demand, (size_t)len);
+        DispatchEvents(buffer.get(), len);
+    }
+
+    EndDispatch();
+
+    if (demand < bufferSize / 4 && bufferSize > minBufferSize)
+    {
+        ResizeBuffer(demand * 2);
+    }
+}
+
+size_t WatchRegistry::GetReadSize(int fd)
+{
+    return bufferSize.load(std::memory_order_relaxed);
+}
+
+void WatchRegistry::OnRead(int fd, const char *data, ssize_t length)
+{
+    if (length <= 0)
+    {
+        return;
+    }
+
+    DispatchEvents(data, length);
+    EndDispatch();
+
+    // There is no FIONREAD here to tell how much is queued, as that would
+    // cost the system call the posted read saves, so a read that filled most
+    // of the buffer is taken to mean a backlog.
+    size_t size = bufferSize.load(std::memory_order_relaxed);
+    if ((size_t)length > size / 2)
+    {
+        ResizeBuffer(size * 2);
+    }
+    else if ((size_t)length < size / 4 && size > minBufferSize)
+    {
+        ResizeBuffer(length * 2);
+    }
+}
+
+void WatchRegistry::OnError(int fd, int error)
+{
+    // Subscribers are expected to unsubscribe in response, so the list is
+    // walked from a copy.
+    recipients.clear();
+    for (auto it = subscribers.begin(); it != subscribers.end(); it++)
+    {
+        recipients.push_back(it->subscriber);
+    }
+
+    for (size_t i = 0; i < recipients.size(); i++)
+    {
+        if (recipients[i])
+        {
+            recipients[i]->OnWatchError(error);
+        }
+    }
+}
+
+void WatchRegistry::DispatchEvents(const char *data, size_t length)
+{
+    const inotify_event *event;
+    for (const char *p = data; p < data + length; p += sizeof(inotify_event) + event->len)
+    {
+        event = (const inotify_event *)p;
+        Dispatch(event);
+    }
+}
+
+void WatchRegistry::EndDispatch()
+{
+    for (size_t i = 0; i < notified.size(); i++)
+    {
+        if (notified[i])
+        {
+            notified[i]->OnWatchEventsEnd();
+        }
+    }
+
+    notified.clear();
+}
+
+#endif // __linux__
@@ -0,0 +1,178 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef REGISTRY_H_
+#define REGISTRY_H_
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/inotify.h>
+
+#include "flatmap.h"
+#include "reactor.h"
+
+class TreeWatch;
+
+// One inotify instance for the whole process. Watchers that cover the same
+// directory share a single kernel watch, reference counted by subscriber, so
+// each change is read and parsed once and then handed to every subscriber
+// of the watch. The directory trees built from those watches are shared
+// through it too.
+//
+// Everything here runs on the reactor thread; other threads go through
+// EventReactor::Call().
+class WatchRegistry : public EventReactor::Handler
+{
+public:
+    class Subscriber
+    {
+    public:
+        virtual ~Subscriber() {}
+
+        // Called for each event on a watch the subscriber holds. A queue
+        // overflow, which has no watch, goes to every subscriber.
+        virtual void OnWatchEvent(const inotify_event *event) = 0;
+
+        // Called once everything read in one wakeup has been handed out, for
+        // each subscriber that was given anything.
+        virtual void OnWatchEventsEnd() = 0;
+
+        // Called for every subscriber when the inotify instance can no longer
+        // be read, after which no more events will come.
+        virtual void OnWatchError(int error) = 0;
+    };
+
+    ~WatchRegistry();
+
+    // Returns the process-wide registry, creating it if necessary. It is
+    // destroyed once the last reference is released.
+    static std::shared_ptr<WatchRegistry> Acquire();
+
+    // The buffer events are read into grows with the backlog, between the
+    // smallest floor and the largest ceiling any subscriber asked for.
+    // Subscribing again only changes what the subscriber asks for.
+    bool Subscribe(Subscriber *subscriber, size_t minBufferSize, size_t maxBufferSize);
+
+    // Drops every watch the subscriber still holds.
+    void Unsubscribe(Subscriber *subscriber);
+
+    // Watches the directory for the subscriber and returns the descriptor,
+    // or -1. The kernel is asked for the union of every subscriber's mask.
+    int AddWatch(const char *path, uint32_t mask, Subscriber *subscriber);
+
+    // Changes the subscriber's mask on a watch it holds, through the path it
+    // was added with. Returns the descriptor the path now leads to.
+    int UpdateWatch(const char *path, int wd, uint32_t mask, Subscriber *subscriber);
+
+    // The kernel watch is removed with its last subscriber.
+    void RemoveWatch(int wd, Subscriber *subscriber);
+
+    // Trees are kept by the directory at their root, so a watcher on a
+    // directory one already holds can take its view from it instead of
+    // building its own. The registry doesn't keep them alive.
+    void AddTree(const std::string &root, const std::shared_ptr<TreeWatch> &tree);
+    void RemoveTree(const std::string &root, const TreeWatch *tree);
+    void FindTrees(const std::string &root, std::vector<std::shared_ptr<TreeWatch>> &found);
+
+    inline size_t GetWatchCount() const { return watchCount.load(std::memory_order_relaxed); }
+    inline size_t GetTreeCount() const { return treeCount.load(std::memory_order_relaxed); }
+    inline size_t GetBufferSize() const { return bufferSize.load(std::memory_order_relaxed); }
+    inline size_t GetPeakBufferSize() const { return peakBufferSize.load(std::memory_order_relaxed); }
+
+private:
+    WatchRegistry();
+
+    virtual void OnReadable(int fd) override;
+    virtual size_t GetReadSize(int fd) override;
+    virtual void OnRead(int fd, const char *data, ssize_t length) override;
+    virtual void OnError(int fd, int error) override;
+    void DispatchEvents(const char *data, size_t length);
+    void Dispatch(const inotify_event *event);
+    void EndDispatch();
+    void ResizeBuffer(size_t size);
+    void UpdateBufferBounds();
+
+    struct Watch
+    {
+        uint32_t mask;
+        std::vector<std::pair<Subscriber *, uint32_t>> subscribers;
+    };
+
+    uint32_t GetMask(const Watch &watch) const;
+
+    std::shared_ptr<EventReactor> reactor;
+    int fileDescriptor;
+
+    // With io_uring, the reactor keeps a read posted into its own buffer and
+    // only asks how large to make it.
+    bool reactorReads;
+    FlatHashMap<int, Watch> watches;
+    std::atomic<size_t> watchCount;
+
+    std::multimap<std::string, std::weak_ptr<TreeWatch>> trees;
+    std::atomic<size_t> treeCount;
+
+    struct Subscription
+    {
+        Subscriber *subscriber;
+        size_t minBufferSize;
+        size_t maxBufferSize;
+    };
+
+    std::vector<Subscription> subscribers;
+
+    // Who an event is being handed to, copied out since subscribers add and
+    // remove watches while handling it, and who has been handed anything
+    // since the last read.
+    std::vector<Subscriber *> recipients;
+    std::vector<Subscriber *> notified;
+
+    // Sized before each wakeup's reads from the bytes the kernel has queued,
+    // so a burst is drained in one read(), or doubled after a posted read
+    // comes back over half full. It shrinks again once a wakeup needs less than a
+    // quarter of it.
+    std::unique_ptr<char[]> buffer;
+    std::atomic<size_t> bufferSize;
+    std::atomic<size_t> peakBufferSize;
+    size_t minBufferSize;
+    size_t maxBufferSize;
+};
+
+#endif // __linux__
+
+#endif // REGISTRY_H_
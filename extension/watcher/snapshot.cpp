@@ -0,0 +1,97 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "snapshot.h"
+
+DirectorySnapshot::DirectorySnapshot() : entries(8),
+                                         modifiedTime(0)
+{
+}
+
+void DirectorySnapshot::Clear()
+{
+    entries.Clear();
+    modifiedTime = 0;
+}
+
+DirectorySnapshot::Entry *DirectorySnapshot::Find(const char *name, size_t length)
+{
+    Entry *entry = entries.Find(HashName(name, length));
+    if (entry && entry->name.compare(0, std::string::npos, name, length) != 0)
+    {
+        return nullptr;
+    }
+
+    return entry;
+}
+
+DirectorySnapshot::Entry &DirectorySnapshot::Set(const char *name, size_t length, int64_t modifiedTime, uint64_t size, uint64_t inode, bool isDirectory)
+{
+    uint64_t key = HashName(name, length);
+
+    Entry *entry = entries.Find(key);
+    if (!entry)
+    {
+        entry = &entries.Insert(key, Entry());
+    }
+
+    entry->name.assign(name, length);
+    entry->modifiedTime = modifiedTime;
+    entry->size = size;
+    entry->inode = inode;
+    entry->isDirectory = isDirectory;
+    entry->seen = true;
+
+    return *entry;
+}
+
+bool DirectorySnapshot::Remove(const char *name, size_t length)
+{
+    return entries.Erase(HashName(name, length));
+}
+
+void DirectorySnapshot::ClearSeen()
+{
+    entries.ForEach([](uint64_t key, Entry &entry)
+                    { entry.seen = false; });
+}
+
+uint64_t DirectorySnapshot::HashName(const char *name, size_t length)
+{
+    // FNV-1a. Names are only ever compared within one directory, where a
+    // 64-bit collision isn't a practical concern.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
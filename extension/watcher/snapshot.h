@@ -0,0 +1,109 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "flatmap.h"
+
+// What one directory looked like when it was last checked: its own
+// modification time, plus the name and kind of each entry, and where they
+// were stat'd, their inode, size and modification time. Comparing against a
+// fresh listing gives the changes made since, and an inode that turns up
+// under a new name is a rename.
+class DirectorySnapshot
+{
+public:
+    struct Entry
+    {
+        std::string name;
+        int64_t modifiedTime;
+        uint64_t size;
+        uint64_t inode;
+        bool isDirectory;
+        bool seen;
+    };
+
+    DirectorySnapshot();
+
+    void Clear();
+
+    Entry *Find(const char *name, size_t length);
+    Entry &Set(const char *name, size_t length, int64_t modifiedTime, uint64_t size, uint64_t inode, bool isDirectory);
+    bool Remove(const char *name, size_t length);
+
+    // Marks every entry as not seen, ahead of comparing against a listing.
+    void ClearSeen();
+
+    // Removes the entries that weren't seen, calling back with each first.
+    template <typename F>
+    void RemoveUnseen(F &&callback)
+    {
+        unseen.clear();
+        entries.ForEach([this](uint64_t key, Entry &entry)
+                        {
+                            if (!entry.seen)
+                            {
+                                unseen.push_back(key);
+                            }
+                        });
+
+        for (auto it = unseen.begin(); it != unseen.end(); it++)
+        {
+            Entry *entry = entries.Find(*it);
+            callback(*entry);
+            entries.Erase(*it);
+        }
+    }
+
+    template <typename F>
+    void ForEach(F &&callback)
+    {
+        entries.ForEach([&callback](uint64_t key, Entry &entry)
+                        { callback(entry); });
+    }
+
+    inline int64_t GetModifiedTime() const { return modifiedTime; }
+    inline void SetModifiedTime(int64_t time) { modifiedTime = time; }
+    inline size_t GetSize() const { return entries.GetSize(); }
+
+private:
+    static uint64_t HashName(const char *name, size_t length);
+
+    FlatHashMap<uint64_t, Entry> entries;
+    int64_t modifiedTime;
+    std::vector<uint64_t> unseen;
+};
+
+#endif // SNAPSHOT_H_
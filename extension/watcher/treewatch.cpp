@@ -0,0 +1,1155 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+
+#include "treewatch.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    int64_t GetModifiedTime(const struct stat &st)
+    {
+        return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    // The wall clock, which file times are taken from, in the same units.
+    int64_t GetRealTime()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    std::string TrimSeparators(const std::string &path)
+    {
+        size_t length = path.size();
+        while (length > 1 && path[length - 1] == '/')
+        {
+            length--;
+        }
+
+        return path.substr(0, length);
+    }
+}
+
+std::shared_ptr<TreeWatch> TreeWatch::Acquire(const std::shared_ptr<EventReactor> &reactor, const std::shared_ptr<WatchRegistry> &registry, const std::string &path, const Options &options)
+{
+    if (registry)
+    {
+        // The directory may be the root of a tree, or inside one rooted at
+        // any directory above it.
+        std::vector<std::shared_ptr<TreeWatch>> found;
+        std::string root = TrimSeparators(path);
+        const std::string directory = root;
+
+        for (;;)
+        {
+            found.clear();
+            registry->FindTrees(root, found);
+
+            for (auto it = found.begin(); it != found.end(); it++)
+            {
+                TreeWatch &tree = **it;
+
+                // The directory filter is matched against paths relative to
+                // the root, so a tree with one is only shared from its root.
+                bool sameRoot = root == directory;
+                if (tree.stopped || tree.options.subtree != options.subtree || tree.options.symlinks != options.symlinks ||
+                    tree.options.directoryFilter != options.directoryFilter || (!sameRoot && options.directoryFilter))
+                {
+                    continue;
+                }
+
+                if (tree.FindDirectory(directory) != WatchTree::kInvalidNode)
+                {
+                    return *it;
+                }
+            }
+
+            size_t slash = root.find_last_of('/');
+            if (slash == std::string::npos || root.size() <= 1)
+            {
+                break;
+            }
+
+            root.resize(slash == 0 ? 1 : slash);
+        }
+    }
+
+    return std::make_shared<TreeWatch>(reactor, registry, TrimSeparators(path), options);
+}
+
+TreeWatch::TreeWatch(const std::shared_ptr<EventReactor> &reactor,
+                     const std::shared_ptr<WatchRegistry> &registry,
+                     const std::string &rootPath,
+                     const Options &options) : reactor(reactor),
+                                               registry(registry),
+                                               rootPath(rootPath),
+                                               options(options),
+                                               polling(!registry),
+                                               started(false),
+                                               stopped(false),
+                                               mask(0),
+                                               moveExpiryMs(kMoveExpiryMs),
+                                               minBufferSize(0),
+                                               maxBufferSize(0),
+                                               armed(false),
+                                               registeredDirectories(0),
+                                               pendingDirectories(0),
+                                               nextPollId(0),
+                                               syncedTime(GetRealTime()),
+                                               resyncSince(0),
+                                               pollTimerDescriptor(-1),
+                                               moveTimerDescriptor(-1),
+                                               moveTimerArmed(false),
+                                               records(0),
+                                               scanDescriptor(-1),
+                                               scanReport(false)
+{
+}
+
+TreeWatch::~TreeWatch()
+{
+    if (pollTimerDescriptor != -1)
+    {
+        close(pollTimerDescriptor);
+    }
+
+    if (moveTimerDescriptor != -1)
+    {
+        close(moveTimerDescriptor);
+    }
+}
+
+uint32_t TreeWatch::AddView(View *view, const std::string &path, const ViewOptions &viewOptions)
+{
+    uint32_t node = FindDirectory(path);
+    if (started && node == WatchTree::kInvalidNode)
+    {
+        return node;
+    }
+
+    ViewEntry entry;
+    entry.view = view;
+    entry.options = viewOptions;
+    views.push_back(entry);
+
+    UpdateViews();
+
+    // The first view starts the tree, with what it asks for.
+    if (!started)
+    {
+        started = true;
+
+        if (!Start())
+        {
+            views.clear();
+            Stop();
+            return WatchTree::kInvalidNode;
+        }
+
+        node = tree.GetRoot();
+    }
+
+    return node;
+}
+
+void TreeWatch::SetViewMask(View *view, uint32_t viewMask)
+{
+    for (auto it = views.begin(); it != views.end(); it++)
+    {
+        if (it->view == view)
+        {
+            it->options.mask = viewMask;
+        }
+    }
+
+    UpdateViews();
+}
+
+void TreeWatch::RemoveView(View *view)
+{
+    auto it = std::find_if(views.begin(), views.end(), [view](const ViewEntry &entry)
+                           { return entry.view == view; });
+
+    if (it == views.end())
+    {
+        return;
+    }
+
+    views.erase(it);
+
+    // It may be removing itself from inside a call made while handing
+    // something out.
+    std::replace(recipients.begin(), recipients.end(), view, (View *)nullptr);
+
+    if (views.empty())
+    {
+        Stop();
+        return;
+    }
+
+    UpdateViews();
+}
+
+void TreeWatch::UpdateViews()
+{
+    if (views.empty() || stopped)
+    {
+        return;
+    }
+
+    uint32_t oldMask = GetWatchMask();
+
+    mask = 0;
+    moveExpiryMs = kMoveExpiryMs;
+    minBufferSize = views.front().options.minBufferSize;
+    maxBufferSize = views.front().options.maxBufferSize;
+
+    for (auto it = views.begin(); it != views.end(); it++)
+    {
+        mask |= it->options.mask;
+        moveExpiryMs = std::max(moveExpiryMs, (long)it->options.moveExpiryMs);
+        minBufferSize = std::min(minBufferSize, it->options.minBufferSize);
+        maxBufferSize = std::max(maxBufferSize, it->options.maxBufferSize);
+    }
+
+    // Polling compares everything, whatever the views ask for.
+    if (!started || polling)
+    {
+        return;
+    }
+
+    registry->Subscribe(this, minBufferSize, maxBufferSize);
+
+    uint32_t watchMask = GetWatchMask();
+    if (watchMask == oldMask)
+    {
+        return;
+    }
+
+    // Updating a watch keeps its descriptor, so nothing in the tree
+    // changes. What other trees asked for on the same directory is kept.
+    tree.ForEach([this, watchMask](uint32_t node, int wd)
+                 { registry->UpdateWatch(GetNodePath(node).c_str(), wd, watchMask, this); });
+}
+
+bool TreeWatch::Start()
+{
+    if (polling)
+    {
+        pollTimerDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (pollTimerDescriptor == -1 || !reactor->Register(pollTimerDescriptor, this))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        moveTimerDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (moveTimerDescriptor == -1 || !reactor->Register(moveTimerDescriptor, this) ||
+            !registry->Subscribe(this, minBufferSize, maxBufferSize))
+        {
+            return false;
+        }
+    }
+
+    if (AddDirectory(WatchTree::kInvalidNode, "", rootPath, false) == WatchTree::kInvalidNode)
+    {
+        return false;
+    }
+
+    if (registry)
+    {
+        registry->AddTree(rootPath, shared_from_this());
+    }
+
+    reactor->ScheduleWork(this);
+    return true;
+}
+
+void TreeWatch::Stop()
+{
+    if (stopped)
+    {
+        return;
+    }
+
+    stopped = true;
+
+    if (registry)
+    {
+        registry->Unsubscribe(this);
+        registry->RemoveTree(rootPath, this);
+    }
+
+    if (pollTimerDescriptor != -1)
+    {
+        reactor->Unregister(pollTimerDescriptor);
+    }
+
+    if (moveTimerDescriptor != -1)
+    {
+        reactor->Unregister(moveTimerDescriptor);
+    }
+
+    reactor->CancelWork(this);
+
+    ForEachView([](View *view)
+                { view->OnTreeStopped(); });
+}
+
+uint32_t TreeWatch::FindDirectory(const std::string &directory) const
+{
+    std::string path = TrimSeparators(directory);
+    uint32_t node = tree.GetRoot();
+    if (node == WatchTree::kInvalidNode || path == rootPath)
+    {
+        return node;
+    }
+
+    // Below the root, one name at a time.
+    size_t start = rootPath.size() == 1 ? 1 : rootPath.size() + 1;
+    if (path.size() <= start || path.compare(0, rootPath.size(), rootPath) != 0 || path[start - 1] != '/')
+    {
+        return WatchTree::kInvalidNode;
+    }
+
+    while (start < path.size() && node != WatchTree::kInvalidNode)
+    {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+        {
+            end = path.size();
+        }
+
+        node = tree.FindChild(node, path.data() + start, end - start);
+        start = end + 1;
+    }
+
+    return node;
+}
+
+uint32_t TreeWatch::AddDirectory(uint32_t parent, const std::string &name, const fs::path &path, bool report)
+{
+    // A polled directory has no watch, only an id that is never reused.
+    int wd = polling ? nextPollId++ : registry->AddWatch(path.string().c_str(), GetWatchMask(), this);
+    if (wd == -1)
+    {
+        return WatchTree::kInvalidNode;
+    }
+
+    // A directory reachable through more than one link is only watched once.
+    uint32_t node = tree.Add(parent, wd, name.data(), name.size());
+    if (node == WatchTree::kInvalidNode)
+    {
+        return node;
+    }
+
+    // Node ids are reused, so start from a clean snapshot.
+    GetSnapshot(node).Clear();
+
+    if (node >= createdNodes.size())
+    {
+        createdNodes.resize(node + 1);
+    }
+
+    createdNodes[node] = report;
+
+    // The watch is in place before the directory is listed, so nothing
+    // created in between can slip through.
+    ScanRequest request;
+    request.wd = wd;
+    request.report = report;
+    scanQueue.push_back(request);
+
+    return node;
+}
+
+void TreeWatch::RemoveDirectory(uint32_t node)
+{
+    removedDescriptors.clear();
+    removedNodes.clear();
+    tree.Remove(node, removedDescriptors, &removedNodes);
+
+    for (auto it = removedDescriptors.begin(); it != removedDescriptors.end() && registry; it++)
+    {
+        registry->RemoveWatch(*it, this);
+    }
+
+    for (auto it = removedNodes.begin(); it != removedNodes.end(); it++)
+    {
+        snapshots[*it].reset();
+    }
+
+    // Scans publish the count as they go, but a removal can come at any time.
+    registeredDirectories.store(tree.GetSize(), std::memory_order_relaxed);
+
+    ForEachView([](View *view)
+                { view->OnTreeReshaped(); });
+}
+
+uint32_t TreeWatch::GetWatchMask() const
+{
+    // Losing the watched directory itself always matters.
+    uint32_t watchMask = mask | IN_ONLYDIR | IN_DELETE_SELF | IN_MOVE_SELF;
+
+    // New and moved directories are needed to keep the subtree watched.
+    if (options.subtree)
+    {
+        watchMask |= IN_CREATE | IN_MOVE;
+    }
+
+    return watchMask;
+}
+
+const std::string &TreeWatch::GetNodePath(uint32_t node)
+{
+    scratchPath.assign(rootPath);
+    if (node != tree.GetRoot())
+    {
+        scratchPath += '/';
+        tree.AppendPath(node, scratchPath);
+    }
+
+    return scratchPath;
+}
+
+const std::string &TreeWatch::GetChildPath(uint32_t node, const char *name)
+{
+    GetNodePath(node);
+    scratchPath += '/';
+    scratchPath += name;
+
+    return scratchPath;
+}
+
+bool TreeWatch::IsExcludedChild(uint32_t node, const char *name, size_t length)
+{
+    if (!options.directoryFilter)
+    {
+        return false;
+    }
+
+    filterPath.clear();
+    tree.AppendPath(node, filterPath);
+
+    if (!filterPath.empty())
+    {
+        filterPath += '/';
+    }
+
+    filterPath.append(name, length);
+    return !options.directoryFilter->IsAccepted(filterPath.data(), filterPath.size());
+}
+
+bool TreeWatch::IsDirectoryLink(uint32_t node, const char *name)
+{
+    const std::string &path = GetChildPath(node, name);
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) == -1 || !S_ISLNK(st.st_mode))
+    {
+        return false;
+    }
+
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+DirectorySnapshot &TreeWatch::GetSnapshot(uint32_t node)
+{
+    if (node >= snapshots.size())
+    {
+        snapshots.resize(node + 1);
+    }
+
+    if (!snapshots[node])
+    {
+        snapshots[node] = std::make_unique<DirectorySnapshot>();
+    }
+
+    return *snapshots[node];
+}
+
+bool TreeWatch::OnWork()
+{
+    if (stopped)
+    {
+        return false;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(kScanSliceMicroseconds);
+    std::error_code ec;
+
+    // The directory being listed may have been removed since the last slice.
+    if (scanIterator != fs::directory_iterator() && tree.Find(scanDescriptor) == WatchTree::kInvalidNode)
+    {
+        scanIterator = fs::directory_iterator();
+    }
+
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        if (scanIterator == fs::directory_iterator())
+        {
+            if (scanQueue.empty())
+            {
+                break;
+            }
+
+            ScanRequest request = scanQueue.front();
+            scanQueue.pop_front();
+
+            uint32_t node = tree.Find(request.wd);
+            if (node == WatchTree::kInvalidNode)
+            {
+                continue;
+            }
+
+            scanDescriptor = request.wd;
+            scanReport = request.report;
+
+            // Taken before listing, so anything that changes the directory
+            // meanwhile makes it look changed to a later resync.
+            const std::string &path = GetNodePath(node);
+            struct stat st;
+            if (stat(path.c_str(), &st) == 0)
+            {
+                GetSnapshot(node).SetModifiedTime(GetModifiedTime(st));
+            }
+
+            scanIterator = fs::directory_iterator(path, fs::directory_options::skip_permission_denied, ec);
+            if (ec)
+            {
+                scanIterator = fs::directory_iterator();
+            }
+
+            continue;
+        }
+
+        const auto &entry = *scanIterator;
+        uint32_t node = tree.Find(scanDescriptor);
+        std::string name = entry.path().filename().string();
+
+        // Polling compares every file against its last stat. With inotify,
+        // only the name and kind are kept, which the listing already has.
+        if (polling)
+        {
+            struct stat st;
+            if (stat(entry.path().c_str(), &st) == 0)
+            {
+                GetSnapshot(node).Set(name.data(), name.size(), GetModifiedTime(st), st.st_size, st.st_ino, S_ISDIR(st.st_mode));
+            }
+        }
+        else
+        {
+            GetSnapshot(node).Set(name.data(), name.size(), 0, 0, 0, entry.is_directory(ec));
+        }
+
+        if (options.subtree && entry.is_directory(ec) && (options.symlinks || !entry.is_symlink(ec)))
+        {
+            // Directories found inside one that was created after the watch
+            // started would otherwise never be reported.
+            // An excluded one is reported, but nothing inside it is watched.
+            bool watched = IsExcludedChild(node, name.data(), name.size()) ||
+                           AddDirectory(node, name, entry.path(), scanReport) != WatchTree::kInvalidNode;
+
+            if (watched && scanReport)
+            {
+                ForEachView([&](View *view)
+                            { view->OnTreeChange(IN_CREATE, node, name.data(), name.size()); });
+            }
+        }
+
+        scanIterator.increment(ec);
+        if (ec)
+        {
+            scanIterator = fs::directory_iterator();
+        }
+    }
+
+    bool scanning = scanIterator != fs::directory_iterator();
+
+    registeredDirectories.store(tree.GetSize(), std::memory_order_relaxed);
+    pendingDirectories.store(scanQueue.size() + (scanning ? 1 : 0), std::memory_order_relaxed);
+
+    if (!scanning && scanQueue.empty())
+    {
+        if (!armed)
+        {
+            armed = true;
+            ForEachView([](View *view)
+                        { view->OnTreeArmed(); });
+
+            if (polling)
+            {
+                SetTimer(pollTimerDescriptor, options.pollIntervalMs ? options.pollIntervalMs : kPollIntervalMs);
+            }
+        }
+
+        // Resyncing waits for registration so every directory has a
+        // snapshot to compare against.
+        while (!resyncQueue.empty() && std::chrono::steady_clock::now() < deadline)
+        {
+            uint32_t node = tree.Find(resyncQueue.back());
+            resyncQueue.pop_back();
+
+            if (node != WatchTree::kInvalidNode)
+            {
+                ResyncDirectory(node);
+            }
+        }
+    }
+
+    // Those found by a resync go out slice by slice.
+    EndEvents();
+
+    return !stopped && (scanning || !scanQueue.empty() || !resyncQueue.empty());
+}
+
+void TreeWatch::StartResync()
+{
+    // Files changed since events were last read in full are taken as
+    // modified, give or take how coarse file times are. An overflow during
+    // a resync extends the one in progress.
+    int64_t since = syncedTime - kResyncSlackMs * 1000000;
+    resyncSince = resyncQueue.empty() ? since : std::min(resyncSince, since);
+
+    // The lost events could have touched any directory, and inotify doesn't
+    // say which. Each one's modification time is checked, and only those
+    // where it moved are listed again; files are only looked at when
+    // modifications are asked for.
+    resyncQueue.clear();
+    tree.ForEach([this](uint32_t node, int wd)
+                 { resyncQueue.push_back(wd); });
+
+    reactor->ScheduleWork(this);
+}
+
+void TreeWatch::ResyncDirectory(uint32_t node)
+{
+    resyncPath = GetNodePath(node);
+
+    struct stat st;
+    if (stat(resyncPath.c_str(), &st) == -1)
+    {
+        // Gone; its parent's resync reports that.
+        return;
+    }
+
+    DirectorySnapshot &snapshot = GetSnapshot(node);
+
+    if (GetModifiedTime(st) == snapshot.GetModifiedTime())
+    {
+        // Nothing was added or removed, so only file contents can differ.
+        if (!(mask & IN_CLOSE_WRITE))
+        {
+            return;
+        }
+
+        snapshot.ForEach([&](DirectorySnapshot::Entry &entry)
+                         {
+                             if (entry.isDirectory)
+                             {
+                                 return;
+                             }
+
+                             struct stat fileStat;
+                             if (stat(GetChildPath(node, entry.name.c_str()).c_str(), &fileStat) == 0 && IsModified(entry, fileStat))
+                             {
+                                 ForEachView([&](View *view)
+                                             { view->OnTreeChange(IN_CLOSE_WRITE, node, entry.name.data(), entry.name.size()); });
+                             }
+                         });
+
+        return;
+    }
+
+    DIR *dir = opendir(resyncPath.c_str());
+    if (!dir)
+    {
+        return;
+    }
+
+    snapshot.SetModifiedTime(GetModifiedTime(st));
+    snapshot.ClearSeen();
+    newEntries.clear();
+
+    while (dirent *entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        size_t nameLength = strlen(entry->d_name);
+        DirectorySnapshot::Entry *known = snapshot.Find(entry->d_name, nameLength);
+
+        // With inotify, the listing says what kind of entry this is, and
+        // files are only looked at for modifications. Links are followed.
+        bool needsStat = polling || entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK ||
+                         (known && entry->d_type != DT_DIR && (mask & IN_CLOSE_WRITE));
+
+        struct stat entryStat;
+        if (needsStat && fstatat(dirfd(dir), entry->d_name, &entryStat, 0) == -1)
+        {
+            continue;
+        }
+
+        bool isDirectory = needsStat ? S_ISDIR(entryStat.st_mode) : entry->d_type == DT_DIR;
+
+        if (!known)
+        {
+            if (polling)
+            {
+                snapshot.Set(entry->d_name, nameLength, GetModifiedTime(entryStat), entryStat.st_size, entryStat.st_ino, isDirectory);
+            }
+            else
+            {
+                snapshot.Set(entry->d_name, nameLength, 0, 0, entry->d_ino, isDirectory);
+            }
+
+            NewEntry newEntry;
+            newEntry.name.assign(entry->d_name, nameLength);
+            newEntry.inode = polling ? (uint64_t)entryStat.st_ino : (uint64_t)entry->d_ino;
+            newEntry.isDirectory = isDirectory;
+            newEntry.isLink = entry->d_type == DT_LNK;
+            newEntry.renamed = false;
+            newEntries.push_back(std::move(newEntry));
+            continue;
+        }
+
+        known->seen = true;
+
+        if (!isDirectory && needsStat && IsModified(*known, entryStat))
+        {
+            ForEachView([&](View *view)
+                        { view->OnTreeChange(IN_CLOSE_WRITE, node, entry->d_name, nameLength); });
+        }
+
+        // Learned as the directory is listed, so renames can be matched the
+        // next time.
+        if (!polling)
+        {
+            known->inode = entry->d_ino;
+        }
+    }
+
+    closedir(dir);
+
+    snapshot.RemoveUnseen([&](const DirectorySnapshot::Entry &entry)
+                          {
+                              // The same inode under a new name was renamed. Names
+                              // recorded from events have none.
+                              for (auto it = newEntries.begin(); it != newEntries.end() && entry.inode; it++)
+                              {
+                                  if (it->renamed || it->inode != entry.inode || it->isDirectory != entry.isDirectory)
+                                  {
+                                      continue;
+                                  }
+
+                                  it->renamed = true;
+
+                                  // The directory keeps its place in the tree, and its
+                                  // snapshots, under the new name.
+                                  uint32_t child = tree.FindChild(node, entry.name.data(), entry.name.size());
+                                  if (child != WatchTree::kInvalidNode)
+                                  {
+                                      tree.Move(child, node, it->name.data(), it->name.size());
+                                      ForEachView([](View *view)
+                                                  { view->OnTreeReshaped(); });
+
+                                      if (IsExcludedChild(node, it->name.data(), it->name.size()))
+                                      {
+                                          RemoveDirectory(child);
+                                      }
+                                  }
+                                  else if (options.subtree && it->isDirectory && (options.symlinks || !it->isLink) &&
+                                           !IsExcludedChild(node, it->name.data(), it->name.size()))
+                                  {
+                                      // Renamed out of an exclusion.
+                                      AddDirectory(node, it->name, GetChildPath(node, it->name.c_str()), false);
+                                  }
+
+                                  ForEachView([&](View *view)
+                                              { view->OnTreeRenamed(node, entry.name.data(), entry.name.size(), it->name.data(), it->name.size()); });
+
+                                  return;
+                              }
+
+                              ForEachView([&](View *view)
+                                          { view->OnTreeChange(IN_DELETE, node, entry.name.data(), entry.name.size()); });
+
+                              // Its watches may have missed their own removal too.
+                              uint32_t child = tree.FindChild(node, entry.name.data(), entry.name.size());
+                              if (child != WatchTree::kInvalidNode)
+                              {
+                                  RemoveDirectory(child);
+                              }
+                          });
+
+    for (auto it = newEntries.begin(); it != newEntries.end(); it++)
+    {
+        if (it->renamed)
+        {
+            continue;
+        }
+
+        ForEachView([&](View *view)
+                    { view->OnTreeChange(IN_CREATE, node, it->name.data(), it->name.size()); });
+
+        if (options.subtree && it->isDirectory && (options.symlinks || !it->isLink) &&
+            tree.FindChild(node, it->name.data(), it->name.size()) == WatchTree::kInvalidNode &&
+            !IsExcludedChild(node, it->name.data(), it->name.size()))
+        {
+            AddDirectory(node, it->name, GetChildPath(node, it->name.c_str()), true);
+        }
+    }
+}
+
+bool TreeWatch::IsModified(DirectorySnapshot::Entry &entry, const struct stat &st)
+{
+    if (!polling)
+    {
+        return GetModifiedTime(st) >= resyncSince;
+    }
+
+    // A file saved by replacing it has a new inode, but may keep its size
+    // and modification time.
+    if (GetModifiedTime(st) == entry.modifiedTime && (uint64_t)st.st_size == entry.size && (uint64_t)st.st_ino == entry.inode)
+    {
+        return false;
+    }
+
+    entry.modifiedTime = GetModifiedTime(st);
+    entry.size = st.st_size;
+    entry.inode = st.st_ino;
+    return true;
+}
+
+void TreeWatch::ContinuePoll()
+{
+    // Directories that appeared in the last slice are listed, and what is in
+    // them reported, before the pass carries on.
+    if (!scanQueue.empty() || scanIterator != fs::directory_iterator())
+    {
+        SetTimer(pollTimerDescriptor, kPollSliceGapMs);
+        return;
+    }
+
+    if (pollQueue.empty())
+    {
+        // There is no IN_DELETE_SELF to say the root is gone.
+        struct stat st;
+        if (stat(rootPath.c_str(), &st) == -1 || !S_ISDIR(st.st_mode))
+        {
+            Stop();
+            return;
+        }
+
+        tree.ForEach([this](uint32_t node, int id)
+                     { pollQueue.push_back(id); });
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(kPollSliceMicroseconds);
+
+    while (!pollQueue.empty() && std::chrono::steady_clock::now() < deadline)
+    {
+        uint32_t node = tree.Find(pollQueue.back());
+        pollQueue.pop_back();
+
+        if (node != WatchTree::kInvalidNode)
+        {
+            ResyncDirectory(node);
+        }
+    }
+
+    if (!scanQueue.empty())
+    {
+        reactor->ScheduleWork(this);
+    }
+
+    EndEvents();
+
+    if (!stopped)
+    {
+        SetTimer(pollTimerDescriptor, pollQueue.empty() ? (options.pollIntervalMs ? options.pollIntervalMs : kPollIntervalMs) : kPollSliceGapMs);
+    }
+}
+
+void TreeWatch::SetTimer(int fd, long milliseconds)
+{
+    itimerspec spec = {};
+    spec.it_value.tv_sec = milliseconds / 1000;
+    spec.it_value.tv_nsec = (milliseconds % 1000) * 1000000L;
+
+    timerfd_settime(fd, 0, &spec, nullptr);
+}
+
+void TreeWatch::ExpireMoves()
+{
+    moveTimerArmed = false;
+
+    // A directory among them has left the tree, so its watches go too.
+    pendingMoves.ForEach([this](uint32_t cookie, int wd)
+                         {
+                             if (wd != -1)
+                             {
+                                 expiredDescriptors.push_back(wd);
+                             }
+                         });
+
+    pendingMoves.Clear();
+
+    // Nodes are looked up again, as one may have been removed since.
+    for (auto it = expiredDescriptors.begin(); it != expiredDescriptors.end(); it++)
+    {
+        uint32_t node = tree.Find(*it);
+        if (node != WatchTree::kInvalidNode)
+        {
+            RemoveDirectory(node);
+        }
+    }
+
+    expiredDescriptors.clear();
+}
+
+void TreeWatch::EndEvents()
+{
+    size_t count = records;
+    records = 0;
+
+    ForEachView([count](View *view)
+                { view->OnTreeEventsEnd(count); });
+}
+
+void TreeWatch::OnReadable(int fd)
+{
+    // A rearm since the timer fired resets its count, which makes this read
+    // fail.
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+
+    if (fd == pollTimerDescriptor)
+    {
+        ContinuePoll();
+    }
+    else
+    {
+        ExpireMoves();
+    }
+}
+
+void TreeWatch::OnError(int fd, int error)
+{
+    // A timer that can't be read any more leaves the tree blind.
+    Stop();
+}
+
+void TreeWatch::OnWatchEvent(const inotify_event *event)
+{
+    if (stopped)
+    {
+        return;
+    }
+
+    records++;
+
+    // The kernel queue filled up and events were dropped. Say so, then
+    // find what was missed by comparing against the snapshots.
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        ForEachView([](View *view)
+                    { view->OnTreeOverflow(); });
+
+        StartResync();
+        return;
+    }
+
+    // Events may still be buffered for a directory that was torn down
+    // earlier in this wakeup.
+    uint32_t node = tree.Find(event->wd);
+    if (node == WatchTree::kInvalidNode)
+    {
+        return;
+    }
+
+    if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+    {
+        // A subdirectory that moves is re-linked or dropped when its
+        // parent reports the move, so only the root is handled here.
+        if ((event->mask & IN_DELETE_SELF) || node == tree.GetRoot())
+        {
+            RemoveDirectory(node);
+        }
+
+        return;
+    }
+
+    const char *name = event->name;
+    size_t nameLength = event->len ? strlen(event->name) : 0;
+
+    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        GetSnapshot(node).Set(name, nameLength, 0, 0, 0, (event->mask & IN_ISDIR) != 0);
+
+        int *move = (event->mask & IN_MOVED_TO) ? pendingMoves.Find(event->cookie) : nullptr;
+        if (move)
+        {
+            // The directory keeps its watches; only its place in the tree
+            // changes, which changes the paths below it.
+            uint32_t movedNode = tree.Find(*move);
+            if (movedNode != WatchTree::kInvalidNode)
+            {
+                tree.Move(movedNode, node, name, nameLength);
+                ForEachView([](View *view)
+                            { view->OnTreeReshaped(); });
+
+                // Unless it was moved somewhere excluded.
+                if (IsExcludedChild(node, name, nameLength))
+                {
+                    RemoveDirectory(movedNode);
+                }
+            }
+            else if (options.subtree && (event->mask & IN_ISDIR) && *move == -1 &&
+                     !IsExcludedChild(node, name, nameLength))
+            {
+                // Moved out of an excluded directory, or one excluded by
+                // name, so it wasn't watched before.
+                AddDirectory(node, std::string(name, nameLength), GetChildPath(node, name), false);
+                reactor->ScheduleWork(this);
+            }
+
+            pendingMoves.Erase(event->cookie);
+        }
+        else if (options.subtree && ((event->mask & IN_ISDIR) || (options.symlinks && IsDirectoryLink(node, name))))
+        {
+            // Already reported when its parent was listed.
+            if (tree.FindChild(node, name, nameLength) != WatchTree::kInvalidNode)
+            {
+                return;
+            }
+
+            if (!IsExcludedChild(node, name, nameLength))
+            {
+                AddDirectory(node, std::string(name, nameLength), GetChildPath(node, name), true);
+                reactor->ScheduleWork(this);
+            }
+        }
+
+        if (event->mask & IN_MOVED_TO)
+        {
+            ForEachView([&](View *view)
+                        { view->OnTreeMovedTo(event->cookie, node, name, nameLength); });
+        }
+        else
+        {
+            ForEachView([&](View *view)
+                        { view->OnTreeChange(IN_CREATE, node, name, nameLength); });
+        }
+    }
+
+    // Never reported, so there's nothing to take back. One that was renamed
+    // is reported as created under its new name.
+    if ((event->mask & (IN_DELETE | IN_MOVED_FROM)) &&
+        !GetSnapshot(node).Remove(name, nameLength) && createdNodes[node])
+    {
+        return;
+    }
+
+    if (event->mask & IN_DELETE)
+    {
+        ForEachView([&](View *view)
+                    { view->OnTreeChange(IN_DELETE, node, name, nameLength); });
+    }
+
+    if (event->mask & IN_MOVED_FROM)
+    {
+        if (pendingMoves.GetSize() < kMaxPendingMoves)
+        {
+            uint32_t child = options.subtree ? tree.FindChild(node, name, nameLength) : WatchTree::kInvalidNode;
+            pendingMoves.Insert(event->cookie, child != WatchTree::kInvalidNode ? tree.GetDescriptor(child) : -1);
+        }
+
+        ForEachView([&](View *view)
+                    { view->OnTreeMovedFrom(event->cookie, node, name, nameLength); });
+    }
+
+    if (event->mask & IN_CLOSE_WRITE)
+    {
+        ForEachView([&](View *view)
+                    { view->OnTreeChange(IN_CLOSE_WRITE, node, name, nameLength); });
+    }
+}
+
+void TreeWatch::OnWatchEventsEnd()
+{
+    if (stopped)
+    {
+        return;
+    }
+
+    if (tree.IsEmpty())
+    {
+        Stop();
+        return;
+    }
+
+    syncedTime = GetRealTime();
+
+    // Once armed, the timer isn't pushed back by later moves, so a steady
+    // stream of them can't keep a directory that left the tree watched.
+    if (!pendingMoves.IsEmpty() && !moveTimerArmed)
+    {
+        SetTimer(moveTimerDescriptor, moveExpiryMs);
+        moveTimerArmed = true;
+    }
+
+    EndEvents();
+}
+
+void TreeWatch::OnWatchError(int error)
+{
+    Stop();
+}
+
+#endif // __linux__
@@ -0,0 +1,341 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+
+#ifndef TREEWATCH_H_
+#define TREEWATCH_H_
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "flatmap.h"
+#include "pathmatcher.h"
+#include "reactor.h"
+#include "registry.h"
+#include "snapshot.h"
+#include "watchtree.h"
+
+// A watched directory tree: a watch on each directory in it, a snapshot of
+// what each one holds, and the listing that registers them. Events are parsed
+// here once, and what they mean is handed to every view of the tree: a
+// watcher on its root, or on a directory inside it.
+//
+// Watchers on the same tree that take in the same directories share one,
+// found through the registry by the directory at its root, so another watcher
+// on a tree that is already watched lists and stats nothing. With polling,
+// each watcher has a tree of its own, without watches, which is compared
+// against its snapshots periodically instead.
+//
+// Everything here runs on the reactor's thread.
+class TreeWatch : public EventReactor::Handler, public WatchRegistry::Subscriber, public std::enable_shared_from_this<TreeWatch>
+{
+public:
+    // Changes are described with the inotify bits, whether they were read
+    // from inotify or found by comparing a listing against a snapshot:
+    // IN_CREATE, IN_DELETE, and IN_CLOSE_WRITE for a modification.
+    class View
+    {
+    public:
+        virtual ~View() {}
+
+        // Every directory in the tree is watched. Not called for views added
+        // after that.
+        virtual void OnTreeArmed() = 0;
+
+        virtual void OnTreeChange(uint32_t mask, uint32_t node, const char *name, size_t length) = 0;
+
+        // The first half of a rename, which stays a deletion unless the half
+        // with the same cookie follows.
+        virtual void OnTreeMovedFrom(uint32_t cookie, uint32_t node, const char *name, size_t length) = 0;
+        virtual void OnTreeMovedTo(uint32_t cookie, uint32_t node, const char *name, size_t length) = 0;
+
+        // A rename within one directory, found by a resync.
+        virtual void OnTreeRenamed(uint32_t node, const char *oldName, size_t oldLength, const char *name, size_t length) = 0;
+
+        // Events were lost. What they would have said is found afterwards.
+        virtual void OnTreeOverflow() = 0;
+
+        // Directories were moved or removed, so paths built for their nodes
+        // no longer hold, and removed nodes may be reused.
+        virtual void OnTreeReshaped() = 0;
+
+        // Called once everything read in one wakeup, or found by one slice of
+        // a listing or resync, has been handed out, with the number of
+        // records that were read.
+        virtual void OnTreeEventsEnd(size_t records) = 0;
+
+        // The root is gone, or the tree can't be watched any more. Nothing
+        // more comes after this.
+        virtual void OnTreeStopped() = 0;
+    };
+
+    // What decides which directories are in the tree. Views can only share a
+    // tree built with the same options.
+    struct Options
+    {
+        bool subtree;
+        bool symlinks;
+        std::shared_ptr<const PathMatcher> directoryFilter;
+
+        // How often a polled tree is compared against its snapshots.
+        unsigned int pollIntervalMs;
+    };
+
+    struct ViewOptions
+    {
+        // The inotify events the view needs. The tree's watches ask for
+        // those of every view.
+        uint32_t mask;
+
+        // How long the view may hold the first half of a rename.
+        unsigned int moveExpiryMs;
+
+        // What to read events into, as for WatchRegistry::Subscribe().
+        size_t minBufferSize;
+        size_t maxBufferSize;
+    };
+
+    // Finds a tree the registry shares whose root is the directory, or holds
+    // it, and which was built with the same options, or starts one there.
+    // Without a registry, the tree is polled and never shared.
+    static std::shared_ptr<TreeWatch> Acquire(const std::shared_ptr<EventReactor> &reactor, const std::shared_ptr<WatchRegistry> &registry, const std::string &path, const Options &options);
+
+    TreeWatch(const std::shared_ptr<EventReactor> &reactor, const std::shared_ptr<WatchRegistry> &registry, const std::string &rootPath, const Options &options);
+    ~TreeWatch();
+
+    TreeWatch(const TreeWatch &) = delete;
+    TreeWatch &operator=(const TreeWatch &) = delete;
+
+    // Returns the node of the view's directory, or kInvalidNode if the tree
+    // doesn't hold it. Events in the tree are handed to the view from then
+    // on, including those outside its directory.
+    uint32_t AddView(View *view, const std::string &path, const ViewOptions &options);
+    void SetViewMask(View *view, uint32_t mask);
+
+    // The tree stops once its last view is removed.
+    void RemoveView(View *view);
+
+    // Appends the node's path relative to the base, which must be the node
+    // or above it.
+    inline void AppendPath(uint32_t node, uint32_t base, std::string &out) const { tree.AppendPath(node, out, base); }
+    inline bool IsWithin(uint32_t node, uint32_t base) const { return tree.IsWithin(node, base); }
+    inline uint32_t Find(int wd) const { return tree.Find(wd); }
+    inline int GetDescriptor(uint32_t node) const { return tree.GetDescriptor(node); }
+    inline uint32_t GetRoot() const { return tree.GetRoot(); }
+
+    inline bool IsArmed() const { return armed; }
+    inline bool IsStopped() const { return stopped; }
+    inline const std::string &GetRootPath() const { return rootPath; }
+
+    inline size_t GetRegisteredDirectoryCount() const { return registeredDirectories.load(std::memory_order_relaxed); }
+    inline size_t GetPendingDirectoryCount() const { return pendingDirectories.load(std::memory_order_relaxed); }
+
+private:
+    bool Start();
+    void Stop();
+    uint32_t FindDirectory(const std::string &path) const;
+    void UpdateViews();
+    uint32_t AddDirectory(uint32_t parent, const std::string &name, const std::filesystem::path &path, bool report);
+    void RemoveDirectory(uint32_t node);
+    uint32_t GetWatchMask() const;
+    const std::string &GetNodePath(uint32_t node);
+    const std::string &GetChildPath(uint32_t node, const char *name);
+    bool IsDirectoryLink(uint32_t node, const char *name);
+    bool IsExcludedChild(uint32_t node, const char *name, size_t length);
+    DirectorySnapshot &GetSnapshot(uint32_t node);
+    bool IsModified(DirectorySnapshot::Entry &entry, const struct stat &st);
+    void StartResync();
+    void ResyncDirectory(uint32_t node);
+    void ContinuePoll();
+    void SetTimer(int fd, long milliseconds);
+    void ExpireMoves();
+    void EndEvents();
+    virtual void OnReadable(int fd) override;
+    virtual void OnError(int fd, int error) override;
+    virtual bool OnWork() override;
+    virtual void OnWatchEvent(const inotify_event *event) override;
+    virtual void OnWatchEventsEnd() override;
+    virtual void OnWatchError(int error) override;
+
+    // Hands something to every view. Views remove themselves as they go,
+    // so the list is walked from a copy.
+    template <typename F>
+    void ForEachView(F &&callback)
+    {
+        recipients.clear();
+        for (auto it = views.begin(); it != views.end(); it++)
+        {
+            recipients.push_back(it->view);
+        }
+
+        for (size_t i = 0; i < recipients.size(); i++)
+        {
+            if (recipients[i])
+            {
+                callback(recipients[i]);
+            }
+        }
+    }
+
+    std::shared_ptr<EventReactor> reactor;
+    std::shared_ptr<WatchRegistry> registry;
+    const std::string rootPath;
+    const Options options;
+    bool polling;
+    bool started;
+    bool stopped;
+
+    struct ViewEntry
+    {
+        View *view;
+        ViewOptions options;
+    };
+
+    std::vector<ViewEntry> views;
+    std::vector<View *> recipients;
+
+    // What the views ask of the watches between them, how long the first
+    // half of a rename is kept, which is as long as any view keeps it, and
+    // the bounds of the buffer events are read into.
+    uint32_t mask;
+    long moveExpiryMs;
+    size_t minBufferSize;
+    size_t maxBufferSize;
+
+    // Set once every directory has been watched and listed.
+    bool armed;
+    std::atomic<size_t> registeredDirectories;
+    std::atomic<size_t> pendingDirectories;
+
+    // Every directory in the tree, rooted at the root path. With polling,
+    // nodes get ids of their own instead of watch descriptors, which are
+    // never reused.
+    WatchTree tree;
+    std::vector<int> removedDescriptors;
+    std::vector<uint32_t> removedNodes;
+    int nextPollId;
+
+    // Where paths are built, and where they're built to check against the
+    // directory filter.
+    std::string scratchPath;
+    std::string filterPath;
+
+    // A snapshot of each directory, indexed by tree node, kept in step with
+    // the events read. With inotify, that is only the names in it and its
+    // own modification time; files are stat'd by a resync, and never
+    // otherwise. After an overflow, the directories still to be compared
+    // against theirs.
+    std::vector<std::unique_ptr<DirectorySnapshot>> snapshots;
+    std::vector<int> resyncQueue;
+    std::string resyncPath;
+
+    // Wall-clock times, in file time units: up to when every event is
+    // known to have been read, and from when a resync takes files as
+    // modified.
+    int64_t syncedTime;
+    int64_t resyncSince;
+
+    static constexpr long kResyncSlackMs = 1000;
+
+    // Entries a resync found that weren't in the snapshot, held until
+    // those that disappeared have been checked for the same inode.
+    struct NewEntry
+    {
+        std::string name;
+        uint64_t inode;
+        bool isDirectory;
+        bool isLink;
+        bool renamed;
+    };
+
+    std::vector<NewEntry> newEntries;
+
+    // With polling, every directory is resynced each interval. A pass is
+    // spread over slices with gaps between them, which bounds the share of
+    // a core it takes however large the tree is.
+    int pollTimerDescriptor;
+    std::vector<int> pollQueue;
+
+    static constexpr long kPollIntervalMs = 1000;
+    static constexpr long kPollSliceMicroseconds = 2000;
+    static constexpr long kPollSliceGapMs = 20;
+
+    // Directories being moved, by the cookie of the IN_MOVED_FROM that has
+    // yet to be paired with its IN_MOVED_TO. One still unpaired when the
+    // timer fires has left the tree, and its watches go. -1 for entries that
+    // aren't watched directories.
+    FlatHashMap<uint32_t, int> pendingMoves;
+    std::vector<int> expiredDescriptors;
+    int moveTimerDescriptor;
+    bool moveTimerArmed;
+
+    static constexpr long kMoveExpiryMs = 5;
+    static constexpr size_t kMaxPendingMoves = 4096;
+
+    // Records read since the views were last told.
+    size_t records;
+
+    // Directories that are watched but not yet listed. Listing happens
+    // in slices, and a slice may stop partway through a directory.
+    // Subdirectories of one created after the tree was started are
+    // reported as created.
+    struct ScanRequest
+    {
+        int wd;
+        bool report;
+    };
+
+    std::deque<ScanRequest> scanQueue;
+    std::filesystem::directory_iterator scanIterator;
+    int scanDescriptor;
+    bool scanReport;
+
+    // Directories created after the tree was started, by tree node. Anything
+    // reported in one is in its snapshot, so an entry that isn't was
+    // renamed or removed before the directory was watched, and is only
+    // reported under the name it ends up with.
+    std::vector<bool> createdNodes;
+
+    static constexpr long kScanSliceMicroseconds = 2000;
+};
+
+#endif // __linux__
+
+#endif // TREEWATCH_H_
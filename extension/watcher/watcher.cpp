@@ -29,13 +29,21 @@
 
 #include "watcher.h"
 
+#include <algorithm>
+#include <chrono>
 #include <string>
 
 #ifdef __linux__
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/fanotify.h>
 #include <sys/inotify.h>
-#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 #else
 #endif
@@ -44,29 +52,151 @@
 
 namespace fs = std::filesystem;
 
+#ifdef __linux__
+namespace
+{
+    // Filesystems whose contents can change without the local kernel being
+    // told, so inotify stays silent.
+    bool IsRemoteFilesystem(const char *path)
+    {
+        struct statfs fs;
+        if (statfs(path, &fs) == -1)
+        {
+            return false;
+        }
+
+        switch ((uint32_t)fs.f_type)
+        {
+            case 0x6969:     // NFS
+            case 0x517B:     // SMB
+            case 0xFF534D42: // CIFS
+            case 0xFE534D42: // SMB2
+            case 0x65735546: // FUSE
+            case 0x01021997: // 9P
+            case 0x00C36400: // Ceph
+            case 0x6B414653: // AFS
+            case 0x73757245: // Coda
+            case 0x0BD00BD0: // Lustre
+            case 0x01161970: // GFS2
+                return true;
+        }
+
+        return false;
+    }
+}
+#endif
+
 DirectoryWatcher::Worker::Worker(
-    bool isRoot,
+    const std::filesystem::path &root,
     const std::filesystem::path &path,
     const WatchOptions &_options,
-    EventQueue *eventsBuffer,
-    std::mutex *eventsBufferMutex) : isRootWorker(isRoot),
-                                     basePath(path.lexically_normal()),
-                                     eventsBuffer(eventsBuffer),
-                                     eventsBufferMutex(eventsBufferMutex),
-                                     options(_options)
+    DirectoryWatcher *watcher) : isRootWorker(root == path),
+                                 basePath(path.lexically_normal()),
+                                 watcher(watcher),
+                                 rootPath(root.lexically_normal().string()),
+                                 options(_options),
+                                 running(false),
+                                 requestedNotifyFilter(_options.notifyFilterFlags),
+                                 armed(false),
+                                 registeredDirectories(0),
+                                 pendingDirectories(0)
 {
+    if (!isRootWorker)
+    {
+        relativeBase = basePath.lexically_relative(rootPath).string();
+    }
+
+    if (options.verifyContents)
+    {
+        contentVerifier = std::make_unique<ContentVerifier>(options.maxHashedSize ? options.maxHashedSize : kDefaultMaxHashedSize);
+    }
+
 #ifdef __linux__
-    fileDescriptor = inotify_init1(IN_NONBLOCK);
-    cancelEvent = eventfd(0, 0);
+    notifyFilter = options.notifyFilterFlags;
+    timerDescriptor = -1;
+    flushTimerArmed = false;
+    started = false;
+    viewRoot = WatchTree::kInvalidNode;
+    viewDescriptor = -1;
+    polling = false;
+
+    running = true;
+
+    timerDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerDescriptor == -1)
+    {
+        Stop();
+        return;
+    }
+
+    polling = options.backend == kPolling || (options.backend == kAutomatic && IsRemoteFilesystem(basePath.c_str()));
 
-    if (fileDescriptor != -1)
+    // All workers share one reactor thread instead of each polling on their
+    // own, and one inotify instance, so overlapping watchers don't each pay
+    // for the same kernel watches. The subtree is registered on the reactor
+    // thread, a slice at a time, so this returns without walking the
+    // directory tree. Polling workers stat every file they cover, which on
+    // a remote filesystem can block for a long time, so they share a thread
+    // of their own.
+    reactor = polling ? EventReactor::AcquireBlocking() : EventReactor::Acquire();
+
+    if (contentVerifier || options.contentsBudget)
     {
-        AddDirectory(basePath);
+        contentStage.worker = this;
+        contentReactor = EventReactor::AcquireBlocking();
     }
 
-    thread = std::thread(&DirectoryWatcher::Worker::ThreadProc, this);
+    // The tree is listed just as it is for inotify, only without watches,
+    // and belongs to this worker alone.
+    if (polling)
+    {
+        if (!reactor->Register(timerDescriptor, this))
+        {
+            Stop();
+            return;
+        }
+
+        reactor->ScheduleWork(this);
+        return;
+    }
+
+    // A single mark covers the whole tree, so nothing needs to be listed or
+    // watched directory by directory; OnWork() only sends the start event.
+    if (options.backend == kFanotify)
+    {
+        fanotify = std::make_unique<FanotifyWatch>();
+        if (!fanotify->Open(rootPath, options.subtree, options.directoryFilter.get(), GetFanotifyMask(), std::max(options.bufferSize, kMinBufferSize)))
+        {
+            fanotify.reset();
+        }
+    }
+
+    if (fanotify)
+    {
+        if (!reactor->Register(timerDescriptor, this) || !reactor->Register(fanotify->GetDescriptor(), this))
+        {
+            Stop();
+            return;
+        }
+
+        reactor->ScheduleWork(this);
+        return;
+    }
+
+    registry = WatchRegistry::Acquire();
+
+    if (!reactor->Register(timerDescriptor, this))
+    {
+        Stop();
+        return;
+    }
+
+    reactor->ScheduleWork(this);
 
 #else
+    bufferSize = 0;
+    peakBufferSize = 0;
+
     auto actualBasePath = fs::path(basePath);
     if (fs::is_symlink(actualBasePath))
     {
@@ -90,36 +220,9 @@ DirectoryWatcher::Worker::Worker(
 
     cancelEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
 
-    if (options.subtree)
-    {
-        if (options.symlinks)
-        {
-            std::queue<fs::path> dirsToTraverse;
-            dirsToTraverse.push(basePath);
-
-            while (!dirsToTraverse.empty())
-            {
-                fs::path currentDir = dirsToTraverse.front();
-                dirsToTraverse.pop();
-
-                for (const auto &entry : fs::directory_iterator(currentDir))
-                {
-                    if (fs::is_directory(entry))
-                    {
-                        if (fs::is_symlink(entry))
-                        {
-                            workers.push_back(std::make_unique<Worker>(false, fs::path(entry), options, eventsBuffer, eventsBufferMutex));
-                        }
-                        else
-                        {
-                            dirsToTraverse.push(entry);
-                        }
-                    }
-                }
-            }
-        }
-    }
-
+    // Directory links are looked for on the worker thread, so this returns
+    // without walking the directory tree.
+    running = true;
     thread = std::thread(&DirectoryWatcher::Worker::ThreadProc, this);
 #endif
 }
@@ -127,314 +230,958 @@ DirectoryWatcher::Worker::Worker(
 DirectoryWatcher::Worker::~Worker()
 {
 #ifdef __linux__
-#else
-    workers.clear();
-#endif
+    Stop();
 
-#ifdef __linux__
-    uint64_t u = 1;
-    write(cancelEvent, &u, sizeof(u));
+    if (timerDescriptor != -1)
+    {
+        close(timerDescriptor);
+    }
+
+    // A tree is only torn down on the reactor thread, where it runs. The
+    // last watcher out closes the inotify instance, which waits on the
+    // reactor thread, so it can't happen from inside Call().
+    if (reactor)
+    {
+        reactor->Call([this]()
+                      { treeWatch.reset(); });
+    }
+
+    registry.reset();
 #else
     SetEvent(cancelEvent);
-#endif
 
     if (thread.joinable())
     {
         thread.join();
     }
 
-#ifdef __linux__
-    if (fcntl(cancelEvent, F_GETFD) != -1)
+    // The thread adds link workers, so they're only torn down after it exits.
+    workers.clear();
+#endif
+}
+
+void DirectoryWatcher::Worker::PushEvent(NotifyEventType type)
+{
+    if (!isRootWorker)
+    {
+        return;
+    }
+
+    auto batch = watcher->AcquireBatch(rootPath);
+    batch->AddEvent(type, kNone, batch->AddDirectory("", 0), "", 0);
+
+    watcher->QueueEvents(std::move(batch), options);
+}
+
+void DirectoryWatcher::Worker::AddChange(EventBatch &batch, NotifyFilterFlags flags, uint32_t directory, const char *name, size_t length)
+{
+    if (options.coalesceWindowMs)
+    {
+        batch.AddChange(flags, directory, name, length);
+    }
+    else
+    {
+        batch.AddEvent(kFilesystem, flags, directory, name, length);
+    }
+}
+
+void DirectoryWatcher::Worker::VerifyContents(EventBatch &batch)
+{
+    if (!contentVerifier)
     {
-        close(cancelEvent);
+        return;
     }
 
-    if (fcntl(fileDescriptor, F_GETFD) != -1)
+    // Only what is left once the batch has been filtered is hashed.
+    for (auto it = batch.begin(); it != batch.end(); it++)
     {
-        for (auto it = watchDescriptors.begin(); it != watchDescriptors.end(); it++)
+        NotifyEvent &event = *it;
+        if (event.type != kFilesystem || !(event.flags & (kModified | kDeleted)))
         {
-            inotify_rm_watch(fileDescriptor, it->first);
+            continue;
         }
 
-        close(fileDescriptor);
+        contentPath.clear();
+        event.AppendPath(contentPath, event.directory, event.nameOffset, event.nameLength, false);
+
+        if (event.flags & kDeleted)
+        {
+            contentVerifier->Forget(contentPath);
+        }
+        else if (event.flags == kModified && !contentVerifier->HasChanged(contentPath))
+        {
+            // Written without changing a byte. Dropped by the next Filter().
+            event.flags = kNone;
+        }
     }
-#endif
 }
 
-#ifdef __linux__
-int DirectoryWatcher::Worker::AddDirectory(const std::filesystem::path &path)
+void DirectoryWatcher::Worker::CaptureContents(EventBatch &batch)
 {
-    int wd = inotify_add_watch(fileDescriptor, path.string().c_str(), IN_CREATE | IN_MOVE | IN_DELETE | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
-    if (wd != -1)
+    if (!options.contentsBudget)
     {
-        watchDescriptors.insert_or_assign(wd, fs::path(path));
+        return;
+    }
 
-        if (options.subtree)
+    // Only once the batch is due, so a file changed repeatedly within the
+    // coalescing window is read once, as it ended up.
+    for (auto it = batch.begin(); it != batch.end(); it++)
+    {
+        NotifyEvent &event = *it;
+        if (event.type != kFilesystem || !(event.flags & (kCreated | kModified)))
         {
-            for (const auto &entry : fs::directory_iterator(path, fs::directory_options::skip_permission_denied))
-            {
-                if (entry.is_directory())
-                {
-                    if (!options.symlinks && entry.is_symlink())
-                    {
-                        continue;
-                    }
+            continue;
+        }
 
-                    AddDirectory(entry);
-                }
-            }
+        contentPath.clear();
+        event.AppendPath(contentPath, event.directory, event.nameOffset, event.nameLength, false);
+
+        auto contents = FileContents::Read(contentPath, watcher->contentBudget, options.maxContentsSize ? options.maxContentsSize : kDefaultMaxContentsSize);
+        if (contents)
+        {
+            batch.AttachContents(event, std::move(contents));
         }
     }
+}
+
+void DirectoryWatcher::Worker::SendBatch(std::unique_ptr<EventBatch> &&batch)
+{
+    if (contentVerifier)
+    {
+        VerifyContents(*batch);
+        watcher->eventsFiltered.fetch_add(batch->Filter(kNotifyAll, nullptr), std::memory_order_relaxed);
+    }
 
-    return wd;
+    if (batch->IsEmpty())
+    {
+        watcher->ReleaseBatch(std::move(batch));
+        return;
+    }
+
+    CaptureContents(*batch);
+    watcher->QueueEvents(std::move(batch), options);
 }
-#endif
 
-void DirectoryWatcher::Worker::ThreadProc()
+bool DirectoryWatcher::Worker::IsExcludedDirectory(const char *path, size_t length) const
 {
+    return options.directoryFilter && !options.directoryFilter->IsAccepted(path, length);
+}
+
 #ifdef __linux__
-    auto buffer = std::make_unique<char[]>(options.bufferSize);
+uint32_t DirectoryWatcher::Worker::GetWatchMask() const
+{
+    // What the tree needs to keep itself watched is added by the tree.
+    uint32_t mask = 0;
 
-    pollfd fds[2];
+    if (notifyFilter & kCreated)
+    {
+        mask |= IN_CREATE | IN_MOVED_TO;
+    }
 
-    fds[0].fd = fileDescriptor;
-    fds[0].events = POLLIN;
+    if (notifyFilter & kDeleted)
+    {
+        mask |= IN_DELETE | IN_MOVED_FROM;
+    }
 
-    fds[1].fd = cancelEvent;
-    fds[1].events = POLLIN;
+    if (notifyFilter & kModified)
+    {
+        mask |= IN_CLOSE_WRITE;
+    }
 
-#else
-    auto buffer = std::make_unique<char[]>(options.bufferSize);
-    ScopedHandle watchEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+    // Either half of a move needs the other, or a rename inside the tree
+    // would look like a file coming or going.
+    if ((mask & IN_MOVE) || (notifyFilter & kRenamed))
+    {
+        mask |= IN_MOVE;
+    }
 
-    HANDLE waitHandles[2];
-    waitHandles[0] = cancelEvent;
-    waitHandles[1] = watchEvent;
+    return mask;
+}
 
-    OVERLAPPED overlapped;
-    ZeroMemory(&overlapped, sizeof overlapped);
-    overlapped.hEvent = watchEvent;
-#endif
+uint64_t DirectoryWatcher::Worker::GetFanotifyMask() const
+{
+    // Directories are reported like any other entry.
+    uint64_t mask = FAN_ONDIR;
 
-    if (isRootWorker)
+    if (notifyFilter & kCreated)
     {
-        std::lock_guard<std::mutex> lock(*eventsBufferMutex);
+        mask |= FAN_CREATE;
+    }
 
-        auto change = std::make_unique<NotifyEvent>();
-        change->type = kStart;
-        change->path = basePath.string();
+    if (notifyFilter & kDeleted)
+    {
+        mask |= FAN_DELETE;
+    }
 
-        eventsBuffer->push(std::move(change));
+    if (notifyFilter & kModified)
+    {
+        mask |= FAN_CLOSE_WRITE;
     }
 
-#ifdef __linux__
-    while (poll(fds, 2, -1) >= 0)
+    // A rename across the edge of the tree is a creation or deletion.
+    if (notifyFilter & (kCreated | kDeleted | kRenamed))
+    {
+        mask |= FAN_RENAME;
+    }
+
+    return mask;
+}
+
+std::chrono::microseconds DirectoryWatcher::Worker::GetCpuTime() const
+{
+    return reactor ? reactor->GetCpuTime() : std::chrono::microseconds(0);
+}
+
+void DirectoryWatcher::Worker::SetNotifyFilter(NotifyFilterFlags flags)
+{
+    requestedNotifyFilter.store(flags, std::memory_order_relaxed);
+
+    // Applied on the reactor thread, which owns the watch tree.
+    if (reactor && running)
     {
-        if (fds[0].revents & POLLERR || fds[1].revents & POLLERR)
+        reactor->ScheduleWork(this);
+    }
+}
+
+void DirectoryWatcher::Worker::ApplyNotifyFilter()
+{
+    NotifyFilterFlags flags = (NotifyFilterFlags)requestedNotifyFilter.load(std::memory_order_relaxed);
+    if (flags == notifyFilter)
+    {
+        return;
+    }
+
+    notifyFilter = flags;
+
+    if (fanotify)
+    {
+        fanotify->SetMask(GetFanotifyMask());
+        return;
+    }
+
+    // What the watches ask for is worked out across every view of the tree.
+    // What other watchers asked for on the same directories is kept.
+    if (treeWatch)
+    {
+        treeWatch->SetViewMask(this, GetWatchMask());
+    }
+}
+
+bool DirectoryWatcher::Worker::OnWork()
+{
+    if (!started)
+    {
+        started = true;
+
+        if (fanotify)
         {
-            break;
+            armed = true;
+            PushEvent(kStart);
+        }
+        else if (!StartTree())
+        {
+            Stop();
+            return false;
+        }
+    }
+
+    ApplyNotifyFilter();
+
+    // Events raised while the tree was registering were held back until now.
+    ScheduleFlush();
+    return false;
+}
+
+bool DirectoryWatcher::Worker::StartTree()
+{
+    TreeWatch::Options treeOptions;
+    treeOptions.subtree = options.subtree;
+    treeOptions.symlinks = options.symlinks;
+    treeOptions.directoryFilter = options.directoryFilter;
+    treeOptions.pollIntervalMs = options.pollIntervalMs;
+
+    // Room for at least one event with the longest possible name. The first
+    // half of a rename is held as long as the batch may be.
+    TreeWatch::ViewOptions viewOptions;
+    viewOptions.mask = GetWatchMask();
+    viewOptions.moveExpiryMs = std::max((unsigned int)kMoveExpiryMs, options.coalesceWindowMs);
+    viewOptions.minBufferSize = std::max(std::min(options.bufferSize, kMinBufferSize), sizeof(inotify_event) + NAME_MAX + 1);
+    viewOptions.maxBufferSize = options.maxBufferSize ? options.maxBufferSize : std::max(options.bufferSize, kMaxBufferSize);
+    viewOptions.maxBufferSize = std::max(viewOptions.maxBufferSize, viewOptions.minBufferSize);
+
+    // Without the registry, as when polling, the tree is this worker's own.
+    treeWatch = TreeWatch::Acquire(reactor, registry, rootPath, treeOptions);
+    viewRoot = treeWatch->AddView(this, rootPath, viewOptions);
+    if (viewRoot == WatchTree::kInvalidNode)
+    {
+        return false;
+    }
+
+    viewDescriptor = treeWatch->GetDescriptor(viewRoot);
+    viewPath.clear();
+    treeWatch->AppendPath(viewRoot, treeWatch->GetRoot(), viewPath);
+
+    // A tree that was already listed has nothing left to wait for.
+    if (treeWatch->IsArmed())
+    {
+        OnTreeArmed();
+    }
+
+    return true;
+}
+
+bool DirectoryWatcher::Worker::IsInView(uint32_t node) const
+{
+    // A shared tree may be rooted above the watched directory.
+    return running && treeWatch->IsWithin(node, viewRoot);
+}
+
+void DirectoryWatcher::Worker::OnTreeArmed()
+{
+    armed = true;
+    registeredDirectories.store(treeWatch->GetRegisteredDirectoryCount(), std::memory_order_relaxed);
+    pendingDirectories.store(0, std::memory_order_relaxed);
+    PushEvent(kStart);
+}
+
+void DirectoryWatcher::Worker::OnTreeChange(uint32_t mask, uint32_t node, const char *name, size_t length)
+{
+    // The tree watches for what every view asks for between them.
+    if (!IsInView(node) || (mask == IN_CLOSE_WRITE && !(notifyFilter & kModified)))
+    {
+        return;
+    }
+
+    NotifyFilterFlags flags = mask == IN_CREATE ? kCreated : mask == IN_DELETE ? kDeleted : kModified;
+
+    // A batch with unpaired moves stays open across wakeups until their
+    // other halves arrive or the flush timer fires. It is also held open
+    // while the tree is still being registered.
+    EventBatch &batch = GetOpenBatch();
+    AddChange(batch, flags, GetBatchDirectory(batch, node), name, length);
+}
+
+void DirectoryWatcher::Worker::OnTreeMovedFrom(uint32_t cookie, uint32_t node, const char *name, size_t length)
+{
+    if (!IsInView(node))
+    {
+        return;
+    }
+
+    // Stays a deletion unless the matching IN_MOVED_TO shows up, so it's
+    // never folded away.
+    EventBatch &batch = GetOpenBatch();
+    uint32_t directory = GetBatchDirectory(batch, node);
+    batch.AddEvent(kFilesystem, kDeleted, directory, name, length);
+    batch.BreakChanges(directory, name, length);
+
+    if (pendingMoves.GetSize() < kMaxPendingMoves)
+    {
+        pendingMoves.Insert(cookie, (uint32_t)(batch.GetSize() - 1));
+    }
+}
+
+void DirectoryWatcher::Worker::OnTreeMovedTo(uint32_t cookie, uint32_t node, const char *name, size_t length)
+{
+    if (!IsInView(node))
+    {
+        return;
+    }
+
+    EventBatch &batch = GetOpenBatch();
+    uint32_t directory = GetBatchDirectory(batch, node);
+
+    // Moved in from outside the view, or its first half was already sent.
+    uint32_t *move = pendingMoves.Find(cookie);
+    if (!move)
+    {
+        AddChange(batch, kCreated, directory, name, length);
+        return;
+    }
+
+    auto &change = batch.GetEvent(*move);
+    change.flags = kRenamed;
+    batch.SetRenamed(change, directory, name, length);
+    batch.BreakChanges(directory, name, length);
+
+    pendingMoves.Erase(cookie);
+}
+
+void DirectoryWatcher::Worker::OnTreeRenamed(uint32_t node, const char *oldName, size_t oldLength, const char *name, size_t length)
+{
+    if (!IsInView(node))
+    {
+        return;
+    }
+
+    EventBatch &batch = GetOpenBatch();
+    uint32_t directory = GetBatchDirectory(batch, node);
+
+    auto &change = batch.AddEvent(kFilesystem, kRenamed, directory, oldName, oldLength);
+    batch.SetRenamed(change, directory, name, length);
+    batch.BreakChanges(directory, oldName, oldLength);
+    batch.BreakChanges(directory, name, length);
+}
+
+void DirectoryWatcher::Worker::OnTreeOverflow()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    EventBatch &batch = GetOpenBatch();
+    batch.AddEvent(kOverflow, kNone, GetBatchDirectory(batch, viewRoot), "", 0);
+}
+
+void DirectoryWatcher::Worker::OnTreeReshaped()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    // Cached directory paths may belong to nodes that moved or were removed.
+    batchDirectories.clear();
+    registeredDirectories.store(treeWatch->GetRegisteredDirectoryCount(), std::memory_order_relaxed);
+
+    // The watched directory is gone, or it was moved within a tree rooted
+    // above it, which for this watcher is the same.
+    viewRoot = treeWatch->Find(viewDescriptor);
+    if (viewRoot != WatchTree::kInvalidNode)
+    {
+        scratchPath.clear();
+        treeWatch->AppendPath(viewRoot, treeWatch->GetRoot(), scratchPath);
+
+        if (scratchPath == viewPath)
+        {
+            return;
         }
+    }
+
+    Stop();
+}
+
+void DirectoryWatcher::Worker::OnTreeEventsEnd(size_t records)
+{
+    if (!running)
+    {
+        return;
+    }
+
+    watcher->recordsRead.fetch_add(records, std::memory_order_relaxed);
+    registeredDirectories.store(treeWatch->GetRegisteredDirectoryCount(), std::memory_order_relaxed);
+    pendingDirectories.store(treeWatch->GetPendingDirectoryCount(), std::memory_order_relaxed);
 
-        if (fds[1].revents & POLLIN)
+    ScheduleFlush();
+}
+
+void DirectoryWatcher::Worker::OnTreeStopped()
+{
+    Stop();
+}
+
+uint32_t DirectoryWatcher::Worker::GetBatchDirectory(EventBatch &batch, uint32_t node)
+{
+    // A batch rarely spans more than a handful of directories.
+    for (auto it = batchDirectories.begin(); it != batchDirectories.end(); it++)
+    {
+        if (it->first == node)
         {
-            break;
+            return it->second;
         }
+    }
+
+    // With fanotify, the node is a directory it resolved.
+    scratchPath.clear();
+    if (fanotify)
+    {
+        scratchPath.assign(fanotify->GetPath(node));
+    }
+    else
+    {
+        treeWatch->AppendPath(node, viewRoot, scratchPath);
+    }
+
+    uint32_t directory = batch.AddDirectory(scratchPath.data(), scratchPath.size());
+    batchDirectories.emplace_back(node, directory);
+
+    return directory;
+}
+
+DirectoryWatcher::EventBatch &DirectoryWatcher::Worker::GetOpenBatch()
+{
+    if (!openBatch)
+    {
+        openBatch = watcher->AcquireBatch(rootPath);
+        batchDirectories.clear();
+    }
+
+    return *openBatch;
+}
+
+void DirectoryWatcher::Worker::Stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+
+    // Torn down on the reactor thread, between calls to handlers, so that
+    // once it is done nothing calls into this worker and no event is being
+    // handed to it.
+    if (reactor)
+    {
+        reactor->Call([this]()
+                      {
+                          if (treeWatch)
+                          {
+                              treeWatch->RemoveView(this);
+                          }
+
+                          if (fanotify)
+                          {
+                              reactor->Unregister(fanotify->GetDescriptor());
+                          }
+
+                          reactor->Unregister(timerDescriptor);
+                          reactor->CancelWork(this);
+                      });
+    }
 
-        if (fds[0].revents & POLLIN)
+    // The reactor can no longer call in, so anything held back for pairing
+    // is safe to flush from here, and it has to go out before the stop event.
+    // Events buffered by a watch that never finished registering are dropped.
+    FlushBatch();
+
+    if (openBatch)
+    {
+        watcher->ReleaseBatch(std::move(openBatch));
+    }
+
+    // Batches still being finished go out ahead of the stop event too.
+    if (contentReactor)
+    {
+        contentReactor->Call([this]()
+                             {
+                                 contentReactor->CancelWork(&contentStage);
+                                 while (FinishContents())
+                                 {
+                                 }
+                             });
+    }
+
+    PushEvent(kStop);
+}
+
+void DirectoryWatcher::Worker::SetFlushTimer(long milliseconds)
+{
+    // Once armed, the timer isn't pushed back by later events, so a steady
+    // stream of changes can't hold the batch forever.
+    if ((milliseconds != 0) == flushTimerArmed)
+    {
+        return;
+    }
+
+    itimerspec spec = {};
+    spec.it_value.tv_sec = milliseconds / 1000;
+    spec.it_value.tv_nsec = (milliseconds % 1000) * 1000000L;
+
+    timerfd_settime(timerDescriptor, 0, &spec, nullptr);
+    flushTimerArmed = milliseconds != 0;
+}
+
+void DirectoryWatcher::Worker::ScheduleFlush()
+{
+    if (!openBatch)
+    {
+        return;
+    }
+
+    long delay = pendingMoves.IsEmpty() ? 0 : kMoveExpiryMs;
+    if (!openBatch->IsEmpty())
+    {
+        delay = std::max(delay, (long)options.coalesceWindowMs);
+    }
+
+    if (delay == 0 || openBatch->IsOversized())
+    {
+        FlushBatch();
+    }
+    else
+    {
+        SetFlushTimer(delay);
+    }
+}
+
+void DirectoryWatcher::Worker::FlushBatch()
+{
+    // Halves still waiting for a partner are left as deletions. The tree
+    // drops the watches of a directory among them.
+    pendingMoves.Clear();
+
+    SetFlushTimer(0);
+
+    // Nothing is sent ahead of the start event.
+    if (!openBatch || !armed)
+    {
+        return;
+    }
+
+    auto batch = std::move(openBatch);
+    watcher->eventsFiltered.fetch_add(batch->Filter(notifyFilter, options.pathMatcher.get()), std::memory_order_relaxed);
+
+    if (batch->IsEmpty() || !contentReactor)
+    {
+        SendBatch(std::move(batch));
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(contentMutex);
+        contentBatches.push_back(std::move(batch));
+    }
+
+    contentReactor->ScheduleWork(&contentStage);
+}
+
+bool DirectoryWatcher::Worker::FinishContents()
+{
+    std::unique_ptr<EventBatch> batch;
+
+    {
+        std::lock_guard<std::mutex> lock(contentMutex);
+        if (contentBatches.empty())
         {
-            std::vector<std::unique_ptr<NotifyEvent>> queuedEvents;
+            return false;
+        }
 
-            for (;;)
+        batch = std::move(contentBatches.front());
+        contentBatches.pop_front();
+    }
+
+    // One batch at a time, so polling handlers on the same thread get a turn.
+    SendBatch(std::move(batch));
+
+    std::lock_guard<std::mutex> lock(contentMutex);
+    return !contentBatches.empty();
+}
+
+void DirectoryWatcher::Worker::OnReadable(int fd)
+{
+    if (fanotify && fd == fanotify->GetDescriptor())
+    {
+        ReadFanotify();
+        return;
+    }
+
+    // Otherwise it's the flush timer; inotify is read by the registry. A
+    // rearm or flush since the timer fired resets its count, which makes
+    // this read fail.
+    uint64_t expirations;
+    if (read(timerDescriptor, &expirations, sizeof(expirations)) == sizeof(expirations))
+    {
+        FlushBatch();
+    }
+}
+
+void DirectoryWatcher::Worker::OnError(int fd, int error)
+{
+    // A timer or fanotify descriptor that can't be read any more leaves the
+    // watch blind, which the plugin is told through the stop event.
+    Stop();
+}
+
+void DirectoryWatcher::Worker::ReadFanotify()
+{
+    if (!fanotify->Read(fanotifyEvents))
+    {
+        Stop();
+        return;
+    }
+
+    if (fanotifyEvents.empty())
+    {
+        return;
+    }
+
+    watcher->recordsRead.fetch_add(fanotifyEvents.size(), std::memory_order_relaxed);
+
+    EventBatch &batch = GetOpenBatch();
+
+    // The directories resolved in earlier reads are gone.
+    batchDirectories.clear();
+
+    for (auto it = fanotifyEvents.begin(); it != fanotifyEvents.end(); it++)
+    {
+        const FanotifyWatch::Event &event = *it;
+
+        // There are no snapshots to find what was missed with.
+        if (event.mask & FAN_Q_OVERFLOW)
+        {
+            batch.AddEvent(kOverflow, kNone, batch.AddDirectory("", 0), "", 0);
+            continue;
+        }
+
+        const char *name = fanotify->GetName(event.nameOffset);
+        uint32_t directory = event.directory != FanotifyWatch::kOutside ? GetBatchDirectory(batch, event.directory) : 0;
+
+        // Both ends of a rename come in one event. An end outside the tree
+        // makes it a file arriving or leaving.
+        if (event.mask & FAN_RENAME)
+        {
+            if (event.oldDirectory == FanotifyWatch::kOutside)
             {
-                ssize_t len = read(fileDescriptor, buffer.get(), options.bufferSize);
+                AddChange(batch, kCreated, directory, name, event.nameLength);
+                continue;
+            }
 
-                if (len == -1 && errno != EAGAIN)
+            const char *oldName = fanotify->GetName(event.oldNameOffset);
+            uint32_t oldDirectory = GetBatchDirectory(batch, event.oldDirectory);
+
+            batch.AddEvent(kFilesystem, kDeleted, oldDirectory, oldName, event.oldNameLength);
+            batch.BreakChanges(oldDirectory, oldName, event.oldNameLength);
+
+            if (event.directory != FanotifyWatch::kOutside)
+            {
+                auto &change = batch.GetEvent(batch.GetSize() - 1);
+                change.flags = kRenamed;
+                batch.SetRenamed(change, directory, name, event.nameLength);
+                batch.BreakChanges(directory, name, event.nameLength);
+            }
+
+            continue;
+        }
+
+        if (event.directory == FanotifyWatch::kOutside)
+        {
+            continue;
+        }
+
+        // The kernel merges back-to-back events on the same file.
+        if (event.mask & FAN_CREATE)
+        {
+            AddChange(batch, kCreated, directory, name, event.nameLength);
+        }
+
+        if (event.mask & FAN_CLOSE_WRITE)
+        {
+            AddChange(batch, kModified, directory, name, event.nameLength);
+        }
+
+        if (event.mask & FAN_DELETE)
+        {
+            AddChange(batch, kDeleted, directory, name, event.nameLength);
+        }
+    }
+
+    ScheduleFlush();
+}
+#else
+void DirectoryWatcher::Worker::AddDirectoryLinks()
+{
+    if (!options.subtree || !options.symlinks)
+    {
+        return;
+    }
+
+    std::queue<fs::path> dirsToTraverse;
+    dirsToTraverse.push(basePath);
+
+    while (!dirsToTraverse.empty() && running)
+    {
+        fs::path currentDir = dirsToTraverse.front();
+        dirsToTraverse.pop();
+
+        pendingDirectories = dirsToTraverse.size() + 1;
+
+        std::error_code ec;
+        for (const auto &entry : fs::directory_iterator(currentDir, fs::directory_options::skip_permission_denied, ec))
+        {
+            if (entry.is_directory(ec))
+            {
+                filterPath = fs::path(entry).lexically_relative(rootPath).string();
+                if (IsExcludedDirectory(filterPath.data(), filterPath.size()))
                 {
-                    goto end_event_loop;
+                    continue;
                 }
 
-                if (len <= 0)
+                if (entry.is_symlink(ec))
                 {
-                    break;
+                    workers.push_back(std::make_unique<Worker>(fs::path(rootPath), fs::path(entry), options, watcher));
                 }
-
-                const inotify_event *event;
-                for (char *p = buffer.get(); p < buffer.get() + len; p += sizeof(inotify_event) + event->len)
+                else
                 {
-                    event = (const inotify_event *)p;
+                    dirsToTraverse.push(entry);
+                }
+            }
+        }
+    }
 
-                    if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
-                    {
-                        auto it = watchDescriptors.find(event->wd);
-                        if (it != watchDescriptors.end())
-                        {
-                            fs::path watchPath(it->second);
+    pendingDirectories = 0;
+}
 
-                            for (auto jt = watchDescriptors.begin(); jt != watchDescriptors.end();)
-                            {
-                                if (jt->first == event->wd || IsSubPath(watchPath, jt->second))
-                                {
-                                    inotify_rm_watch(fileDescriptor, jt->first);
-                                    jt = watchDescriptors.erase(jt);
-                                }
-
-                                if (jt != watchDescriptors.end())
-                                {
-                                    jt++;
-                                }
-                            }
-                        }
+bool DirectoryWatcher::Worker::IsInExcludedDirectory(const std::string &name)
+{
+    if (!options.directoryFilter)
+    {
+        return false;
+    }
 
-                        continue;
-                    }
+    // The whole subtree is watched by one handle, so changes below an
+    // excluded directory can only be dropped, not avoided.
+    filterPath.assign(relativeBase);
+    if (!filterPath.empty())
+    {
+        filterPath += '\\';
+    }
 
-                    if (event->mask & IN_IGNORED)
-                    {
-                        continue;
-                    }
+    size_t start = filterPath.size();
+    filterPath += name;
 
-                    auto &baseRelPath = watchDescriptors.at(event->wd);
+    for (size_t i = start; i < filterPath.size(); i++)
+    {
+        if (filterPath[i] == '\\' && IsExcludedDirectory(filterPath.data(), i))
+        {
+            return true;
+        }
+    }
 
-                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
-                    {
-                        if (options.subtree)
-                        {
-                            fs::path relPath = baseRelPath / event->name;
+    return false;
+}
 
-                            if ((event->mask & IN_ISDIR) ||
-                                (options.symlinks && fs::is_symlink(relPath) && fs::is_directory(relPath)))
-                            {
-                                AddDirectory(relPath);
-                            }
-                        }
+DWORD DirectoryWatcher::Worker::GetChangeFilter(NotifyFilterFlags flags) const
+{
+    DWORD filter = 0;
 
-                        if (event->mask & IN_MOVED_TO)
-                        {
-                            bool foundRenamedEvent = false;
+    // Name changes are also how directory links come and go.
+    if ((flags & (kCreated | kDeleted | kRenamed)) || (options.subtree && options.symlinks))
+    {
+        filter |= FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME;
+    }
 
-                            for (auto it = queuedEvents.rbegin(); it != queuedEvents.rend(); it++)
-                            {
-                                auto &change = *it;
-                                if (change->cookie == event->cookie)
-                                {
-                                    change->flags = kRenamed;
-                                    change->cookie = 0;
-                                    change->lastPath = change->path;
-                                    change->path = baseRelPath / event->name;
-
-                                    foundRenamedEvent = true;
-                                    break;
-                                }
-                            }
+    if (flags & kModified)
+    {
+        filter |= FILE_NOTIFY_CHANGE_LAST_WRITE;
+    }
 
-                            if (foundRenamedEvent)
-                            {
-                                continue;
-                            }
-                        }
+    // The filter can't be empty.
+    return filter ? filter : FILE_NOTIFY_CHANGE_DIR_NAME;
+}
 
-                        std::unique_ptr<NotifyEvent> change = std::make_unique<NotifyEvent>();
-                        change->type = kFilesystem;
-                        change->flags = kCreated;
-                        change->cookie = event->cookie;
-                        change->path = baseRelPath / event->name;
+std::chrono::microseconds DirectoryWatcher::Worker::GetCpuTime() const
+{
+    std::chrono::microseconds cpuTime(0);
 
-                        queuedEvents.push_back(std::move(change));
-                    }
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (GetThreadTimes(const_cast<std::thread &>(thread).native_handle(), &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+        // In 100 nanosecond units.
+        uint64_t kernel = ((uint64_t)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+        uint64_t user = ((uint64_t)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+        cpuTime = std::chrono::microseconds((kernel + user) / 10);
+    }
 
-                    if (event->mask & (IN_DELETE | IN_MOVED_FROM))
-                    {
-                        if (event->mask & IN_MOVED_FROM)
-                        {
-                            bool foundRenamedEvent = false;
+    for (auto it = workers.begin(); it != workers.end(); it++)
+    {
+        cpuTime += (*it)->GetCpuTime();
+    }
 
-                            for (auto it = queuedEvents.rbegin(); it != queuedEvents.rend(); it++)
-                            {
-                                auto &change = *it;
-                                if (change->cookie == event->cookie)
-                                {
-                                    change->flags = kRenamed;
-                                    change->cookie = 0;
-                                    change->lastPath = change->path;
-                                    change->path = baseRelPath / event->name;
-
-                                    foundRenamedEvent = true;
-                                    break;
-                                }
-                            }
+    return cpuTime;
+}
 
-                            if (foundRenamedEvent)
-                            {
-                                continue;
-                            }
-                        }
+void DirectoryWatcher::Worker::SetNotifyFilter(NotifyFilterFlags flags)
+{
+    requestedNotifyFilter.store(flags, std::memory_order_relaxed);
+}
+
+void DirectoryWatcher::Worker::ThreadProc()
+{
+    auto buffer = std::make_unique<char[]>(options.bufferSize);
+    bufferSize = options.bufferSize;
+    peakBufferSize = options.bufferSize;
+    ScopedHandle watchEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr));
 
-                        std::unique_ptr<NotifyEvent> change = std::make_unique<NotifyEvent>();
-                        change->type = kFilesystem;
-                        change->flags = kDeleted;
-                        change->cookie = event->cookie;
-                        change->path = baseRelPath / event->name;
+    HANDLE waitHandles[2];
+    waitHandles[0] = cancelEvent;
+    waitHandles[1] = watchEvent;
 
-                        queuedEvents.push_back(std::move(change));
-                    }
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof overlapped);
+    overlapped.hEvent = watchEvent;
 
-                    if (event->mask & IN_CLOSE_WRITE)
-                    {
-                        std::unique_ptr<NotifyEvent> change = std::make_unique<NotifyEvent>();
-                        change->type = kFilesystem;
-                        change->flags = kModified;
-                        change->cookie = event->cookie;
-                        change->path = baseRelPath / event->name;
+    NotifyFilterFlags notifyFilter = options.notifyFilterFlags;
 
-                        queuedEvents.push_back(std::move(change));
-                    }
-                }
-            }
+    // With a coalescing window, the batch stays open across reads until the
+    // window closes. A read may still be outstanding when it does.
+    std::unique_ptr<EventBatch> batch;
+    uint32_t baseDirectory = 0;
+    auto batchDeadline = std::chrono::steady_clock::now();
+    bool reading = false;
 
-            std::lock_guard<std::mutex> lock(*eventsBufferMutex);
+    while (running)
+    {
+        // A new filter takes effect from the next read.
+        NotifyFilterFlags requested = (NotifyFilterFlags)requestedNotifyFilter.load(std::memory_order_relaxed);
+        if (requested != notifyFilter)
+        {
+            notifyFilter = requested;
 
-            for (auto it = queuedEvents.begin(); it != queuedEvents.end(); it++)
+            for (auto it = workers.begin(); it != workers.end(); it++)
             {
-                auto &change = *it;
-                if (change->flags & options.notifyFilterFlags)
-                {
-                    eventsBuffer->push(std::move(*it));
-                }
+                (*it)->SetNotifyFilter(notifyFilter);
             }
+        }
 
-            if (watchDescriptors.size() == 0)
+        if (!reading)
+        {
+            if (!ReadDirectoryChangesExW(
+                    directory,
+                    buffer.get(),
+                    options.bufferSize,
+                    options.subtree,
+                    GetChangeFilter(notifyFilter),
+                    nullptr,
+                    &overlapped,
+                    nullptr,
+                    ReadDirectoryNotifyExtendedInformation))
             {
+                running = false;
                 break;
             }
+
+            reading = true;
         }
-    }
 
-end_event_loop:
+        // Changes are being collected from here on, so directory links found
+        // now can't be missed. The system buffers changes meanwhile.
+        if (!armed)
+        {
+            AddDirectoryLinks();
 
-#else
-    bool running = true;
+            armed = true;
+            registeredDirectories = 1 + workers.size();
+            PushEvent(kStart);
+        }
 
-    while (running)
-    {
-        if (!ReadDirectoryChangesExW(
-                directory,
-                buffer.get(),
-                options.bufferSize,
-                options.subtree,
-                FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
-                nullptr,
-                &overlapped,
-                nullptr,
-                ReadDirectoryNotifyExtendedInformation))
+        DWORD timeout = INFINITE;
+        if (batch)
         {
-            running = false;
-            break;
+            auto now = std::chrono::steady_clock::now();
+            timeout = now < batchDeadline ? (DWORD)std::chrono::ceil<std::chrono::milliseconds>(batchDeadline - now).count() : 0;
         }
 
-        switch (WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE))
+        switch (WaitForMultipleObjects(2, waitHandles, FALSE, timeout))
+        {
+        case WAIT_TIMEOUT:
         {
+            FlushBatch(batch, notifyFilter);
+            break;
+        }
         case WAIT_OBJECT_0 + 1:
         {
+            reading = false;
+
             DWORD dwBytes = 0;
             if (!GetOverlappedResult(directory, &overlapped, &dwBytes, TRUE))
             {
@@ -444,46 +1191,56 @@ end_event_loop:
 
             ResetEvent(watchEvent);
 
+            // The buffer overflowed and the changes in it were lost.
             if (dwBytes == 0)
             {
+                FlushBatch(batch, notifyFilter);
+
+                auto overflow = watcher->AcquireBatch(rootPath);
+                overflow->AddEvent(kOverflow, kNone, overflow->AddDirectory(relativeBase.data(), relativeBase.size()), "", 0);
+                watcher->QueueEvents(std::move(overflow), options);
                 break;
             }
 
-            std::vector<std::unique_ptr<NotifyEvent>> queuedEvents;
+            if (!batch)
+            {
+                batch = watcher->AcquireBatch(rootPath);
+                baseDirectory = batch->AddDirectory(relativeBase.data(), relativeBase.size());
+                batchDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.coalesceWindowMs);
+            }
+
+            fs::path renamedPath;
 
             char *p = buffer.get();
             for (;;)
             {
                 FILE_NOTIFY_EXTENDED_INFORMATION *info = reinterpret_cast<FILE_NOTIFY_EXTENDED_INFORMATION *>(p);
+                watcher->recordsRead.fetch_add(1, std::memory_order_relaxed);
+
                 std::wstring fileName(info->FileName, info->FileNameLength / sizeof(wchar_t));
+                std::string name = fs::path(fileName).string();
                 fs::path path = basePath / fileName;
 
-                switch (info->Action)
+                bool excluded = info->Action != FILE_ACTION_RENAMED_OLD_NAME &&
+                                info->Action != FILE_ACTION_RENAMED_NEW_NAME &&
+                                IsInExcludedDirectory(name);
+
+                switch (excluded ? 0 : info->Action)
                 {
                 case FILE_ACTION_ADDED:
                 {
-                    auto change = std::make_unique<NotifyEvent>();
-                    change->type = kFilesystem;
-                    change->flags = kCreated;
-                    change->path = path.string();
-
-                    queuedEvents.push_back(std::move(change));
+                    AddChange(*batch, kCreated, baseDirectory, name.data(), name.size());
 
                     if (options.subtree && options.symlinks && fs::is_symlink(path) && fs::is_directory(path))
                     {
-                        workers.push_back(std::make_unique<Worker>(false, path, options, eventsBuffer, eventsBufferMutex));
+                        workers.push_back(std::make_unique<Worker>(fs::path(rootPath), path, options, watcher));
                     }
 
                     break;
                 }
                 case FILE_ACTION_REMOVED:
                 {
-                    auto change = std::make_unique<NotifyEvent>();
-                    change->type = kFilesystem;
-                    change->flags = kDeleted;
-                    change->path = path.string();
-
-                    queuedEvents.push_back(std::move(change));
+                    AddChange(*batch, kDeleted, baseDirectory, name.data(), name.size());
 
                     if (options.subtree)
                     {
@@ -507,30 +1264,22 @@ end_event_loop:
                         break;
                     }
 
-                    auto change = std::make_unique<NotifyEvent>();
-                    change->type = kFilesystem;
-                    change->flags = kModified;
-                    change->path = path.string();
-
-                    queuedEvents.push_back(std::move(change));
+                    AddChange(*batch, kModified, baseDirectory, name.data(), name.size());
 
                     break;
                 }
                 case FILE_ACTION_RENAMED_OLD_NAME:
                 {
-                    auto change = std::make_unique<NotifyEvent>();
-                    change->type = kFilesystem;
-                    change->flags = kRenamed;
-                    change->lastPath = path.string();
-
-                    queuedEvents.push_back(std::move(change));
+                    batch->AddEvent(kFilesystem, kRenamed, baseDirectory, name.data(), name.size());
+                    batch->BreakChanges(baseDirectory, name.data(), name.size());
+                    renamedPath = path;
 
                     break;
                 }
                 case FILE_ACTION_RENAMED_NEW_NAME:
                 {
-                    auto &change = queuedEvents.back();
-                    change->path = path.string();
+                    batch->SetRenamed(*(batch->end() - 1), baseDirectory, name.data(), name.size());
+                    batch->BreakChanges(baseDirectory, name.data(), name.size());
 
                     if (options.subtree)
                     {
@@ -538,7 +1287,7 @@ end_event_loop:
                         {
                             auto &worker = *it;
 
-                            if (!worker->IsRunning() || worker->basePath == change->lastPath)
+                            if (!worker->IsRunning() || worker->basePath == renamedPath)
                             {
                                 it = workers.erase(it);
                             }
@@ -546,7 +1295,7 @@ end_event_loop:
 
                         if (options.symlinks && fs::is_symlink(path) && fs::is_directory(path))
                         {
-                            workers.push_back(std::make_unique<Worker>(false, path, options, eventsBuffer, eventsBufferMutex));
+                            workers.push_back(std::make_unique<Worker>(fs::path(rootPath), path, options, watcher));
                         }
                     }
 
@@ -562,15 +1311,9 @@ end_event_loop:
                 p += info->NextEntryOffset;
             }
 
-            std::lock_guard<std::mutex> lock(*eventsBufferMutex);
-
-            for (auto it = queuedEvents.begin(); it != queuedEvents.end(); it++)
+            if (!options.coalesceWindowMs || batch->IsOversized())
             {
-                auto &change = *it;
-                if (change->flags & options.notifyFilterFlags)
-                {
-                    eventsBuffer->push(std::move(*it));
-                }
+                FlushBatch(batch, notifyFilter);
             }
 
             break;
@@ -582,24 +1325,48 @@ end_event_loop:
         }
         }
     }
-#endif
 
-    if (isRootWorker)
-    {
-        std::lock_guard<std::mutex> lock(*eventsBufferMutex);
+    running = false;
 
-        auto change = std::make_unique<NotifyEvent>();
-        change->type = kStop;
-        change->path = basePath.string();
+    FlushBatch(batch, notifyFilter);
+    PushEvent(kStop);
+}
 
-        eventsBuffer->push(std::move(change));
+void DirectoryWatcher::Worker::FlushBatch(std::unique_ptr<EventBatch> &batch, NotifyFilterFlags notifyFilter)
+{
+    if (!batch)
+    {
+        return;
     }
+
+    auto flushed = std::move(batch);
+    watcher->eventsFiltered.fetch_add(flushed->Filter(notifyFilter, options.pathMatcher.get()), std::memory_order_relaxed);
+
+    SendBatch(std::move(flushed));
 }
+#endif
 
-DirectoryWatcher::DirectoryWatcher()
+DirectoryWatcher::DirectoryWatcher() : droppedEvents(0),
+                                       recordsRead(0),
+                                       eventsFiltered(0),
+                                       eventsQueued(0),
+                                       eventsDispatched(0),
+                                       queuedEvents(0),
+                                       queuedBytes(0),
+                                       peakQueuedBytes(0),
+                                       collapsed(false),
+                                       heldBatches(0),
+                                       heldWaiting(false),
+                                       draining(false),
+                                       evicting(false),
+                                       contentBudget(std::make_shared<ContentBudget>()),
+                                       pendingBatch(0),
+                                       pendingEvent(0),
+                                       deferredEvents(0),
+                                       dispatching(false)
 {
-    eventsBuffer = std::make_unique<EventQueue>();
-    eventsBufferMutex = std::make_unique<std::mutex>();
+    eventsBuffer = std::make_unique<EventQueue>(kEventQueueCapacity);
+    freeBatches = std::make_unique<EventQueue>(kBatchPoolCapacity);
 }
 
 DirectoryWatcher::~DirectoryWatcher()
@@ -614,7 +1381,9 @@ bool DirectoryWatcher::Watch(const std::filesystem::path &absPath, const WatchOp
         return false;
     }
 
-    auto worker = std::make_unique<Worker>(true, absPath, options, eventsBuffer.get(), eventsBufferMutex.get());
+    contentBudget->SetLimit(options.contentsBudget);
+
+    auto worker = std::make_unique<Worker>(absPath, absPath, options, this);
     workers.push_back(std::move(worker));
 
     return true;
@@ -634,23 +1403,423 @@ bool DirectoryWatcher::IsWatching(const std::filesystem::path &absPath) const
     return false;
 }
 
+DirectoryWatcher::WatchProgress DirectoryWatcher::GetWatchProgress() const
+{
+    WatchProgress progress = {};
+    progress.armed = !workers.empty();
+
+    for (auto it = workers.begin(); it != workers.end(); it++)
+    {
+        auto &worker = *it;
+        progress.registeredDirectories += worker->GetRegisteredDirectoryCount();
+        progress.pendingDirectories += worker->GetPendingDirectoryCount();
+        progress.armed = progress.armed && worker->IsArmed();
+    }
+
+    return progress;
+}
+
+DirectoryWatcher::WatchBackend DirectoryWatcher::GetBackend() const
+{
+    return workers.empty() ? kAutomatic : workers.front()->GetBackend();
+}
+
+DirectoryWatcher::BufferUsage DirectoryWatcher::GetBufferUsage() const
+{
+    BufferUsage usage = {};
+
+    for (auto it = workers.begin(); it != workers.end(); it++)
+    {
+        auto &worker = *it;
+        usage.currentSize += worker->GetBufferSize();
+        usage.peakSize += worker->GetPeakBufferSize();
+    }
+
+    return usage;
+}
+
+void DirectoryWatcher::SetNotifyFilter(NotifyFilterFlags flags)
+{
+    for (auto it = workers.begin(); it != workers.end(); it++)
+    {
+        (*it)->SetNotifyFilter(flags);
+    }
+}
+
 void DirectoryWatcher::StopWatching()
 {
     workers.clear();
 }
 
+std::unique_ptr<DirectoryWatcher::EventBatch> DirectoryWatcher::AcquireBatch(const std::string &root)
+{
+    std::unique_ptr<EventBatch> batch;
+    if (!freeBatches->TryPop(batch))
+    {
+        batch = std::make_unique<EventBatch>();
+    }
+
+    batch->Reset(root);
+    return batch;
+}
+
+void DirectoryWatcher::ReleaseBatch(std::unique_ptr<EventBatch> &&batch)
+{
+    batch->ClearContents();
+
+    // Let one-off bursts give their memory back instead of pinning it in the
+    // pool. A full pool frees the batch the same way.
+    if (batch->IsOversized() || !freeBatches->TryPush(std::move(batch)))
+    {
+        batch.reset();
+    }
+}
+
+bool DirectoryWatcher::QueueEvents(std::unique_ptr<EventBatch> &&batch, const WatchOptions &options)
+{
+    size_t count = batch->GetSize();
+    size_t bytes = batch->GetMemoryUsage();
+
+    // Start and stop events aren't held to the caps, and are never lost.
+    NotifyEventType type = batch->GetEvent(0).type;
+    if (type == kStart || type == kStop)
+    {
+        QueueHeld(std::move(batch));
+        return true;
+    }
+
+    // Changes can't go on while a start or stop event waits for room, or they
+    // would be seen before it.
+    if (collapsed.load(std::memory_order_acquire) || heldWaiting.load(std::memory_order_acquire))
+    {
+        DropQueued(std::move(batch));
+        return false;
+    }
+
+    if (!HasRoom(count, bytes, options) && options.queuePolicy != kDropNewest)
+    {
+        // Changes taken off are only detached while the lock is held. The
+        // consumer may be waiting on it, and releasing them can free memory.
+        std::vector<std::unique_ptr<EventBatch>> victims;
+
+        {
+            std::lock_guard<std::mutex> lock(heldMutex);
+
+            // A drain that started without the lock is short, and has to
+            // finish first, or a start or stop event taken off here could
+            // end up behind changes it took after it.
+            evicting.store(true);
+            while (draining.load())
+            {
+                std::this_thread::yield();
+            }
+
+            // Only as much as the new batch needs is taken off. Start and
+            // stop events stay ahead of whatever is still queued.
+            std::unique_ptr<EventBatch> oldest;
+            while ((options.queuePolicy == kCollapse || !HasRoom(count, bytes, options)) && eventsBuffer->TryPop(oldest))
+            {
+                Unqueue(*oldest);
+
+                NotifyEventType oldestType = oldest->GetEvent(0).type;
+                if (oldestType == kStart || oldestType == kStop)
+                {
+                    heldFront.push_back(std::move(oldest));
+                    heldBatches.fetch_add(1, std::memory_order_release);
+                }
+                else
+                {
+                    victims.push_back(std::move(oldest));
+                }
+            }
+
+            evicting.store(false, std::memory_order_release);
+        }
+
+        for (auto it = victims.begin(); it != victims.end(); it++)
+        {
+            DropQueued(std::move(*it));
+        }
+
+        if (options.queuePolicy == kCollapse)
+        {
+            droppedEvents.fetch_add(count, std::memory_order_relaxed);
+
+            std::string root = batch->GetRoot();
+            batch->Reset(root);
+            batch->AddEvent(kResyncRequired, kNone, batch->AddDirectory("", 0), "", 0);
+
+            // Nothing else goes on until the consumer has seen the marker,
+            // so it can't be lost either.
+            collapsed.store(true, std::memory_order_release);
+            QueueHeld(std::move(batch));
+            return false;
+        }
+    }
+
+    if (!HasRoom(count, bytes, options) || !PushQueued(batch))
+    {
+        DropQueued(std::move(batch));
+        return false;
+    }
+
+    return true;
+}
+
+bool DirectoryWatcher::PushQueued(std::unique_ptr<EventBatch> &batch)
+{
+    size_t count = batch->GetSize();
+    size_t bytes = batch->GetMemoryUsage();
+
+    // Counted before it goes in, so the consumer never takes off more than
+    // was put on.
+    queuedEvents.fetch_add(count, std::memory_order_relaxed);
+    size_t total = queuedBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    size_t peak = peakQueuedBytes.load(std::memory_order_relaxed);
+    while (total > peak && !peakQueuedBytes.compare_exchange_weak(peak, total, std::memory_order_relaxed))
+    {
+    }
+
+    batch->SetQueueTime(std::chrono::steady_clock::now());
+
+    if (!eventsBuffer->TryPush(std::move(batch)))
+    {
+        Unqueue(*batch);
+        return false;
+    }
+
+    eventsQueued.fetch_add(count, std::memory_order_relaxed);
+    return true;
+}
+
+void DirectoryWatcher::QueueHeld(std::unique_ptr<EventBatch> &&batch)
+{
+    std::lock_guard<std::mutex> lock(heldMutex);
+
+    // Once one is waiting, the rest wait behind it so they keep their order.
+    if (heldBack.empty() && PushQueued(batch))
+    {
+        return;
+    }
+
+    batch->SetQueueTime(std::chrono::steady_clock::now());
+    eventsQueued.fetch_add(batch->GetSize(), std::memory_order_relaxed);
+
+    heldBack.push_back(std::move(batch));
+    heldBatches.fetch_add(1, std::memory_order_release);
+    heldWaiting.store(true, std::memory_order_release);
+}
+
+bool DirectoryWatcher::HasRoom(size_t count, size_t bytes, const WatchOptions &options) const
+{
+    if (options.maxQueuedEvents && queuedEvents.load(std::memory_order_relaxed) + count > options.maxQueuedEvents)
+    {
+        return false;
+    }
+
+    if (options.maxQueuedBytes && queuedBytes.load(std::memory_order_relaxed) + bytes > options.maxQueuedBytes)
+    {
+        return false;
+    }
+
+    return eventsBuffer->SizeApprox() < eventsBuffer->Capacity();
+}
+
+void DirectoryWatcher::Unqueue(const EventBatch &batch)
+{
+    queuedEvents.fetch_sub(batch.GetSize(), std::memory_order_relaxed);
+    queuedBytes.fetch_sub(batch.GetMemoryUsage(), std::memory_order_relaxed);
+}
+
+void DirectoryWatcher::DropQueued(std::unique_ptr<EventBatch> &&batch)
+{
+    droppedEvents.fetch_add(batch->GetSize(), std::memory_order_relaxed);
+    ReleaseBatch(std::move(batch));
+}
+
+DirectoryWatcher::QueueUsage DirectoryWatcher::GetQueueUsage() const
+{
+    QueueUsage usage;
+    usage.events = queuedEvents.load(std::memory_order_relaxed);
+    usage.bytes = queuedBytes.load(std::memory_order_relaxed);
+    usage.peakBytes = peakQueuedBytes.load(std::memory_order_relaxed);
+    return usage;
+}
+
+DirectoryWatcher::Statistics DirectoryWatcher::GetStatistics() const
+{
+    Statistics statistics = {};
+    statistics.recordsRead = recordsRead.load(std::memory_order_relaxed);
+    statistics.eventsFiltered = eventsFiltered.load(std::memory_order_relaxed);
+    statistics.eventsQueued = eventsQueued.load(std::memory_order_relaxed);
+    statistics.eventsDispatched = eventsDispatched.load(std::memory_order_relaxed);
+    statistics.eventsDropped = droppedEvents.load(std::memory_order_relaxed);
+    statistics.queueDepth = queuedEvents.load(std::memory_order_relaxed);
+    statistics.watchCount = GetWatchProgress().registeredDirectories;
+    statistics.bufferSize = GetBufferUsage().currentSize;
+    statistics.queueLatency = queueLatency.GetSummary();
+    statistics.dispatchLatency = dispatchLatency.GetSummary();
+    statistics.totalLatency = totalLatency.GetSummary();
+
+#ifdef __linux__
+    // Workers share the reactor thread, or the polling one.
+    bool counted[2] = {false, false};
+    for (auto it = workers.begin(); it != workers.end(); it++)
+    {
+        bool polls = (*it)->GetBackend() == kPolling;
+        if (!counted[polls])
+        {
+            counted[polls] = true;
+            statistics.cpuTime += (*it)->GetCpuTime();
+        }
+    }
+#else
+    for (auto it = workers.begin(); it != workers.end(); it++)
+    {
+        statistics.cpuTime += (*it)->GetCpuTime();
+    }
+#endif
+
+    return statistics;
+}
+
 void DirectoryWatcher::ProcessEvents()
 {
-    std::lock_guard<std::mutex> lock(*eventsBufferMutex.get());
+    ProcessEvents(std::chrono::steady_clock::time_point::max());
+}
+
+bool DirectoryWatcher::ProcessEvents(std::chrono::steady_clock::time_point deadline)
+{
+    if (dispatching)
+    {
+        return false;
+    }
+
+    // Only once everything taken last time is done, detach everything that is
+    // queued right now. Ring slots are released however long the callbacks
+    // take, and a worker that keeps producing can't keep this call from
+    // returning.
+    if (pendingBatch == pendingBatches.size())
+    {
+        pendingBatches.clear();
+        pendingBatch = 0;
+        pendingEvent = 0;
+
+        // Usually nothing is held and no worker is making room, and the
+        // queue is drained without waiting on the workers.
+        draining.store(true);
+        if (heldBatches.load() == 0 && !evicting.load())
+        {
+            TakeQueued();
+            draining.store(false, std::memory_order_release);
+        }
+        else
+        {
+            draining.store(false);
+
+            // Start and stop events taken off to make room come first, and
+            // those that found no room come last.
+            std::lock_guard<std::mutex> lock(heldMutex);
+            TakeHeld(heldFront);
+            TakeQueued();
+            TakeHeld(heldBack);
+            heldWaiting.store(false, std::memory_order_release);
+        }
+
+        // Once the marker is off the queue, there's room again.
+        for (size_t i = 0; i < pendingBatches.size(); i++)
+        {
+            if (pendingBatches[i]->GetEvent(0).type == kResyncRequired)
+            {
+                collapsed.store(false, std::memory_order_release);
+            }
+        }
+    }
+
+    bool timed = deadline != std::chrono::steady_clock::time_point::max();
+
+    while (pendingBatch < pendingBatches.size())
+    {
+        EventBatch &batch = *pendingBatches[pendingBatch];
+        NotifyEvent &event = batch.GetEvent(pendingEvent++);
+        event.dispatchTime = std::chrono::steady_clock::now();
+        RecordLatency(event);
+
+        eventsDispatched.fetch_add(1, std::memory_order_relaxed);
+
+        dispatching = true;
+        OnProcessEvent(event);
+        dispatching = false;
+
+        if (pendingEvent == batch.GetSize())
+        {
+            ReleaseBatch(std::move(pendingBatches[pendingBatch]));
+            pendingBatch++;
+            pendingEvent = 0;
+        }
+
+        if (timed && std::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+    }
+
+    if (pendingBatch == pendingBatches.size())
+    {
+        return true;
+    }
+
+    size_t left = pendingBatches[pendingBatch]->GetSize() - pendingEvent;
+    for (size_t i = pendingBatch + 1; i < pendingBatches.size(); i++)
+    {
+        left += pendingBatches[i]->GetSize();
+    }
+
+    deferredEvents += left;
+    return false;
+}
+
+void DirectoryWatcher::RecordLatency(const NotifyEvent &event)
+{
+    if (event.type != kFilesystem)
+    {
+        return;
+    }
+
+    auto queueTime = event.GetQueueTime();
+    queueLatency.Record(std::chrono::duration_cast<std::chrono::microseconds>(queueTime - event.readTime));
+    dispatchLatency.Record(std::chrono::duration_cast<std::chrono::microseconds>(event.dispatchTime - queueTime));
+    totalLatency.Record(std::chrono::duration_cast<std::chrono::microseconds>(event.dispatchTime - event.readTime));
+}
+
+void DirectoryWatcher::TakeHeld(std::vector<std::unique_ptr<EventBatch>> &held)
+{
+    heldBatches.fetch_sub(held.size(), std::memory_order_relaxed);
+
+    for (auto it = held.begin(); it != held.end(); it++)
+    {
+        pendingBatches.push_back(std::move(*it));
+    }
+
+    held.clear();
+}
 
-    while (!eventsBuffer->empty())
+void DirectoryWatcher::TakeQueued()
+{
+    std::unique_ptr<EventBatch> batch;
+    for (size_t i = eventsBuffer->Capacity(); i > 0 && eventsBuffer->TryPop(batch); i--)
     {
-        auto &front = eventsBuffer->front();
-        OnProcessEvent(*front.get());
-        eventsBuffer->pop();
+        Unqueue(*batch);
+        pendingBatches.push_back(std::move(batch));
     }
 }
 
+bool DirectoryWatcher::HasPendingEvents() const
+{
+    return pendingBatch < pendingBatches.size() || eventsBuffer->SizeApprox() > 0 || heldBatches.load(std::memory_order_acquire) > 0;
+}
+
 void DirectoryWatcher::OnProcessEvent(const NotifyEvent &event)
 {
 }
\ No newline at end of file
@@ -30,6 +30,7 @@
 #ifndef WATCHER_H_
 #define WATCHER_H_
 
+#include <chrono>
 #include <filesystem>
 #include <vector>
 #include <queue>
@@ -37,13 +38,27 @@
 #include <thread>
 #include <mutex>
 #include <map>
+#include <atomic>
+#include <deque>
 
 #ifdef __linux__
+#include "fanotify.h"
+#include "reactor.h"
+#include "registry.h"
+#include "treewatch.h"
 #else
 #include <Windows.h>
 #endif
 
+#include "contenthash.h"
+#include "filecontents.h"
+#include "flatmap.h"
 #include "helpers.h"
+#include "histogram.h"
+#include "pathmatcher.h"
+#include "queue.h"
+#include "snapshot.h"
+#include "watchtree.h"
 
 class DirectoryWatcher
 {
@@ -58,81 +73,626 @@ public:
         kNotifyAll = (kNone - 1)
     };
 
+    enum WatchBackend
+    {
+        // The platform's own: inotify on Linux, ReadDirectoryChangesW on
+        // Windows.
+        kAutomatic = 0,
+        kInotify,
+
+        // One fanotify mark on the filesystem instead of a watch for every
+        // directory, so even huge trees are watched at once. Needs
+        // CAP_SYS_ADMIN; inotify is used instead where it can't be set up.
+        // Directory links and other filesystems mounted inside the tree
+        // aren't followed, and changes are not resynced after an overflow.
+        kFanotify,
+
+        // Lists the tree periodically and compares it against snapshots, for
+        // network and FUSE filesystems, where changes made elsewhere never
+        // raise inotify events. Picked automatically on those. Only renames
+        // within one directory are recognised; others are a deletion and a
+        // creation.
+        kPolling
+    };
+
+    // What happens to changes that don't fit in the queue.
+    enum QueuePolicy
+    {
+        // They are dropped.
+        kDropNewest = 0,
+
+        // The oldest queued changes are dropped to make room for them.
+        kDropOldest,
+
+        // Everything queued is dropped, and replaced by a single
+        // kResyncRequired event. Nothing more is queued until that has been
+        // taken by ProcessEvents().
+        kCollapse
+    };
+
     struct WatchOptions
     {
         bool subtree;
         bool symlinks;
         NotifyFilterFlags notifyFilterFlags;
+
+        // On Windows, the fixed size of the buffer changes are read into. On
+        // Linux, the buffer is sized from the backlog the kernel reports
+        // instead; it starts no larger than this and may grow up to
+        // maxBufferSize, or a default ceiling if that is 0.
         size_t bufferSize;
+        size_t maxBufferSize;
+
+        // How long, in milliseconds, changes are held so bursts to the same
+        // path can be folded into their net effect. 0 sends them as they are
+        // read.
+        unsigned int coalesceWindowMs;
+
+        // Which paths are reported, checked by the worker before anything is
+        // queued. Shared, as it is never changed once compiled. Null reports
+        // every path.
+        std::shared_ptr<const PathMatcher> pathMatcher;
+
+        // Subdirectories whose path the filter turns away are never watched,
+        // nor is anything below them; only their own entry is reported.
+        std::shared_ptr<const PathMatcher> directoryFilter;
+
+        WatchBackend backend;
+
+        // How often, in milliseconds, a polled tree is compared against its
+        // snapshots. 0 uses a default.
+        unsigned int pollIntervalMs;
+
+        // Drops modifications that left a file's contents as they were, such
+        // as a tool rewriting it with the same bytes. Files are hashed when
+        // they are reported, so the first modification of each is always
+        // sent. Files larger than maxHashedSize, or a default if that is 0,
+        // are compared by size and modification time instead.
+        bool verifyContents;
+        uint64_t maxHashedSize;
+
+        // With a budget, files reported created or modified are read by the
+        // worker and their contents sent with the event, for as long as the
+        // copies the watcher holds fit in it. 0 sends none. Files are read
+        // when the event is sent, so without a coalescing window a new file
+        // is usually still empty. Files larger than maxContentsSize, or a
+        // default if that is 0, are sent without theirs, so no one file can
+        // take the whole budget.
+        size_t contentsBudget;
+        size_t maxContentsSize;
+
+        // Caps on the changes waiting for ProcessEvents(), by count and by
+        // the memory their batches take up. 0 leaves only the queue's fixed
+        // capacity. Start and stop events are never held to them, and are
+        // never dropped.
+        size_t maxQueuedEvents;
+        size_t maxQueuedBytes;
+        QueuePolicy queuePolicy;
     };
 
     enum NotifyEventType
     {
         kFilesystem = 0,
         kStart,
-        kStop
+        kStop,
+
+        // Events were lost because the system's queue filled up. Differences
+        // found afterwards are reported as ordinary events.
+        kOverflow,
+
+        // Queued events were dropped under kCollapse. Nothing is resynced;
+        // the consumer has to look over the tree itself.
+        kResyncRequired
     };
 
+    class EventBatch;
+
+    // A compact event record. Paths are not stored with the event; they are
+    // built from the batch's string slab only when asked for.
     struct NotifyEvent
     {
     public:
         NotifyEventType type;
         NotifyFilterFlags flags;
-        std::string lastPath;
-        std::string path;
 
-#ifdef __linux__
-        uint32_t cookie;
-#endif
+        std::string GetPath() const;
+        std::string GetLastPath() const;
+
+        // Appends the path relative to the watched directory. Nothing is
+        // appended for start and stop events.
+        void AppendRelativePath(std::string &out) const;
+        void AppendRelativeLastPath(std::string &out) const;
+
+        // What the file held when the change was reported, if the watcher
+        // was asked for contents and they fit in its budget.
+        std::shared_ptr<const FileContents> GetContents() const;
+
+        // When the change was read from the system, when it was queued for
+        // ProcessEvents(), and when ProcessEvents() handed it over. A change
+        // folded into an earlier one keeps the earlier one's read time.
+        inline std::chrono::steady_clock::time_point GetReadTime() const { return readTime; }
+        std::chrono::steady_clock::time_point GetQueueTime() const;
+        inline std::chrono::steady_clock::time_point GetDispatchTime() const { return dispatchTime; }
+
+    private:
+        friend class DirectoryWatcher;
+
+        void AppendPath(std::string &out, uint32_t directory, uint32_t offset, uint32_t length, bool relative) const;
+
+        const EventBatch *batch;
+
+        // Index into the batch's directory table, and the location of the
+        // file name in the batch's slab.
+        uint32_t directory;
+        uint32_t nameOffset;
+        uint32_t nameLength;
+
+        uint32_t lastDirectory;
+        uint32_t lastNameOffset;
+        uint32_t lastNameLength;
+
+        // Index into the batch's contents, or kNoContents.
+        uint32_t contents;
+
+        std::chrono::steady_clock::time_point readTime;
+        std::chrono::steady_clock::time_point dispatchTime;
+    };
+
+    static constexpr uint32_t kNoContents = UINT32_MAX;
+
+    // The events of one worker wakeup, or of a few back-to-back wakeups while
+    // a rename waits for its other half. Batches are recycled through a pool
+    // owned by the watcher, so once the pool is warm, filling one doesn't
+    // touch the heap.
+    class EventBatch
+    {
+    public:
+        EventBatch();
+        void Reset(const std::string &root);
+
+        // Copies a directory path, relative to the root, into the slab and
+        // returns its index.
+        uint32_t AddDirectory(const char *relPath, size_t length);
+
+        NotifyEvent &AddEvent(NotifyEventType type, NotifyFilterFlags flags, uint32_t directory, const char *name, size_t length);
+
+        // Adds a change, folding it into the last one added this way for the
+        // same path: modifications after a creation or modification are part
+        // of it, a deletion supersedes a modification, and a creation undone
+        // by a deletion is dropped altogether.
+        void AddChange(NotifyFilterFlags flags, uint32_t directory, const char *name, size_t length);
+
+        // Keeps later changes to the path from being folded into earlier ones,
+        // such as after it was renamed.
+        void BreakChanges(uint32_t directory, const char *name, size_t length);
+
+        // Moves the event's path into its last path and gives it a new one.
+        void SetRenamed(NotifyEvent &event, uint32_t directory, const char *name, size_t length);
+
+        void AttachContents(NotifyEvent &event, std::shared_ptr<const FileContents> &&contents);
+
+        // Lets go of the contents, so a batch waiting in the pool doesn't
+        // hold on to them.
+        void ClearContents();
+
+        // Drops the events that don't match the filter, or whose paths the
+        // matcher turns away. A rename is kept if either of its paths passes.
+        // Returns how many were dropped.
+        size_t Filter(NotifyFilterFlags flags, const PathMatcher *matcher);
+
+        inline NotifyEvent &GetEvent(size_t index) { return events[index]; }
+        inline size_t GetSize() const { return events.size(); }
+        inline bool IsEmpty() const { return events.empty(); }
+        inline std::vector<NotifyEvent>::const_iterator begin() const { return events.begin(); }
+        inline std::vector<NotifyEvent>::const_iterator end() const { return events.end(); }
+        inline std::vector<NotifyEvent>::iterator begin() { return events.begin(); }
+        inline std::vector<NotifyEvent>::iterator end() { return events.end(); }
+
+        // Whether the batch has grown large enough that it should be freed
+        // instead of recycled.
+        bool IsOversized() const;
+
+        // Bytes of memory the batch holds, not counting file contents, which
+        // have a budget of their own.
+        size_t GetMemoryUsage() const;
+
+        inline const std::string &GetRoot() const { return root; }
+
+        // Set as the batch goes into the queue; every event in it shares it.
+        inline void SetQueueTime(std::chrono::steady_clock::time_point time) { queueTime = time; }
+        inline std::chrono::steady_clock::time_point GetQueueTime() const { return queueTime; }
+
+    private:
+        friend struct NotifyEvent;
+
+        uint32_t AppendToSlab(const char *data, size_t length);
+        bool HasPath(const NotifyEvent &event, uint32_t directory, const char *name, size_t length) const;
+
+        struct Span
+        {
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        std::string root;
+        std::string slab;
+        std::vector<Span> directories;
+        std::vector<NotifyEvent> events;
+        std::vector<std::shared_ptr<const FileContents>> contents;
+        std::chrono::steady_clock::time_point queueTime;
+
+        // The last change added for each path, keyed by a hash of its
+        // directory and name.
+        FlatHashMap<uint64_t, uint32_t> changes;
+
+        // Where paths are built for the matcher.
+        std::string matchPath;
     };
 
-    typedef std::queue<std::unique_ptr<NotifyEvent>> EventQueue;
+    typedef BoundedQueue<std::unique_ptr<EventBatch>> EventQueue;
+
+    static constexpr size_t kEventQueueCapacity = 1024;
+    static constexpr size_t kBatchPoolCapacity = 64;
 
 public:
     DirectoryWatcher();
     virtual ~DirectoryWatcher();
+    // Returns without waiting for subdirectories to be registered; that
+    // happens in the background, and the start event is raised once it's done.
     bool Watch(const std::filesystem::path &absPath, const WatchOptions &options);
     bool IsWatching(const std::filesystem::path &absPath) const;
     void StopWatching();
 
+    // Changes what active watches report without restarting them. Only the
+    // changes the filter asks for are requested from the system.
+    void SetNotifyFilter(NotifyFilterFlags flags);
+
     void ProcessEvents();
+
+    // Processes events until the deadline passes, always at least one, and
+    // leaves the rest to the next call, which carries on where this one
+    // stopped. Returns true if nothing was left over. Called again from
+    // inside OnProcessEvent(), it does nothing and returns false; the events
+    // it would have processed are left to the call already running.
+    bool ProcessEvents(std::chrono::steady_clock::time_point deadline);
+
+    // Whether there are events waiting to be processed.
+    bool HasPendingEvents() const;
+
     virtual void OnProcessEvent(const NotifyEvent &event);
 
+    struct WatchProgress
+    {
+        size_t registeredDirectories;
+        size_t pendingDirectories;
+        bool armed;
+    };
+
+    // How far the background registration of watched directories has come.
+    WatchProgress GetWatchProgress() const;
+
+    struct BufferUsage
+    {
+        size_t currentSize;
+        size_t peakSize;
+    };
+
+    // How large the buffers changes are read into are now, and the most they
+    // have grown to.
+    BufferUsage GetBufferUsage() const;
+
+    // What is watching the directory, which may not be the backend that was
+    // asked for.
+    WatchBackend GetBackend() const;
+
+    // Number of events discarded because the consumer fell too far behind.
+    inline size_t GetDroppedEventCount() const { return droppedEvents.load(std::memory_order_relaxed); }
+
+    struct QueueUsage
+    {
+        size_t events;
+        size_t bytes;
+        size_t peakBytes;
+    };
+
+    // How many events are queued and how much memory they take up, and the
+    // most they have taken up. Events already taken by ProcessEvents() no
+    // longer count.
+    QueueUsage GetQueueUsage() const;
+
+    // Bytes of file contents held, whether still queued or kept by the
+    // consumer.
+    inline size_t GetContentsSize() const { return contentBudget->GetUsed(); }
+
+    // Number of events left over by a ProcessEvents() call that ran out of
+    // time, counted again for each call an event is put off by.
+    inline size_t GetDeferredEventCount() const { return deferredEvents; }
+
+    struct Statistics
+    {
+        // Records read from the kernel, before anything is made of them.
+        // Polling reads none.
+        size_t recordsRead;
+
+        // Changes left out by the notify filter or path patterns, or because
+        // a file's contents didn't change.
+        size_t eventsFiltered;
+
+        size_t eventsQueued;
+        size_t eventsDispatched;
+        size_t eventsDropped;
+
+        size_t queueDepth;
+        size_t watchCount;
+        size_t bufferSize;
+
+        // CPU time of the threads that read changes. On Linux, that is the
+        // reactor thread, which every watcher in the process shares, and the
+        // one polling watchers share.
+        std::chrono::microseconds cpuTime;
+
+        // How long changes took from being read to being queued, which
+        // includes any coalescing window, from being queued to being
+        // dispatched, and from end to end. Start, stop and other events
+        // that aren't changes are left out.
+        LatencyHistogram::Summary queueLatency;
+        LatencyHistogram::Summary dispatchLatency;
+        LatencyHistogram::Summary totalLatency;
+    };
+
+    // Counters kept since the watcher was created, along with how things
+    // stand right now. Cheap enough to call every frame, but only from the
+    // thread that calls ProcessEvents(), which records the latencies.
+    Statistics GetStatistics() const;
+
 private:
+    std::unique_ptr<EventBatch> AcquireBatch(const std::string &root);
+    void ReleaseBatch(std::unique_ptr<EventBatch> &&batch);
+    bool QueueEvents(std::unique_ptr<EventBatch> &&batch, const WatchOptions &options);
+    bool HasRoom(size_t count, size_t bytes, const WatchOptions &options) const;
+    bool PushQueued(std::unique_ptr<EventBatch> &batch);
+    void QueueHeld(std::unique_ptr<EventBatch> &&batch);
+    void TakeHeld(std::vector<std::unique_ptr<EventBatch>> &held);
+    void TakeQueued();
+    void Unqueue(const EventBatch &batch);
+    void DropQueued(std::unique_ptr<EventBatch> &&batch);
+    void RecordLatency(const NotifyEvent &event);
+
     std::unique_ptr<EventQueue> eventsBuffer;
-    std::unique_ptr<std::mutex> eventsBufferMutex;
+    std::unique_ptr<EventQueue> freeBatches;
+    std::atomic<size_t> droppedEvents;
+
+    // Bumped by the workers and the consumer as events pass through, for
+    // GetStatistics().
+    std::atomic<size_t> recordsRead;
+    std::atomic<size_t> eventsFiltered;
+    std::atomic<size_t> eventsQueued;
+    std::atomic<size_t> eventsDispatched;
+
+    // Recorded by ProcessEvents() as each change is dispatched.
+    LatencyHistogram queueLatency;
+    LatencyHistogram dispatchLatency;
+    LatencyHistogram totalLatency;
+
+    // What is in the queue, kept up to date as batches go in and out, and set
+    // while a kResyncRequired event waits in it.
+    std::atomic<size_t> queuedEvents;
+    std::atomic<size_t> queuedBytes;
+    std::atomic<size_t> peakQueuedBytes;
+    std::atomic<bool> collapsed;
+
+    // Start and stop events kept out of the queue: those taken off it to make
+    // room, which go ahead of what is left in it, and those that found it
+    // full, which go after. Changes are dropped while any are waiting, so
+    // each worker's events stay in order.
+    std::mutex heldMutex;
+    std::vector<std::unique_ptr<EventBatch>> heldFront;
+    std::vector<std::unique_ptr<EventBatch>> heldBack;
+    std::atomic<size_t> heldBatches;
+    std::atomic<bool> heldWaiting;
+
+    // Set while the consumer drains the queue without the lock, and while a
+    // worker holding it takes batches off to make room. Each is set before
+    // the other is checked, so the two never take batches off at once.
+    std::atomic<bool> draining;
+    std::atomic<bool> evicting;
+
+    // Shared with every copy of a file's contents, which may outlive the
+    // watcher.
+    std::shared_ptr<ContentBudget> contentBudget;
 
+    // Batches taken off the queue by ProcessEvents(), and the next event in
+    // them to process. Kept as members so a call that runs out of time can
+    // be picked up where it stopped, and so their storage is reused.
+    std::vector<std::unique_ptr<EventBatch>> pendingBatches;
+    size_t pendingBatch;
+    size_t pendingEvent;
+    size_t deferredEvents;
+
+    // Set while OnProcessEvent() runs, which must not release the batch the
+    // event belongs to.
+    bool dispatching;
+
+#ifdef __linux__
+    class Worker : public EventReactor::Handler, public TreeWatch::View
+#else
     class Worker
+#endif
     {
     public:
-        Worker(bool isRoot, const std::filesystem::path &path, const WatchOptions &options, EventQueue *eventsBuffer, std::mutex *eventsBufferMutex);
+        Worker(const std::filesystem::path &rootPath, const std::filesystem::path &path, const WatchOptions &options, DirectoryWatcher *watcher);
         ~Worker();
-        inline bool IsRunning() const { return thread.joinable(); }
+        inline bool IsRunning() const { return running; }
+        inline bool IsArmed() const { return armed; }
+        inline size_t GetRegisteredDirectoryCount() const { return registeredDirectories.load(std::memory_order_relaxed); }
+        inline size_t GetPendingDirectoryCount() const { return pendingDirectories.load(std::memory_order_relaxed); }
+#ifdef __linux__
+        // With inotify, the buffer belongs to the registry, and is shared
+        // with every other watcher in the process.
+        inline size_t GetBufferSize() const { return fanotify ? fanotify->GetBufferSize() : registry ? registry->GetBufferSize() : 0; }
+        inline size_t GetPeakBufferSize() const { return fanotify ? fanotify->GetBufferSize() : registry ? registry->GetPeakBufferSize() : 0; }
+        inline WatchBackend GetBackend() const { return fanotify ? kFanotify : polling ? kPolling : kInotify; }
+#else
+        inline size_t GetBufferSize() const { return bufferSize.load(std::memory_order_relaxed); }
+        inline size_t GetPeakBufferSize() const { return peakBufferSize.load(std::memory_order_relaxed); }
+        inline WatchBackend GetBackend() const { return kAutomatic; }
+#endif
+        std::chrono::microseconds GetCpuTime() const;
+        void SetNotifyFilter(NotifyFilterFlags flags);
 
     private:
 #ifdef __linux__
-        int AddDirectory(const std::filesystem::path &path);
+        bool StartTree();
+        bool IsInView(uint32_t node) const;
+        uint32_t GetBatchDirectory(EventBatch &batch, uint32_t node);
+        EventBatch &GetOpenBatch();
+        virtual void OnReadable(int fd) override;
+        virtual void OnError(int fd, int error) override;
+        virtual bool OnWork() override;
+        virtual void OnTreeArmed() override;
+        virtual void OnTreeChange(uint32_t mask, uint32_t node, const char *name, size_t length) override;
+        virtual void OnTreeMovedFrom(uint32_t cookie, uint32_t node, const char *name, size_t length) override;
+        virtual void OnTreeMovedTo(uint32_t cookie, uint32_t node, const char *name, size_t length) override;
+        virtual void OnTreeRenamed(uint32_t node, const char *oldName, size_t oldLength, const char *name, size_t length) override;
+        virtual void OnTreeOverflow() override;
+        virtual void OnTreeReshaped() override;
+        virtual void OnTreeEventsEnd(size_t records) override;
+        virtual void OnTreeStopped() override;
+        uint32_t GetWatchMask() const;
+        uint64_t GetFanotifyMask() const;
+        void ApplyNotifyFilter();
+        void ReadFanotify();
+        void SetFlushTimer(long milliseconds);
+        void ScheduleFlush();
+        void FlushBatch();
+        bool FinishContents();
+        void Stop();
+#else
+        void AddDirectoryLinks();
+        bool IsInExcludedDirectory(const std::string &name);
+        DWORD GetChangeFilter(NotifyFilterFlags flags) const;
+        void FlushBatch(std::unique_ptr<EventBatch> &batch, NotifyFilterFlags notifyFilter);
+        void ThreadProc();
 #endif
 
-        void ThreadProc();
+        void AddChange(EventBatch &batch, NotifyFilterFlags flags, uint32_t directory, const char *name, size_t length);
+        void VerifyContents(EventBatch &batch);
+        void CaptureContents(EventBatch &batch);
+        void SendBatch(std::unique_ptr<EventBatch> &&batch);
+        bool IsExcludedDirectory(const char *path, size_t length) const;
+        void PushEvent(NotifyEventType type);
 
     public:
         bool isRootWorker;
         const std::filesystem::path basePath;
 
     private:
-        EventQueue *eventsBuffer;
-        std::mutex *eventsBufferMutex;
+        DirectoryWatcher *watcher;
+
+        // Paths in events are relative to the watched directory, even those
+        // raised by workers watching a directory link inside it.
+        std::string rootPath;
+        std::string relativeBase;
 
         const WatchOptions options;
-        std::thread thread;
+        std::atomic<bool> running;
+
+        // What each modified file held when last reported, with verifyContents,
+        // and where the paths of files to hash or read are built.
+        std::unique_ptr<ContentVerifier> contentVerifier;
+        std::string contentPath;
+
+        static constexpr uint64_t kDefaultMaxHashedSize = 4 * 1024 * 1024;
+        static constexpr size_t kDefaultMaxContentsSize = 1024 * 1024;
+        std::atomic<unsigned int> requestedNotifyFilter;
+
+        // Set once every directory in the tree is being watched; the start
+        // event is sent at the same time.
+        std::atomic<bool> armed;
+        std::atomic<size_t> registeredDirectories;
+        std::atomic<size_t> pendingDirectories;
 
 #ifdef __linux__
-        int fileDescriptor;
-        std::map<int, std::filesystem::path> watchDescriptors;
-        int cancelEvent;
+        std::shared_ptr<EventReactor> reactor;
+
+        // Owns the inotify instance. Watches on directories another watcher
+        // also covers are shared with it, and the read buffer is sized
+        // between the smallest floor and the largest ceiling asked for.
+        std::shared_ptr<WatchRegistry> registry;
+
+        // Finding or starting the tree is left to the first OnWork(), so
+        // starting a watch doesn't wait on the reactor thread.
+        bool started;
+
+        // Set instead of the tree when the whole tree is watched with
+        // fanotify. There is no watch tree then; events come with their
+        // directory already resolved.
+        std::unique_ptr<FanotifyWatch> fanotify;
+        std::vector<FanotifyWatch::Event> fanotifyEvents;
+
+        static constexpr size_t kMinBufferSize = 4096;
+        static constexpr size_t kMaxBufferSize = 256 * 1024;
+
+        // The filter the watches are registered with. It only changes on the
+        // reactor thread.
+        NotifyFilterFlags notifyFilter;
+
+        // The tree this worker is a view of, which may be shared with other
+        // watchers, and the node of the watched directory in it. The
+        // directory's watch and its path below the tree's root tell whether
+        // it is still where it was when the tree reshapes. With polling,
+        // the tree is this worker's alone.
+        std::shared_ptr<TreeWatch> treeWatch;
+        uint32_t viewRoot;
+        int viewDescriptor;
+        std::string viewPath;
+        bool polling;
+
+        // Tree nodes whose directory has already been copied into the batch
+        // being filled, and a scratch buffer for building paths.
+        std::vector<std::pair<uint32_t, uint32_t>> batchDirectories;
+        std::string scratchPath;
+
+        // The batch being filled, and the IN_MOVED_FROM events in it that are
+        // still waiting for their IN_MOVED_TO, by cookie. The kernel queues
+        // both halves of a rename back to back, but a read() can end between
+        // them.
+        std::unique_ptr<EventBatch> openBatch;
+        FlatHashMap<uint32_t, uint32_t> pendingMoves;
+
+        // Fires when the open batch is due: once unpaired moves have waited
+        // long enough, or once the coalescing window has closed.
+        int timerDescriptor;
+        bool flushTimerArmed;
+
+        // Hashing or reading a file can take as long as the disk does, so
+        // batches that need either are finished on the blocking reactor, in the order they
+        // were flushed, rather than on the one every watcher shares.
+        class ContentStage : public EventReactor::Handler
+        {
+        public:
+            virtual void OnReadable(int fd) override {}
+            virtual bool OnWork() override { return worker->FinishContents(); }
+
+            Worker *worker;
+        };
+
+        ContentStage contentStage;
+        std::shared_ptr<EventReactor> contentReactor;
+        std::mutex contentMutex;
+        std::deque<std::unique_ptr<EventBatch>> contentBatches;
+
+        static constexpr long kMoveExpiryMs = 5;
+        static constexpr size_t kMaxPendingMoves = 4096;
 #else
+        std::thread thread;
         std::vector<std::unique_ptr<Worker>> workers;
+
+        // Where paths are built to check against the directory filter.
+        std::string filterPath;
+
+        std::atomic<size_t> bufferSize;
+        std::atomic<size_t> peakBufferSize;
         ScopedHandle directory;
         ScopedHandle cancelEvent;
 #endif
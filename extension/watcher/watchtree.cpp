@@ -0,0 +1,252 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#include "watchtree.h"
+
+WatchTree::WatchTree() : root(kInvalidNode),
+                         size(0)
+{
+}
+
+uint32_t WatchTree::Add(uint32_t parent, int wd, const char *name, size_t length)
+{
+    if (descriptors.Find(wd))
+    {
+        return kInvalidNode;
+    }
+
+    uint32_t node;
+    if (!freeNodes.empty())
+    {
+        node = freeNodes.back();
+        freeNodes.pop_back();
+    }
+    else
+    {
+        node = (uint32_t)nodes.size();
+        nodes.emplace_back();
+    }
+
+    Node &entry = nodes[node];
+    entry.wd = wd;
+    entry.firstChild = kInvalidNode;
+    entry.name.assign(name, length);
+
+    if (parent == kInvalidNode)
+    {
+        entry.parent = kInvalidNode;
+        entry.prevSibling = kInvalidNode;
+        entry.nextSibling = kInvalidNode;
+        root = node;
+    }
+    else
+    {
+        Link(node, parent);
+    }
+
+    descriptors.Insert(wd, node);
+    size++;
+
+    return node;
+}
+
+uint32_t WatchTree::Find(int wd) const
+{
+    const uint32_t *node = descriptors.Find(wd);
+    return node ? *node : kInvalidNode;
+}
+
+uint32_t WatchTree::FindChild(uint32_t parent, const char *name, size_t length) const
+{
+    for (uint32_t child = nodes[parent].firstChild; child != kInvalidNode; child = nodes[child].nextSibling)
+    {
+        const std::string &childName = nodes[child].name;
+        if (childName.size() == length && childName.compare(0, length, name, length) == 0)
+        {
+            return child;
+        }
+    }
+
+    return kInvalidNode;
+}
+
+void WatchTree::Move(uint32_t node, uint32_t parent, const char *name, size_t length)
+{
+    if (node == root)
+    {
+        return;
+    }
+
+    Unlink(node);
+    nodes[node].name.assign(name, length);
+    Link(node, parent);
+}
+
+void WatchTree::Remove(uint32_t node, std::vector<int> &removed, std::vector<uint32_t> *removedNodes)
+{
+    if (node == root)
+    {
+        root = kInvalidNode;
+    }
+    else
+    {
+        Unlink(node);
+    }
+
+    stack.clear();
+    stack.push_back(node);
+
+    while (!stack.empty())
+    {
+        uint32_t current = stack.back();
+        stack.pop_back();
+
+        for (uint32_t child = nodes[current].firstChild; child != kInvalidNode; child = nodes[child].nextSibling)
+        {
+            stack.push_back(child);
+        }
+
+        Node &entry = nodes[current];
+        removed.push_back(entry.wd);
+        if (removedNodes)
+        {
+            removedNodes->push_back(current);
+        }
+
+        descriptors.Erase(entry.wd);
+
+        entry.wd = -1;
+        entry.name.clear();
+        freeNodes.push_back(current);
+        size--;
+    }
+}
+
+void WatchTree::AppendPath(uint32_t node, std::string &out, uint32_t base) const
+{
+    if (base == kInvalidNode)
+    {
+        base = root;
+    }
+
+    // Measure first so the path can be written back to front in place.
+    size_t length = 0;
+    for (uint32_t current = node; current != base; current = nodes[current].parent)
+    {
+        length += nodes[current].name.size() + 1;
+    }
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    size_t start = out.size();
+    out.resize(start + length - 1);
+
+    size_t end = out.size();
+    for (uint32_t current = node; current != base; current = nodes[current].parent)
+    {
+        const std::string &name = nodes[current].name;
+        end -= name.size();
+        out.replace(end, name.size(), name);
+
+        if (end > start)
+        {
+            out[--end] = '/';
+        }
+    }
+}
+
+bool WatchTree::IsWithin(uint32_t node, uint32_t base) const
+{
+    if (base == root)
+    {
+        return node != kInvalidNode;
+    }
+
+    for (uint32_t current = node; current != kInvalidNode; current = nodes[current].parent)
+    {
+        if (current == base)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WatchTree::Clear()
+{
+    nodes.clear();
+    freeNodes.clear();
+    descriptors.Clear();
+    root = kInvalidNode;
+    size = 0;
+}
+
+void WatchTree::Link(uint32_t node, uint32_t parent)
+{
+    Node &entry = nodes[node];
+    Node &parentEntry = nodes[parent];
+
+    entry.parent = parent;
+    entry.prevSibling = kInvalidNode;
+    entry.nextSibling = parentEntry.firstChild;
+
+    if (parentEntry.firstChild != kInvalidNode)
+    {
+        nodes[parentEntry.firstChild].prevSibling = node;
+    }
+
+    parentEntry.firstChild = node;
+}
+
+void WatchTree::Unlink(uint32_t node)
+{
+    Node &entry = nodes[node];
+
+    if (entry.prevSibling != kInvalidNode)
+    {
+        nodes[entry.prevSibling].nextSibling = entry.nextSibling;
+    }
+    else
+    {
+        nodes[entry.parent].firstChild = entry.nextSibling;
+    }
+
+    if (entry.nextSibling != kInvalidNode)
+    {
+        nodes[entry.nextSibling].prevSibling = entry.prevSibling;
+    }
+
+    entry.parent = kInvalidNode;
+    entry.prevSibling = kInvalidNode;
+    entry.nextSibling = kInvalidNode;
+}
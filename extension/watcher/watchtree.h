@@ -0,0 +1,117 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * FileWatcher Extension
+ * Copyright (C) 2022 KitRifty  All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "SourcePawn JIT," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.  AlliedModders LLC defines further
+ * exceptions, found in LICENSE.txt (as of this writing, version JULY-31-2007),
+ * or <http://www.sourcemod.net/license.php>.
+ */
+
+#ifndef WATCHTREE_H_
+#define WATCHTREE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "flatmap.h"
+
+// The directories a worker is watching, kept as a tree. Each node stores only
+// its own name and links to its parent and siblings; full paths are rebuilt
+// on demand. Moving a directory re-links one node, and removing one visits
+// only its subtree.
+class WatchTree
+{
+public:
+    static constexpr uint32_t kInvalidNode = UINT32_MAX;
+
+    WatchTree();
+
+    // Adds a node under the parent, or the root if the parent is
+    // kInvalidNode. Returns kInvalidNode if the descriptor is already in the
+    // tree.
+    uint32_t Add(uint32_t parent, int wd, const char *name, size_t length);
+
+    uint32_t Find(int wd) const;
+    uint32_t FindChild(uint32_t parent, const char *name, size_t length) const;
+
+    // Re-links the node under a new parent with a new name. Its descendants
+    // come along with it.
+    void Move(uint32_t node, uint32_t parent, const char *name, size_t length);
+
+    // Removes the node and everything below it, appending their descriptors
+    // to the list, and their node ids to the other if given.
+    void Remove(uint32_t node, std::vector<int> &descriptors, std::vector<uint32_t> *removedNodes = nullptr);
+
+    // Appends the node's path relative to the root, or to the base if given,
+    // separated by '/'. Nothing is appended for the root or the base.
+    void AppendPath(uint32_t node, std::string &out, uint32_t base = kInvalidNode) const;
+
+    // Whether the node is the base or below it.
+    bool IsWithin(uint32_t node, uint32_t base) const;
+
+    void Clear();
+
+    inline int GetDescriptor(uint32_t node) const { return nodes[node].wd; }
+    inline uint32_t GetRoot() const { return root; }
+    inline size_t GetSize() const { return size; }
+    inline bool IsEmpty() const { return size == 0; }
+
+    template <typename F>
+    void ForEach(F &&callback) const
+    {
+        for (auto it = nodes.begin(); it != nodes.end(); it++)
+        {
+            if (it->wd != -1)
+            {
+                callback((uint32_t)(it - nodes.begin()), it->wd);
+            }
+        }
+    }
+
+private:
+    struct Node
+    {
+        int wd;
+        uint32_t parent;
+        uint32_t firstChild;
+        uint32_t prevSibling;
+        uint32_t nextSibling;
+        std::string name;
+    };
+
+    void Link(uint32_t node, uint32_t parent);
+    void Unlink(uint32_t node);
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> freeNodes;
+    FlatHashMap<int, uint32_t> descriptors;
+    uint32_t root;
+    size_t size;
+
+    // Reused by Remove() to walk a subtree without recursion.
+    std::vector<uint32_t> stack;
+};
+
+#endif // WATCHTREE_H_